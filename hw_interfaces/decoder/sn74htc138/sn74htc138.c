@@ -5,35 +5,70 @@
 
 #include "sn74htc138.h"
 
+/*
+ * Port bits that select a line with the decoder enabled.
+ */
+static unsigned char line_bits(const sn74htc138_t *device, unsigned char line)
+{
+    unsigned char bits = 1 << device->enable_bit;
+    if (line & 0x1)
+        bits |= 1 << device->a_bit;
+    if (line & 0x2)
+        bits |= 1 << device->b_bit;
+    if (line & 0x4)
+        bits |= 1 << device->c_bit;
+    return bits;
+}
+
+static unsigned char decoder_mask(const sn74htc138_t *device)
+{
+    return (1 << device->a_bit) | (1 << device->b_bit) |
+           (1 << device->c_bit) | (1 << device->enable_bit);
+}
+
 void sn74htc138_decode(const sn74htc138_t *device, const unsigned char value) {
-    unsigned char a = 0, b = 0, c = 0, enable = 0;
+    unsigned char bits = 0;
     if (device->zero_based)
-    {
-        a = 0x1 & value;
-        b = (0x2 & value) >> 1;
-        c = (0x4 & value) >> 2;
-        enable = 1;
-    }
-    else if (value == 0)
-    {
-        enable = 0;
-    }
-    else
-    {
-        a = value == 0 ? 0 : 0x1 & value - 1;
-        b = value == 0 ? 0 : (0x2 & value - 1) >> 1;
-        c = value == 0 ? 0 : (0x4 & value - 1) >> 2;
-        enable = 1;
-    }
-    
-    *(device->port) =
-            (a << device->a_bit) |
-            (b << device->b_bit) |
-            (c << device->c_bit) |
-            (enable << device->enable_bit);
+        bits = line_bits(device, value);
+    else if (value != 0)
+        bits = line_bits(device, value - 1);
+
+    // only the decoder's own pins change
+    *(device->port) = (*(device->port) & ~decoder_mask(device)) | bits;
 }
 
 void sn74htc138_disable(const sn74htc138_t *device)
 {
     *(device->port) &= ~(1 << device->enable_bit);
-}
\ No newline at end of file
+}
+
+void sn74htc138_scan_init(sn74htc138_scan_t *scan, const sn74htc138_t *device)
+{
+    unsigned char line;
+    scan->port = device->port;
+    scan->mask = decoder_mask(device);
+    for (line = 0; line < SN74HTC138_LINES; line++)
+    {
+        scan->frame[line] = line_bits(device, line);
+        scan->on[line] = 0;
+    }
+    scan->line = 0;
+    scan->tick = 0;
+}
+
+void sn74htc138_scan_level(sn74htc138_scan_t *scan, unsigned char line, unsigned char on)
+{
+    if (on > SN74HTC138_STEPS)
+        on = SN74HTC138_STEPS;
+    scan->on[line & (SN74HTC138_LINES - 1)] = on;
+}
+
+void sn74htc138_scan_bitmap(sn74htc138_scan_t *scan, unsigned char bitmap, unsigned char on)
+{
+    unsigned char line;
+    for (line = 0; line < SN74HTC138_LINES; line++)
+    {
+        sn74htc138_scan_level(scan, line, (bitmap & 1) ? on : 0);
+        bitmap >>= 1;
+    }
+}
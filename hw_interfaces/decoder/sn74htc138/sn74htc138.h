@@ -21,8 +21,57 @@ typedef struct sn74htc138
     volatile unsigned char *port; // port dedicated to controlling the SN74HTC138
 } sn74htc138_t;
 
+#define SN74HTC138_LINES    8
+
+/*
+ * Ticks per line slot. A lit line stays on for 1 to SN74HTC138_STEPS ticks
+ * of its slot, giving that many brightness levels.
+ */
+#ifndef SN74HTC138_STEPS
+#define SN74HTC138_STEPS    4
+#endif
+
+/*
+ * Lamp scan state. frame[] holds the port bits that light each line, so
+ * the scan tick only ever does one masked write to the decoder's bits.
+ */
+typedef struct sn74htc138_scan
+{
+    volatile unsigned char *port;             // decoder port
+    unsigned char mask;                       // decoder bits in the port
+    unsigned char frame[SN74HTC138_LINES];    // port bits that light each line
+    unsigned char on[SN74HTC138_LINES];       // ticks each line is lit, 0 for dark
+    unsigned char line;                       // line of the current slot
+    unsigned char tick;                       // tick within the slot
+} sn74htc138_scan_t;
+
+/*
+ * Scan tick, called from the ISR at SN74HTC138_LINES * SN74HTC138_STEPS
+ * times the refresh rate. Writes the line at the start of its slot and
+ * blanks it after its on ticks; other pins on the port are left alone.
+ */
+#define sn74htc138_scan_int(s)                                              \
+    if ((s)->tick == 0)                                                     \
+        *(s)->port = (*(s)->port & ~(s)->mask) |                            \
+                     ((s)->on[(s)->line] ? (s)->frame[(s)->line] : 0);      \
+    else if ((s)->tick == (s)->on[(s)->line])                               \
+        *(s)->port &= ~(s)->mask;                                           \
+    if (++(s)->tick == SN74HTC138_STEPS) {                                  \
+        (s)->tick = 0;                                                      \
+        (s)->line = ((s)->line + 1) & (SN74HTC138_LINES - 1);               \
+    }
+
 void sn74htc138_decode(const sn74htc138_t *device, const unsigned char value);
 
 void sn74htc138_disable(const sn74htc138_t *device);
 
-#endif
\ No newline at end of file
+/* Precompute the frame for a decoder; every line starts dark */
+void sn74htc138_scan_init(sn74htc138_scan_t *scan, const sn74htc138_t *device);
+
+/* Set a line's brightness, 0 (dark) to SN74HTC138_STEPS */
+void sn74htc138_scan_level(sn74htc138_scan_t *scan, unsigned char line, unsigned char on);
+
+/* Light the lines set in bitmap at one brightness, darken the rest */
+void sn74htc138_scan_bitmap(sn74htc138_scan_t *scan, unsigned char bitmap, unsigned char on);
+
+#endif
@@ -3,6 +3,7 @@
  */
 
 #include "lcd.h"
+#include "lcd_bus.h"
  
 /*** LCD device with HD44780 driver ***/
 
@@ -22,26 +23,34 @@
  * 1: READ, LCD presents data
  */
 
-#define LCD_STROBE(x) ((x = 1),(x = 0))
-#define LCD_STROBE_SLOW(x) { \
-    x = 1;  \
-    __delay_us(1); \
-    x = 0;  \
-}
+/* TRUE for a two controller panel */
+#define lcd_dual(lcd) ((lcd)->geo->e2_line < (lcd)->geo->lines)
+
+/*
+ * Geometries of the common modules. Most 16x1 modules are wired as 8x2
+ * internally, the right half of the glass being the second line at 0x40,
+ * and are lcd_16x1_8x2; lcd_16x1 is for the few with one 16 character line.
+ */
+const lcd_geometry_t lcd_16x1 = { 16, 1, 1, { 0x00 } };
+const lcd_geometry_t lcd_16x1_8x2 = { 8, 2, 2, { 0x00, 0x40 } };
+const lcd_geometry_t lcd_16x2 = { 16, 2, 2, { 0x00, 0x40 } };
+const lcd_geometry_t lcd_16x4 = { 16, 4, 4, { 0x00, 0x40, 0x10, 0x50 } };
+const lcd_geometry_t lcd_20x2 = { 20, 2, 2, { 0x00, 0x40 } };
+const lcd_geometry_t lcd_20x4 = { 20, 4, 4, { 0x00, 0x40, 0x14, 0x54 } };
+const lcd_geometry_t lcd_40x2 = { 40, 2, 2, { 0x00, 0x40 } };
+const lcd_geometry_t lcd_40x4 = { 40, 4, 2, { 0x00, 0x40, 0x00, 0x40 } };
 
 static void lcd_cmd(LCD_t* lcd, unsigned char cmd);
-static void lcd_tx_byte(LCD_t* lcd, unsigned char byte);
+static void lcd_cmd_all(LCD_t* lcd, unsigned char cmd);
+static void lcd_init_ctrl(LCD_t* lcd);
+static void lcd_tx_byte(LCD_t* lcd, unsigned char rs, unsigned char byte);
 static void lcd_write(LCD_t* lcd, unsigned char byte);
-static unsigned char read_pin(unsigned char pin);
-static void write_pin(volatile unsigned char* pin, unsigned char data);
-static void strobe_pin(volatile unsigned char* pin);
-static void strobe_pin_slow(volatile unsigned char* pin);
 
 /*****************************************************************************
  * Subroutine: lcd_clear
  *
  * Description:
- * This subroutine clears the LCD and the address counter is reset.
+ * This subroutine clears the LCD and the cursor is returned home.
  *
  * Input Parameters:
  * LCD struct reference
@@ -50,14 +59,21 @@ static void strobe_pin_slow(volatile unsigned char* pin);
  * None
  *
  * Subroutines:
- * lcd_cmd
+ * lcd_cmd_all
  * __delay_ms
  *****************************************************************************/
 void lcd_clear(LCD_t* lcd)
 {
-    lcd_cmd(lcd, 0x01);
+#ifdef LCD_SCROLL
+    unsigned char lcv;
+
+    for (lcv = 0; lcv < LCD_SHADOW_LEN(lcd->geo->cols, lcd->geo->lines); lcv++)
+        lcd->shadow[lcv] = SPACE;
+#endif
+    lcd_cmd_all(lcd, 0x01);
     __delay_ms(2);
-    lcd->addr = LINE1_START_ADDR;
+    lcd->line = 0;
+    lcd->col = 0;
 }
 
 /*****************************************************************************
@@ -79,11 +95,37 @@ void lcd_clear(LCD_t* lcd)
  *****************************************************************************/
 static void lcd_cmd(LCD_t* lcd, unsigned char cmd)
 {
-    write_pin(lcd->rs_pin, 0);
-    write_pin(lcd->rw_pin, 0);
-    lcd_tx_byte(lcd, cmd);
+    lcd_tx_byte(lcd, 0, cmd);
 }    
 
+/*****************************************************************************
+ * Subroutine: lcd_cmd_all
+ *
+ * Description:
+ * This private subroutine sends a command to every controller of the
+ * panel and leaves the first one addressed.
+ *
+ * Input Parameters:
+ * LCD struct reference
+ * LCD Command
+ *
+ * Output Parameters:
+ * None
+ *
+ * Subroutines:
+ * lcd_cmd
+ *****************************************************************************/
+static void lcd_cmd_all(LCD_t* lcd, unsigned char cmd)
+{
+    if (lcd_dual(lcd))
+    {
+        lcd->e2 = 1;
+        lcd_cmd(lcd, cmd);
+    }
+    lcd->e2 = 0;
+    lcd_cmd(lcd, cmd);
+}
+
 /*****************************************************************************
  * Subroutine: lcd_disable
  *
@@ -97,35 +139,37 @@ static void lcd_cmd(LCD_t* lcd, unsigned char cmd)
  * None
  *
  * Subroutines:
- * None
+ * lcd_bus_idle
  *****************************************************************************/
 void lcd_disable(LCD_t* lcd)
 {
-    write_pin(lcd->en_pin, 0);
-    write_pin(lcd->rw_pin, 0);
+    lcd_bus_idle(lcd);
 }
 
 /*****************************************************************************
- * Subroutine: lcd_disable
+ * Subroutine: lcd_goto
  *
  * Description:
- * This subroutine disables the LCD.
+ * This subroutine moves the cursor to a line and column, looking up the
+ * line's DD RAM address and controller in the geometry.
  *
  * Input Parameters:
  * LCD struct reference
- * LCD address
+ * Line, 0 based
+ * Column, 0 based
  *
  * Output Parameters:
- * lcd_en
- * lcd_rw
+ * None
  *
  * Subroutines:
  * lcd_cmd
  *****************************************************************************/
-void lcd_goto(LCD_t* lcd, unsigned char address)
+void lcd_goto(LCD_t* lcd, unsigned char line, unsigned char col)
 {
-    lcd_cmd(lcd, 0x80 | address);
-    lcd->addr = address;
+    lcd->e2 = line >= lcd->geo->e2_line;
+    lcd_cmd(lcd, 0x80 | (lcd->geo->line_addr[line] + col));
+    lcd->line = line;
+    lcd->col = col;
 }
 
 /*****************************************************************************
@@ -141,21 +185,23 @@ void lcd_goto(LCD_t* lcd, unsigned char address)
  * None
  *
  * Subroutines:
- * lcd_cmd
+ * lcd_cmd_all
  * __delay_ms
  *****************************************************************************/
 void lcd_home(LCD_t* lcd)
 {
-    lcd_cmd(lcd, 0x2);
+    lcd_cmd_all(lcd, 0x2);
     __delay_ms(2);
-    lcd->addr = LINE1_START_ADDR;
+    lcd->line = 0;
+    lcd->col = 0;
 }    
 
 /*****************************************************************************
  * Subroutine: lcd_init
  *
  * Description:
- * This subroutine initializes the LCD device.
+ * This subroutine initializes the LCD device, both controllers of a two
+ * controller panel.
  *
  * Input Parameters:
  * LCD struct reference
@@ -164,51 +210,77 @@ void lcd_home(LCD_t* lcd)
  * None
  *
  * Subroutines:
+ * lcd_bus_init
  * lcd_clear
- * lcd_tx_byte
+ * lcd_init_ctrl
  * __delay_ms
- * __delay_us
  *****************************************************************************/
 void lcd_init(LCD_t* lcd)
 {
-    write_pin(lcd->rw_pin, 0);
-    write_pin(lcd->rs_pin, 0);
+    lcd_bus_init(lcd);
     
     /*** Power-On Initialization ***/
     /* Wait 15 ms */
     __delay_ms(15);
     
+    if (lcd_dual(lcd))
+    {
+        lcd->e2 = 1;
+        lcd_init_ctrl(lcd);
+    }
+    lcd->e2 = 0;
+    lcd_init_ctrl(lcd);
+    
+    lcd_clear(lcd);
+}
+
+/*****************************************************************************
+ * Subroutine: lcd_init_ctrl
+ *
+ * Description:
+ * This private subroutine runs the 4-bit initialization sequence on the
+ * controller being addressed.
+ *
+ * Input Parameters:
+ * LCD struct reference
+ *
+ * Output Parameters:
+ * None
+ *
+ * Subroutines:
+ * lcd_bus_nibble
+ * lcd_cmd
+ * __delay_ms
+ * __delay_us
+ *****************************************************************************/
+static void lcd_init_ctrl(LCD_t* lcd)
+{
     /* Write 0x3, pulse enable, wait 4.1 ms or longer */
-    *lcd->data_bus = 0x3 << lcd->bus_offset;
-    strobe_pin(lcd->en_pin);
+    lcd_bus_nibble(lcd, 0, 0x3);
     __delay_ms(5);
     
     /* Write 0x3, pulse enable, wait 100 us or longer */
-    *lcd->data_bus = 0x3 << lcd->bus_offset;
-    strobe_pin(lcd->en_pin);
+    lcd_bus_nibble(lcd, 0, 0x3);
     __delay_us(100);
     
     /* Write 0x3, pulse enable, wait 40 us or longer */
-    *lcd->data_bus = 0x3 << lcd->bus_offset;
-    strobe_pin(lcd->en_pin);
+    lcd_bus_nibble(lcd, 0, 0x3);
     __delay_us(40);
     
     /* Write 0x2, pulse enable, wait 40 us or longer */
-    *lcd->data_bus = 0x2 << lcd->bus_offset; /* Set 4-bit mode */
-    strobe_pin(lcd->en_pin);
+    lcd_bus_nibble(lcd, 0, 0x2); /* Set 4-bit mode */
     __delay_us(40);
     
     /*** Display Configuration ***/
-    lcd_tx_byte(lcd, 0x28); /* 4-bit operation */
+    /* 4-bit operation, one or two line mode */
+    lcd_cmd(lcd, lcd->geo->lines > 1 ? 0x28 : 0x20);
     __delay_us(40);
     
-    lcd_tx_byte(lcd, 0x06); /* Automatically increase address pointer */
+    lcd_cmd(lcd, 0x06); /* Automatically increase address pointer */
     __delay_us(40);
     
-    lcd_tx_byte(lcd, 0x0C); /* Turn display on */
+    lcd_cmd(lcd, 0x0C); /* Turn display on */
     __delay_us(40);
-    
-    lcd_clear(lcd);
 }
 
 /*****************************************************************************
@@ -229,7 +301,6 @@ void lcd_init(LCD_t* lcd)
  *****************************************************************************/
 void lcd_putch(LCD_t* lcd, unsigned char data)
 {
-    write_pin(lcd->rs_pin, 1);
     lcd_write(lcd, data);  
 }
 
@@ -251,37 +322,83 @@ void lcd_putch(LCD_t* lcd, unsigned char data)
  *****************************************************************************/
 void lcd_puts(LCD_t* lcd, const char *data)
 {
-    write_pin(lcd->rs_pin, 1);
     while (*data)
         lcd_write(lcd, *data++);  
 }
 
+#ifdef LCD_SCROLL
+/*****************************************************************************
+ * Subroutine: lcd_scroll
+ *
+ * Description:
+ * This subroutine moves every line up one and blanks the last, leaving the
+ * cursor at the start of the last line. The LCD is only ever written, so
+ * the lines are redrawn from the shadow copy of lines 2 and up.
+ *
+ * Input Parameters:
+ * LCD struct reference
+ *
+ * Output Parameters:
+ * None
+ *
+ * Subroutines:
+ * lcd_goto
+ * lcd_tx_byte
+ *****************************************************************************/
+void lcd_scroll(LCD_t* lcd)
+{
+    unsigned char line, col, last, cols;
+    unsigned char* row;
+
+    last = lcd->geo->lines - 1;
+    cols = lcd->geo->cols;
+    row = lcd->shadow;
+    for (line = 0; line < last; line++, row += cols)
+    {
+        lcd_goto(lcd, line, 0);
+        for (col = 0; col < cols; col++)
+        {
+            lcd_tx_byte(lcd, 1, row[col]);
+            /* The shadow row of this line takes the next line's text */
+            row[col] = (line + 1 < last) ? row[col + cols] : SPACE;
+        }
+    }
+
+    lcd_goto(lcd, last, 0);
+    for (col = 0; col < cols; col++)
+        lcd_tx_byte(lcd, 1, SPACE);
+
+    lcd_goto(lcd, last, 0);
+}
+#endif
+
 /*****************************************************************************
  * Subroutine: lcd_tx_byte
  *
  * Description:
- * This private subroutine transmits a character to the LCD's DD RAM. This
- * subroutine bypasses the address counter in lcd_write(unsigned char).
+ * This private subroutine transmits a byte to the LCD, a character to the
+ * DD RAM or an instruction. This subroutine bypasses the cursor tracking
+ * in lcd_write(unsigned char).
  *
  * Input Parameters:
  * LCD struct reference
+ * Register select, 1 for a character
  * Byte to write to LCD 
  *
  * Output Parameters:
  * None
  *
  * Subroutines:
+ * lcd_bus_nibble
  * __delay_us
  *****************************************************************************/
-static void lcd_tx_byte(LCD_t* lcd, unsigned char byte)
+static void lcd_tx_byte(LCD_t* lcd, unsigned char rs, unsigned char byte)
 {
     /* Transfer upper nibble first */
-    *lcd->data_bus = ((byte >> 4) << lcd->bus_offset) | (*lcd->data_bus & 0x0F);
-    strobe_pin_slow(lcd->en_pin);
+    lcd_bus_nibble(lcd, rs, byte >> 4);
     
     /* Transfer lower nibble */
-    *lcd->data_bus = ((byte & 0xF) << lcd->bus_offset) | (*lcd->data_bus & 0x0F);
-    strobe_pin_slow(lcd->en_pin);
+    lcd_bus_nibble(lcd, rs, byte & 0xF);
     
     __delay_us(40);
 }
@@ -304,85 +421,60 @@ static void lcd_tx_byte(LCD_t* lcd, unsigned char byte)
  *****************************************************************************/
 static void lcd_write(LCD_t* lcd, unsigned char byte)
 {
-    unsigned char rs_tmp, rw_tmp, ret, nwl_addr;
+    unsigned char last;
     
-    rs_tmp = read_pin(*lcd->rs_pin);
-    rw_tmp = read_pin(*lcd->rw_pin);
+    last = lcd->geo->lines - 1;
     
-    ret = (byte == NWL || byte == CR || byte == ETX);
-    if (ret)                                    /* Check for newline */
+    if (byte == NWL || byte == CR || byte == ETX) /* Check for newline */
     {
-        nwl_addr = (lcd->addr <= LINE1_END_ADDR+1) ? LINE2_START_ADDR : 
-            LINE1_START_ADDR;
-        lcd_cmd(lcd, 0x80 | nwl_addr);
-        lcd->addr = nwl_addr;
-        write_pin(lcd->rs_pin, rs_tmp);
-        write_pin(lcd->rw_pin, rw_tmp);
+#ifdef LCD_SCROLL
+        if (lcd->line == last)
+            lcd_scroll(lcd);
+        else
+            lcd_goto(lcd, lcd->line + 1, 0);
+#else
+        lcd_goto(lcd, (lcd->line == last) ? 0 : lcd->line + 1, 0);
+#endif
         return;
     }
     else if (byte == BACKSPACE || byte == DEL)  /* Check for backspace */
     {
-        /* Decrement address */
-        if (lcd->addr == LINE1_START_ADDR)
-        {
-            /* Do nothing */
-        }
+        /* Step back, onto the end of the previous line at column 0 */
+        if (lcd->col)
+            lcd_goto(lcd, lcd->line, lcd->col - 1);
+        else if (lcd->line)
+            lcd_goto(lcd, lcd->line - 1, lcd->geo->cols - 1);
         else
-        {
-            lcd->addr = (lcd->addr == LINE2_START_ADDR) ? LINE1_END_ADDR : lcd->addr - 1;
-        }
-        
-        lcd_cmd(lcd, 0x80 | lcd->addr); /* Go to new address */
+            lcd_goto(lcd, 0, 0);
         
         /* Replace previous char with space */
-        write_pin(lcd->rs_pin, 1); /* Rather not call lcd_write again */
-        lcd_tx_byte(lcd, SPACE);   /*                                 */
+        lcd_tx_byte(lcd, 1, SPACE); /* Rather not call lcd_write again */
+#ifdef LCD_SCROLL
+        if (lcd->line)
+            lcd->shadow[(lcd->line - 1) * lcd->geo->cols + lcd->col] = SPACE;
+#endif
         
-        lcd_cmd(lcd, 0x80 | lcd->addr); /* Go back to new address */
-        
-        write_pin(lcd->rs_pin, rs_tmp);
-        write_pin(lcd->rw_pin, rw_tmp);
+        lcd_goto(lcd, lcd->line, lcd->col); /* Go back to new address */
         return;
     }    
-    else if (lcd->addr == LINE1_END_ADDR+1)          /* End of first line */
-    {
-        write_pin(lcd->rs_pin, 0);
-        write_pin(lcd->rw_pin, 0);
-        lcd_tx_byte(lcd, 0x80 | LINE2_START_ADDR);
-        lcd->addr = LINE2_START_ADDR;
-    }
-    else if (lcd->addr == LINE2_END_ADDR+1)          /* End of second line */
+    else if (lcd->col == lcd->geo->cols)        /* End of a line */
     {
-        lcd_clear(lcd);
-        lcd->addr = LINE1_START_ADDR;
+        if (lcd->line < last)
+            lcd_goto(lcd, lcd->line + 1, 0);
+        else
+        {
+#ifdef LCD_SCROLL
+            lcd_scroll(lcd);
+#else
+            lcd_clear(lcd);
+#endif
+        }
     }
     
-    write_pin(lcd->rs_pin, rs_tmp);
-    write_pin(lcd->rw_pin, rw_tmp);
-    lcd_tx_byte(lcd, byte);
-    ++lcd->addr;
+    lcd_tx_byte(lcd, 1, byte);
+#ifdef LCD_SCROLL
+    if (lcd->line)
+        lcd->shadow[(lcd->line - 1) * lcd->geo->cols + lcd->col] = byte;
+#endif
+    ++lcd->col;
 }
-
-static unsigned char read_pin(unsigned char pin)
-{
-    return pin & 1;
-}
-
-static void write_pin(volatile unsigned char* pin, unsigned char data)
-{
-    *pin |= data & 1;
-}
-
-static void strobe_pin(volatile unsigned char* pin)
-{
-    write_pin(pin, 1);
-    write_pin(pin, 0);
-}
-
-static void strobe_pin_slow(volatile unsigned char* pin)
-{
-    write_pin(pin, 1);
-    __delay_us(1);
-    write_pin(pin, 0);
-}
-
@@ -17,30 +17,89 @@
 #define NWL       '\n'          /* New line */
 #define SPACE     0x20          /* Space */
 
-#define CHAR_PER_LINE         16 /* Characters per line on LCD device */
-#define NUM_LINES              2 /* Number of lines on LCD device */
+#define LCD_MAX_LINES          4 /* Most lines a geometry describes */
 
-#define LINE1_START_ADDR    0x00 /* Starting address of line 1 */
-#define LINE2_START_ADDR    0x40 /* Starting address of line 2 */
-#define LINE1_END_ADDR      0x0F /* End address of line 1 */
-#define LINE2_END_ADDR      0x4F /* End address of line 2 */
-
-#define LCD_LINE1           0x00
-#define LCD_LINE2           0x40
+#define LCD_LINE1              0 /* Line numbers for lcd_goto() */
+#define LCD_LINE2              1
+#define LCD_LINE3              2
+#define LCD_LINE4              3
 
 #define CHAR_DEGREE         0xDF /* Degree symbol */
 
+/*
+ * Display geometry. line_addr holds the DD RAM address of each line's
+ * first column. A 40x4 panel is two 40x2 controllers sharing the bus;
+ * lines from e2_line on are on the second one, strobed by the second
+ * enable pin.
+ */
+typedef struct lcd_geometry
+{
+    unsigned char cols;                     // characters per line
+    unsigned char lines;                    // lines, both controllers together
+    unsigned char e2_line;                  // first line of the second controller, lines if none
+    unsigned char line_addr[LCD_MAX_LINES]; // DD RAM address of each line
+} lcd_geometry_t;
+
+extern const lcd_geometry_t lcd_16x1;
+extern const lcd_geometry_t lcd_16x1_8x2;   /* 16x1 glass driven as 8x2 */
+extern const lcd_geometry_t lcd_16x2;
+extern const lcd_geometry_t lcd_16x4;
+extern const lcd_geometry_t lcd_20x2;
+extern const lcd_geometry_t lcd_20x4;
+extern const lcd_geometry_t lcd_40x2;
+extern const lcd_geometry_t lcd_40x4;
+
+/* Bytes of the scroll copy for a geometry: every line but the first */
+#define LCD_SHADOW_LEN(cols, lines) ((cols) * ((lines) - 1))
+
+/*
+ * Bus. By default the LCD sits on a 4-bit parallel bus: the data lines are
+ * four adjacent bits of data_bus and the control pins are bits of
+ * ctrl_port, given as masks.
+ *
+ * Built with -DLCD_SPI, the LCD sits behind a 74HC595 shift register
+ * clocked by the SSP in SPI master mode, and takes three pins: SCK, SDO
+ * and the register clock, LCD_SPI_LATCH. Each nibble is two SPI bytes,
+ * one with EN high and one with EN low. RW is tied low. The 595 outputs
+ * are wired as below.
+ */
+#ifdef LCD_SPI
+#define LCD_SR_RS           0x01 /* QA: register select */
+#define LCD_SR_EN           0x04 /* QC: enable */
+#define LCD_SR_EN2          0x08 /* QD: enable of the second controller */
+#define LCD_SR_DATA            4 /* QE..QH: D4..D7 */
+
+#ifndef LCD_SPI_LATCH
+#define LCD_SPI_LATCH       PORTAbits.RA5   /* RA5 is SS, free in master mode */
+#define LCD_SPI_LATCH_TRIS  TRISAbits.TRISA5
+#endif
+#ifndef LCD_SPI_SCK_TRIS
+#define LCD_SPI_SCK_TRIS    TRISCbits.TRISC6
+#define LCD_SPI_SDO_TRIS    TRISCbits.TRISC4
+#endif
+#endif
+
 /*
  * Represents an LCD device
  */
 typedef struct LCD
 {
+#ifndef LCD_SPI
     volatile unsigned char* data_bus;   // data bus
     unsigned char bus_offset;           // offset in bus to data lines
-    volatile unsigned char* en_pin;     // enable pin
-    volatile unsigned char* rs_pin;     // register select pin
-    volatile unsigned char* rw_pin;     // register write pin
-    unsigned char addr;                 // address counter
+    volatile unsigned char* ctrl_port;  // port of the control pins
+    unsigned char en_mask;              // enable pin
+    unsigned char en2_mask;             // enable pin of the second controller, 40x4 only
+    unsigned char rs_mask;              // register select pin
+    unsigned char rw_mask;              // register write pin
+#endif
+    const lcd_geometry_t* geo;          // display geometry
+    unsigned char line;                 // cursor line
+    unsigned char col;                  // cursor column, geo->cols once the line is full
+    unsigned char e2;                   // TRUE while the second controller is addressed
+#ifdef LCD_SCROLL
+    unsigned char* shadow;              // LCD_SHADOW_LEN bytes, copy of lines 2 on for scrolling
+#endif
 } LCD_t;
 
 /* Clear and home the LCD */
@@ -49,8 +108,8 @@ void lcd_clear(LCD_t* lcd);
 /* Disable LCD display */
 void lcd_disable(LCD_t* lcd);
 
-/* Move cursor to address */
-void lcd_goto(LCD_t* lcd, unsigned char pos);
+/* Move cursor to a line and column */
+void lcd_goto(LCD_t* lcd, unsigned char line, unsigned char col);
 
 /* Return cursor home */
 void lcd_home(LCD_t* lcd);
@@ -58,6 +117,15 @@ void lcd_home(LCD_t* lcd);
 /* Initilization LCD device */
 void lcd_init(LCD_t* lcd);
 
+#ifdef LCD_SCROLL
+/*
+ * Move every line up one and blank the last. Built with LCD_SCROLL,
+ * writing past the end of the last line or a newline on it scrolls
+ * instead of clearing the LCD.
+ */
+void lcd_scroll(LCD_t* lcd);
+#endif
+
 /* Write a string to the LCD */
 void lcd_putch(LCD_t* lcd, unsigned char byte);
 
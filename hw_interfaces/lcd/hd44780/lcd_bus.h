@@ -0,0 +1,26 @@
+/*
+ * Author: Kevin Macksamie
+ *
+ * LCD bus interface, used by lcd.c only. lcd_parallel.c drives a 4-bit
+ * parallel bus and lcd_hc595.c a 74HC595 on the SSP; -DLCD_SPI picks the
+ * second one.
+ */
+
+#ifndef LCD_BUS_H
+#define LCD_BUS_H
+
+#include "lcd.h"
+
+/* Set the pins up and leave the bus idle, before the power-on sequence */
+void lcd_bus_init(LCD_t* lcd);
+
+/*
+ * Clock a nibble into the controller being addressed, lcd->e2. rs is 1
+ * for data and 0 for an instruction.
+ */
+void lcd_bus_nibble(LCD_t* lcd, unsigned char rs, unsigned char nibble);
+
+/* Drop the enables and leave the bus idle */
+void lcd_bus_idle(LCD_t* lcd);
+
+#endif
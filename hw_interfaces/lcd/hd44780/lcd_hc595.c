@@ -0,0 +1,116 @@
+/*
+ * Author: Kevin Macksamie
+ *
+ * LCD bus through a 74HC595 shift register, built with -DLCD_SPI. The SSP
+ * shifts each pattern out in SPI master mode at Fosc/4 and LCD_SPI_LATCH
+ * clocks it onto the 595 outputs, see the wiring in lcd.h.
+ *
+ * A nibble is two SPI bytes, the pattern with EN high and then the same
+ * pattern with EN low. Shifting the second byte takes 32 instruction
+ * cycles, longer than the enable pulse the controller needs, so no delay
+ * is spent. The data and RS are set up by the first latch, ahead of EN.
+ *
+ * On the PIC16F913, SCK is RC6, also the USART TX, and SDO is RC4. A
+ * board using LCD_SPI must keep the USART and the 1-Wire bus off them.
+ */
+
+#include "lcd_bus.h"
+
+#ifdef LCD_SPI
+
+static void lcd_sr_write(unsigned char pattern);
+
+/*****************************************************************************
+ * Subroutine: lcd_bus_idle
+ *
+ * Description:
+ * This subroutine drops both enables.
+ *
+ * Input Parameters:
+ * LCD struct reference
+ *
+ * Output Parameters:
+ * None
+ *
+ * Subroutines:
+ * lcd_sr_write
+ *****************************************************************************/
+void lcd_bus_idle(LCD_t* lcd)
+{
+    lcd_sr_write(0);
+}
+
+/*****************************************************************************
+ * Subroutine: lcd_bus_init
+ *
+ * Description:
+ * This subroutine sets the SSP up as an SPI master, mode 0 at Fosc/4, and
+ * clears the 595 outputs.
+ *
+ * Input Parameters:
+ * LCD struct reference
+ *
+ * Output Parameters:
+ * None
+ *
+ * Subroutines:
+ * lcd_sr_write
+ *****************************************************************************/
+void lcd_bus_init(LCD_t* lcd)
+{
+    LCD_SPI_LATCH = 0;
+    LCD_SPI_LATCH_TRIS = 0;
+    LCD_SPI_SCK_TRIS = 0;
+    LCD_SPI_SDO_TRIS = 0;
+
+    SSPSTAT = 0x40;     /* CKE: data changes as SCK falls, the 595 samples as it rises */
+    SSPCON = 0x20;      /* SSPEN, SCK idles low, master at Fosc/4 */
+
+    lcd_sr_write(0);
+}
+
+/*****************************************************************************
+ * Subroutine: lcd_bus_nibble
+ *
+ * Description:
+ * This subroutine shifts a nibble out with EN high, then again with EN
+ * low. The controller latches it on the falling edge.
+ *
+ * Input Parameters:
+ * LCD struct reference
+ * Register select, 1 for data
+ * Nibble to write
+ *
+ * Output Parameters:
+ * None
+ *
+ * Subroutines:
+ * lcd_sr_write
+ *****************************************************************************/
+void lcd_bus_nibble(LCD_t* lcd, unsigned char rs, unsigned char nibble)
+{
+    unsigned char pattern;
+
+    pattern = nibble << LCD_SR_DATA;
+    if (rs)
+        pattern |= LCD_SR_RS;
+
+    lcd_sr_write(pattern | (lcd->e2 ? LCD_SR_EN2 : LCD_SR_EN));
+    lcd_sr_write(pattern);
+}
+
+/*
+ * Shift a pattern out and latch it onto the 595 outputs.
+ */
+static void lcd_sr_write(unsigned char pattern)
+{
+    SSPBUF = pattern;
+    while (!BF)
+        continue;
+    pattern = SSPBUF;   /* Reading SSPBUF clears BF */
+
+    LCD_SPI_LATCH = 1;
+    LCD_SPI_LATCH = 0;
+}
+
+#endif
@@ -0,0 +1,89 @@
+/*
+ * Author: Kevin Macksamie
+ *
+ * 4-bit parallel LCD bus. The data lines are bus_offset up in data_bus;
+ * EN, EN2, RS and RW are bits of ctrl_port. Other pins on both ports are
+ * left alone.
+ */
+
+#include "lcd_bus.h"
+
+#ifndef LCD_SPI
+
+/* Enable pin of the controller being addressed */
+#define lcd_en(lcd) ((lcd)->e2 ? (lcd)->en2_mask : (lcd)->en_mask)
+
+/*****************************************************************************
+ * Subroutine: lcd_bus_idle
+ *
+ * Description:
+ * This subroutine drops both enables and RW.
+ *
+ * Input Parameters:
+ * LCD struct reference
+ *
+ * Output Parameters:
+ * None
+ *
+ * Subroutines:
+ * None
+ *****************************************************************************/
+void lcd_bus_idle(LCD_t* lcd)
+{
+    *lcd->ctrl_port &= ~(lcd->en_mask | lcd->en2_mask | lcd->rw_mask);
+}
+
+/*****************************************************************************
+ * Subroutine: lcd_bus_init
+ *
+ * Description:
+ * This subroutine leaves the control pins low. The pins must already be
+ * outputs.
+ *
+ * Input Parameters:
+ * LCD struct reference
+ *
+ * Output Parameters:
+ * None
+ *
+ * Subroutines:
+ * None
+ *****************************************************************************/
+void lcd_bus_init(LCD_t* lcd)
+{
+    *lcd->ctrl_port &= ~(lcd->en_mask | lcd->en2_mask | lcd->rs_mask | lcd->rw_mask);
+}
+
+/*****************************************************************************
+ * Subroutine: lcd_bus_nibble
+ *
+ * Description:
+ * This subroutine puts a nibble on the data lines and pulses enable. The
+ * controller latches it on the falling edge.
+ *
+ * Input Parameters:
+ * LCD struct reference
+ * Register select, 1 for data
+ * Nibble to write
+ *
+ * Output Parameters:
+ * None
+ *
+ * Subroutines:
+ * __delay_us
+ *****************************************************************************/
+void lcd_bus_nibble(LCD_t* lcd, unsigned char rs, unsigned char nibble)
+{
+    if (rs)
+        *lcd->ctrl_port |= lcd->rs_mask;
+    else
+        *lcd->ctrl_port &= ~lcd->rs_mask;
+
+    *lcd->data_bus = (*lcd->data_bus & ~(0x0F << lcd->bus_offset)) | (nibble << lcd->bus_offset);
+
+    *lcd->ctrl_port |= lcd_en(lcd);
+    __delay_us(1);
+    *lcd->ctrl_port &= ~lcd_en(lcd);
+}
+
+#endif
@@ -4,9 +4,7 @@
  *
  */
 #include "owire.h"
-#ifndef NODEBUG
-#include "ser.h"
-#endif
+#include "log.h"
 
 /*
  * Definitions 1-Wire hardware interface
@@ -14,6 +12,23 @@
 #define DQ_TRIS TRISCbits.TRISC4
 #define DQ_PIN  PORTCbits.RC4
 
+/*
+ * Interrupts are held off across the timing critical part of each slot so
+ * a tick or UART interrupt cannot stretch a pulse. At most one slot (70 us)
+ * of interrupt latency is added.
+ */
+#define SLOT_BEGIN()    { unsigned char gie = GIE; GIE = 0;
+#define SLOT_END()      GIE = gie; }
+
+unsigned int owire_no_presence;
+unsigned int owire_shorts;
+
+#ifdef OWIRE_SEGMENTS
+static const sn74htc138_t *owire_decoder;
+unsigned char owire_segment_now = OWIRE_NO_SEGMENT;
+unsigned int owire_switches;
+#endif
+
 void owire_drive_low()
 {
     DQ_TRIS = 0;    // make dq an output pin
@@ -44,6 +59,49 @@ void owire_write_byte(unsigned char write_byte)
     }
 }
 
+void owire_write_byte_spu(unsigned char write_byte)
+{
+    unsigned char lcv;
+    for (lcv = 0; lcv < 7; lcv++)
+    {
+        owire_write_bit(write_byte & 0x01);
+        write_byte >>= 1;
+    }
+
+    // the pullup must be on within 10 us of the end of the command
+    SLOT_BEGIN();
+    owire_drive_low();
+    if (write_byte & 0x01)
+    {
+        __delay_us(6);
+        owire_strong_pullup(1);
+        __delay_us(64);
+    }
+    else
+    {
+        __delay_us(60);
+        owire_strong_pullup(1);
+        __delay_us(10);
+    }
+    SLOT_END();
+}
+
+#ifdef OWIRE_SPU_PIN
+void owire_strong_pullup(unsigned char on)
+{
+    OWIRE_SPU_TRIS = 0;
+    OWIRE_SPU_PIN = !on;    // gate low turns the MOSFET on
+}
+#else
+void owire_strong_pullup(unsigned char on)
+{
+    if (on)
+        owire_drive_high();
+    else
+        DQ_TRIS = 1;        // back to the resistor pullup
+}
+#endif
+
 unsigned char owire_read_byte()
 {
     unsigned char lcv;
@@ -62,26 +120,39 @@ unsigned char owire_read_byte()
 unsigned char owire_reset_pulse()
 {
     unsigned char presence;
+    owire_strong_pullup(0);
+    __delay_us(5);
+    if (!owire_read())
+    {
+        LOG(OWIRE, LOG_ERROR, "owire_reset_pulse(): bus shorted low");
+        ++owire_shorts;
+        return 0;
+    }
+
     DQ_PIN = 1;                 // release bus
     owire_drive_low();
     __delay_us(480);
+    SLOT_BEGIN();
     DQ_PIN = 1;                 // release bus
     __delay_us(70);
     presence = owire_read();    // sample bus
+    SLOT_END();
     __delay_us(410);
 
-#ifndef NODEBUG
     if (presence == 1)
-        ser_puts("owire_reset_pulse(): no device present\n\r");
-    else if (presence == 0)
-        ser_puts("owire_reset_pulse(): device(s) present\n\r");
-#endif
-    
+    {
+        LOG(OWIRE, LOG_WARN, "owire_reset_pulse(): no device present");
+        ++owire_no_presence;
+    }
+    else
+        LOG(OWIRE, LOG_DEBUG, "owire_reset_pulse(): device(s) present");
+
     return !presence;
 }
 
 void owire_write_bit(const unsigned char write_bit)
 {
+    SLOT_BEGIN();
     owire_drive_low();
     if (write_bit == 1)
     {
@@ -95,16 +166,38 @@ void owire_write_bit(const unsigned char write_bit)
         DQ_PIN = 1;     // release bus
         __delay_us(10);
     }
+    SLOT_END();
 }
 
 unsigned char owire_read_bit()
 {
     unsigned char read_bit;
+    SLOT_BEGIN();
     owire_drive_low();          // drive bus low
     __delay_us(6);
     DQ_PIN = 1;                 // release bus
     __delay_us(9);
     read_bit = owire_read();    // sample bus
+    SLOT_END();
     __delay_us(55);
     return read_bit;
 }
+
+#ifdef OWIRE_SEGMENTS
+void owire_segment_init(const sn74htc138_t *decoder)
+{
+    owire_decoder = decoder;
+    owire_segment_now = OWIRE_NO_SEGMENT;
+    sn74htc138_disable(decoder);
+}
+
+void owire_segment(unsigned char segment)
+{
+    if (segment == owire_segment_now)
+        return;
+    sn74htc138_decode(owire_decoder, segment);
+    owire_segment_now = segment;
+    ++owire_switches;
+    __delay_us(OWIRE_SEGMENT_SETTLE_US);
+}
+#endif
@@ -24,13 +24,57 @@ unsigned char owire_read();
 
 void owire_write_byte(unsigned char write_byte);
 
+/*
+ * Write a byte and switch the strong pullup on as its last slot ends, for
+ * commands that power parasite devices (Convert T, Copy Scratchpad). The
+ * pullup stays on until owire_strong_pullup(0) or the next reset pulse.
+ */
+void owire_write_byte_spu(unsigned char write_byte);
+
+/*
+ * Strong pullup. Define OWIRE_SPU_PIN and OWIRE_SPU_TRIS for a P-channel
+ * MOSFET from VDD to DQ with its gate on that pin; otherwise the DQ pin is
+ * driven high and sources the current itself.
+ */
+void owire_strong_pullup(unsigned char on);
+
 unsigned char owire_read_byte();
 
+/*
+ * Reset pulse; returns 1 if a device answered with a presence pulse. A bus
+ * held low before the pulse counts as shorted and is not pulsed.
+ */
 unsigned char owire_reset_pulse();
 
 void owire_write_bit(const unsigned char write_bit);
 
 unsigned char owire_read_bit();
 
+#ifdef OWIRE_SEGMENTS
+#include "sn74htc138.h"
+
+/*
+ * Bus segments. Built with -DOWIRE_SEGMENTS, DQ reaches one of up to eight
+ * bus segments through analog switches enabled by the outputs of a
+ * zero-based SN74HTC138. Only the connected segment sees bus traffic.
+ */
+#ifndef OWIRE_SEGMENT_COUNT
+#define OWIRE_SEGMENT_COUNT     8
+#endif
+#define OWIRE_SEGMENT_SETTLE_US 20      // switch on time plus pullup rise
+#define OWIRE_NO_SEGMENT        0xFF
+
+void owire_segment_init(const sn74htc138_t *decoder);
+
+/* Connect a segment; nothing is switched if it already is connected */
+void owire_segment(unsigned char segment);
+
+extern unsigned char owire_segment_now;     // connected segment
+extern unsigned int owire_switches;         // segment changes
+#endif
+
+extern unsigned int owire_no_presence;  // reset pulses nobody answered
+extern unsigned int owire_shorts;       // reset pulses skipped, bus held low
+
 #endif	/* OWIRE_H */
 
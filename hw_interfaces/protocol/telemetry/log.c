@@ -0,0 +1,21 @@
+/*
+ * File:   log.c
+ * Author: Kevin Macksamie
+ */
+#include "log.h"
+#include "telem.h"
+
+void log_emit(unsigned char mod_lvl, unsigned int line, unsigned char nargs,
+        unsigned int a, unsigned int b)
+{
+    unsigned char payload[7];
+
+    payload[0] = mod_lvl;
+    payload[1] = line >> 8;
+    payload[2] = line & 0xFF;
+    payload[3] = a >> 8;
+    payload[4] = a & 0xFF;
+    payload[5] = b >> 8;
+    payload[6] = b & 0xFF;
+    telem_emit(TELEM_T_LOG, payload, 3 + 2 * nargs);   // drops are counted by telem
+}
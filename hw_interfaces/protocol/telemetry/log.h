@@ -0,0 +1,73 @@
+/*
+ * File:   log.h
+ * Author: Kevin Macksamie
+ *
+ * Tokenized logging. A log call sends a LOG telemetry frame holding only
+ * the module, level, source line and binary arguments. The format string
+ * never reaches the MCU: tools/logdict extracts it from the sources into a
+ * dictionary that the host decoder uses to rebuild the message.
+ *
+ * Calls must fit on one source line, since the line number is the key:
+ *   LOG(OWIRE, LOG_WARN, "no presence pulse");
+ *   LOG1(DS18B20, LOG_DEBUG, "found %u sensors", count);
+ * Arguments are sent as 16-bit values.
+ */
+#ifndef LOG_H
+#define LOG_H
+
+/* Levels */
+#define LOG_NONE    0
+#define LOG_ERROR   1
+#define LOG_WARN    2
+#define LOG_INFO    3
+#define LOG_DEBUG   4
+
+/* Modules, at most 32 */
+#define LOG_MOD_MAIN        0
+#define LOG_MOD_OWIRE       1
+#define LOG_MOD_DS18B20     2
+#define LOG_MOD_SAMPLER     3
+#define LOG_MOD_REGISTRY    4
+
+/* Compile-time level per module, override with -DLOG_LEVEL_<MODULE>=... */
+#ifndef LOG_LEVEL_DEFAULT
+#ifdef NODEBUG
+#define LOG_LEVEL_DEFAULT   LOG_WARN
+#else
+#define LOG_LEVEL_DEFAULT   LOG_INFO
+#endif
+#endif
+#ifndef LOG_LEVEL_MAIN
+#define LOG_LEVEL_MAIN      LOG_LEVEL_DEFAULT
+#endif
+#ifndef LOG_LEVEL_OWIRE
+#define LOG_LEVEL_OWIRE     LOG_LEVEL_DEFAULT
+#endif
+#ifndef LOG_LEVEL_DS18B20
+#define LOG_LEVEL_DS18B20   LOG_LEVEL_DEFAULT
+#endif
+#ifndef LOG_LEVEL_SAMPLER
+#define LOG_LEVEL_SAMPLER   LOG_LEVEL_DEFAULT
+#endif
+#ifndef LOG_LEVEL_REGISTRY
+#define LOG_LEVEL_REGISTRY  LOG_LEVEL_DEFAULT
+#endif
+
+/* Calls below the module's level compile to nothing */
+#define LOG_ENABLED(mod, lvl)   ((lvl) <= LOG_LEVEL_##mod)
+
+#define LOG(mod, lvl, fmt) do { \
+    if (LOG_ENABLED(mod, lvl)) log_emit(LOG_MOD_##mod << 3 | (lvl), __LINE__, 0, 0, 0); \
+} while (0)
+#define LOG1(mod, lvl, fmt, a) do { \
+    if (LOG_ENABLED(mod, lvl)) log_emit(LOG_MOD_##mod << 3 | (lvl), __LINE__, 1, (a), 0); \
+} while (0)
+#define LOG2(mod, lvl, fmt, a, b) do { \
+    if (LOG_ENABLED(mod, lvl)) log_emit(LOG_MOD_##mod << 3 | (lvl), __LINE__, 2, (a), (b)); \
+} while (0)
+
+/* Send one LOG frame, use the macros above instead */
+void log_emit(unsigned char mod_lvl, unsigned int line, unsigned char nargs,
+        unsigned int a, unsigned int b);
+
+#endif
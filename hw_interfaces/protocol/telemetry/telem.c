@@ -0,0 +1,112 @@
+/*
+ * File:   telem.c
+ * Author: Kevin Macksamie
+ *
+ * The open frame is staged in txfifo past txiptr, header first, and only
+ * queued by telem_send(), so no RAM holds a copy of it. Staged bytes are
+ * counted in frame_len even once txfifo has no room for them, and the
+ * frame is then dropped whole, as if it had been built elsewhere and
+ * found txfifo full.
+ */
+#include "telem.h"
+#include "ser.h"
+
+static unsigned char frame_len;     // payload bytes in the open frame
+static unsigned char frame_type;    // type of the open frame
+static unsigned char frame_open;    // non-zero between telem_begin() and telem_send()
+static unsigned char frame_lost;    // non-zero once txfifo had no room for the frame
+static unsigned char frame_seq;     // sequence number of the next frame
+unsigned int telem_dropped;
+unsigned char telem_muted;
+
+static unsigned int crc16(unsigned int crc, unsigned char b)
+{
+    unsigned char x;
+    x = (crc >> 8) ^ b;
+    x ^= x >> 4;
+    return ((crc << 8) ^ ((unsigned int) x << 12) ^ ((unsigned int) x << 5) ^ x) & 0xFFFF;
+}
+
+void telem_begin(unsigned char type)
+{
+    frame_type = type;
+    frame_len = 0;
+    frame_open = 1;
+    frame_lost = 0;
+}
+
+bit telem_put(unsigned char b)
+{
+    if (frame_len >= TELEM_PAYLOAD)
+        return 0;
+    // txfifo only drains behind our back, so room once checked stays
+    if (ser_tx_free() < TELEM_HDR_LEN + frame_len + 1 + TELEM_CRC_LEN)
+        frame_lost = 1;
+    if (!frame_lost)
+        ser_stage(TELEM_HDR_LEN + frame_len, b);
+    ++frame_len;
+    return 1;
+}
+
+bit telem_put16(unsigned int v)
+{
+    if (frame_len > TELEM_PAYLOAD - 2)
+        return 0;
+    telem_put(v >> 8);
+    telem_put(v & 0xFF);
+    return 1;
+}
+
+unsigned char telem_room(void)
+{
+    return TELEM_PAYLOAD - frame_len;
+}
+
+unsigned char telem_len(void)
+{
+    return frame_open ? frame_len : 0;
+}
+
+unsigned char telem_type(void)
+{
+    return frame_open ? frame_type : 0;
+}
+
+bit telem_send(void)
+{
+    unsigned int crc;
+    unsigned char lcv, end;
+
+    if (!frame_open)
+        return 0;
+    frame_open = 0;     // frame is closed either way
+    if (telem_muted)
+        return 0;
+    end = TELEM_HDR_LEN + frame_len;
+    if (frame_lost || ser_tx_free() < end + TELEM_CRC_LEN)
+    {
+        ++telem_dropped;
+        return 0;
+    }
+
+    ser_stage(0, TELEM_SYNC);
+    ser_stage(1, frame_len);
+    ser_stage(2, frame_type);
+    ser_stage(3, frame_seq++);
+    crc = 0xFFFF;
+    for (lcv = 1; lcv < end; lcv++)
+        crc = crc16(crc, ser_staged(lcv));
+    ser_stage(end, crc >> 8);
+    ser_stage(end + 1, crc & 0xFF);
+    ser_commit(end + TELEM_CRC_LEN);
+    return 1;
+}
+
+bit telem_emit(unsigned char type, const unsigned char *payload, unsigned char len)
+{
+    telem_send();
+    telem_begin(type);
+    while (len--)
+        telem_put(*payload++);
+    return telem_send();
+}
@@ -0,0 +1,66 @@
+/*
+ * File:   telem.h
+ * Author: Kevin Macksamie
+ *
+ * Binary telemetry frames over the serial port. See telem_proto.h for the
+ * wire format.
+ */
+#ifndef TELEM_H
+#define TELEM_H
+
+#include <xc.h>
+#include "telem_proto.h"
+
+/*
+ * Payload limit of the frames sent here. The open frame is built in place
+ * in txfifo, so a whole one must fit there: the PIC16F913's 32 byte
+ * txfifo takes a 24 byte payload, and COUNTERS frames hold at most 8
+ * counters to stay within it.
+ */
+#ifndef TELEM_PAYLOAD
+#if defined(_PIC18) || defined(_PIC14E)
+#define TELEM_PAYLOAD   TELEM_MAX_PAYLOAD
+#else
+#define TELEM_PAYLOAD   24
+#endif
+#endif
+
+/* txfifo room needed to send a full frame */
+#define TELEM_FRAME_ROOM    (TELEM_HDR_LEN + TELEM_PAYLOAD + TELEM_CRC_LEN)
+
+/* Start a new frame of the given type, discarding any unsent frame */
+void telem_begin(unsigned char type);
+
+/* Append payload bytes; return 0 once the payload is full */
+bit telem_put(unsigned char b);
+bit telem_put16(unsigned int v);
+
+/* Payload bytes left in the open frame */
+unsigned char telem_room(void);
+
+/* Bytes of payload in the open frame, 0 if no frame is open */
+unsigned char telem_len(void);
+
+/* Type of the open frame, 0 if no frame is open */
+unsigned char telem_type(void);
+
+/*
+ * Finish the open frame and queue it on the serial port. If txfifo ran
+ * out of room for it the frame is dropped and counted in telem_dropped.
+ * Returns 1 if the frame was queued.
+ */
+bit telem_send(void);
+
+/*
+ * Send a complete frame from a caller owned payload. The open frame is
+ * sent first, since it sits where this one goes. Same drop rules as
+ * telem_send().
+ */
+bit telem_emit(unsigned char type, const unsigned char *payload, unsigned char len);
+
+extern unsigned int telem_dropped;
+
+/* Set to hold back every frame, e.g. while the port carries plain text */
+extern unsigned char telem_muted;
+
+#endif
@@ -0,0 +1,99 @@
+/*
+ * File:   telem_proto.h
+ * Author: Kevin Macksamie
+ *
+ * Binary telemetry frame format, shared with the host side tools.
+ *
+ *   SYNC | LEN | TYPE | SEQ | PAYLOAD[LEN] | CRC_HI | CRC_LO
+ *
+ * LEN counts payload bytes only. The CRC is CRC-16/CCITT-FALSE (poly
+ * 0x1021, init 0xFFFF) over LEN, TYPE, SEQ and the payload. Multi-byte
+ * fields are big-endian.
+ */
+#ifndef TELEM_PROTO_H
+#define TELEM_PROTO_H
+
+#define TELEM_SYNC          0xA5
+#define TELEM_HDR_LEN       4       /* SYNC, LEN, TYPE, SEQ */
+#define TELEM_CRC_LEN       2
+#define TELEM_MAX_PAYLOAD   32
+#define TELEM_FRAME_MAX     (TELEM_HDR_LEN + TELEM_MAX_PAYLOAD + TELEM_CRC_LEN)
+
+/*
+ * Frame types
+ *
+ * READINGS:  TIME16, then per sample ID, RAW_HI, RAW_LO. TIME16 is the
+ *            sender's millisecond tick, RAW is the DS18B20 Q11.4 word.
+ * ROMS:      per sensor ID, ROM[8]. ID has TELEM_ROM_PARASITE set for a
+ *            parasite powered sensor and TELEM_ROM_MISSING for a
+ *            registered one that did not answer the last scan.
+ * STATUS:    UPTIME16 (seconds), SENSOR_COUNT, FLAGS
+ * COUNTERS:  per counter KEY, VALUE16
+ * LOG:       MODULE << 3 | LEVEL, LINE16, then up to two ARG16. The
+ *            message text is looked up by module and line in the
+ *            dictionary generated by tools/logdict.
+ * SAMPLES:   AGE16 of the first sample, then per sample ID, RAW_HI,
+ *            RAW_LO, oldest first. AGE counts back from the newest logged
+ *            sample (0).
+ * REPLY:     COMMAND, STATUS, VALUE16. Sent once per command line, VALUE
+ *            is the setting in effect or the number of samples sent, or
+ *            with TELEM_R_DEVICE the sensor ids that failed.
+ * HEALTH:    per sensor ID, BACKOFF, PRESENCE16, CRC16, POR16, RETRY16.
+ *            BACKOFF is the passes a quarantined sensor sits out, 0 for a
+ *            healthy one; the rest count failed and repeated reads.
+ */
+#define TELEM_T_READINGS    0x01
+#define TELEM_T_ROMS        0x02
+#define TELEM_T_STATUS      0x03
+#define TELEM_T_COUNTERS    0x04
+#define TELEM_T_LOG         0x05
+#define TELEM_T_SAMPLES     0x06
+#define TELEM_T_REPLY       0x07
+#define TELEM_T_HEALTH      0x08
+
+#define TELEM_ROM_PARASITE  0x80
+#define TELEM_ROM_MISSING   0x40
+#define TELEM_ROM_ID        0x3F    /* Sensor ID bits of a ROMS entry */
+
+/*
+ * Commands are ASCII lines ended by CR or LF: a name, optionally followed
+ * by a space and a decimal number or a letter. REPLY frames identify the
+ * command by these codes.
+ */
+#define TELEM_CMD_PERIOD    0x01    /* period [ms]: sample period */
+#define TELEM_CMD_RES       0x02    /* res [9-12]: resolution in bits */
+#define TELEM_CMD_SCAN      0x03    /* scan: search the bus again */
+#define TELEM_CMD_UNIT      0x04    /* unit [c|f|k]: display unit */
+#define TELEM_CMD_ROMS      0x05    /* roms: send the ROM table */
+#define TELEM_CMD_DUMP      0x06    /* dump [n]: send n logged samples */
+#define TELEM_CMD_POWER     0x07    /* power [0|1]: low-power mode */
+#define TELEM_CMD_HEALTH    0x08    /* health: send bus and sensor health */
+#define TELEM_CMD_FORGET    0x09    /* forget <id>: free a sensor's registry slot */
+#define TELEM_CMD_TERM      0x0A    /* term [flow]: serial to LCD terminal mode */
+#define TELEM_CMD_BAUD      0x0B    /* baud [rate/100]: UART baud rate */
+#define TELEM_CMD_UNKNOWN   0xFF    /* line did not name a command */
+
+/* REPLY status */
+#define TELEM_R_OK          0x00
+#define TELEM_R_UNKNOWN     0x01    /* unknown command */
+#define TELEM_R_BADARG      0x02    /* argument missing or out of range */
+#define TELEM_R_OVERFLOW    0x03    /* line too long */
+#define TELEM_R_DEVICE      0x04    /* sensors failed, VALUE has a bit per id */
+
+/* COUNTERS keys */
+#define TELEM_C_ISR_MAX     0x01    /* Longest ISR in instruction cycles */
+#define TELEM_C_DEFER_DROP  0x02    /* Deferred events lost to a full queue */
+#define TELEM_C_RX_DROP     0x03    /* Bytes lost to a full rxfifo */
+#define TELEM_C_TX_DROP     0x04    /* Frames not sent because txfifo was full */
+#define TELEM_C_LOG_DROP    0x05    /* Samples not logged while EEPROM was busy */
+#define TELEM_C_AWAKE_MS    0x06    /* ms awake since the last report */
+#define TELEM_C_ASLEEP_MS   0x07    /* ms asleep since the last report */
+#define TELEM_C_WAKES       0x08    /* Wakeups since the last report */
+#define TELEM_C_NO_DEVICE   0x09    /* Reset pulses no sensor answered */
+#define TELEM_C_BUS_SHORT   0x0A    /* Reset pulses skipped, bus held low */
+#define TELEM_C_SEARCH_ERR  0x0B    /* Failed search ROM steps */
+#define TELEM_C_SEG_SWITCH  0x0C    /* 1-Wire bus segment changes */
+#define TELEM_C_TASK_WORST  0x10    /* + task index: worst run time in ms */
+#define TELEM_C_TASK_LATE   0x20    /* + task index: late releases */
+
+#endif
@@ -35,11 +35,45 @@
 #include <xc.h>
 #include "ser.h"
 
-unsigned char rxfifo[SER_BUFFER_SIZE];
+/* Reject baud rates the generator cannot reach closely enough */
+#if SER_BRG(SER_BAUD) < 0 || SER_BRG(SER_BAUD) > SER_BRG_MAX
+#error "SER_BAUD is out of range for _XTAL_FREQ"
+#endif
+#if SER_BRG_BAUD(SER_BRG(SER_BAUD)) > SER_BAUD
+#if (SER_BRG_BAUD(SER_BRG(SER_BAUD)) - SER_BAUD) * 1000 > SER_BAUD_TOLERANCE * SER_BAUD
+#error "SER_BAUD error exceeds SER_BAUD_TOLERANCE"
+#endif
+#else
+#if (SER_BAUD - SER_BRG_BAUD(SER_BRG(SER_BAUD))) * 1000 > SER_BAUD_TOLERANCE * SER_BAUD
+#error "SER_BAUD error exceeds SER_BAUD_TOLERANCE"
+#endif
+#endif
+
+SER_RX_BANK unsigned char rxfifo[SER_RX_BUFFER_SIZE];
 volatile unsigned char rxiptr, rxoptr;
-bank1 unsigned char txfifo[SER_BUFFER_SIZE];
+SER_TX_BANK unsigned char txfifo[SER_TX_BUFFER_SIZE];
 volatile unsigned char txiptr, txoptr;
+volatile unsigned char ser_flags;
+volatile unsigned char ser_rx_dropped;
 unsigned char ser_tmp;
+#ifdef SER_FLOW_CONTROL
+unsigned char ser_flow;
+volatile unsigned char ser_xchar;   // XON or XOFF waiting to go out, 0 if none
+
+/*
+ * Restart a stopped sender. Call with interrupts off.
+ */
+static void ser_flow_start(void)
+{
+    ser_flags &= ~SER_RX_STOPPED;
+    if (ser_flow & SER_FLOW_XONXOFF)
+    {
+        ser_xchar = SER_XON;
+        TXIE = 1;
+    }
+    ser_rts(0);
+}
+#endif
 
 bit ser_isrx(void)
 {
@@ -62,26 +96,90 @@ unsigned char ser_getch(void)
     GIE = 0;
     c = rxfifo[rxoptr];
     ++rxoptr;
-    rxoptr &= SER_FIFO_MASK;
+    rxoptr &= SER_RX_MASK;
+    if (ser_rx_count() <= SER_RX_LOW_MARK)
+    {
+        ser_flags &= ~SER_RX_HIGH;
+#ifdef SER_FLOW_CONTROL
+        if (ser_flags & SER_RX_STOPPED)
+            ser_flow_start();
+#endif
+    }
     GIE = 1;
     return c;
 }
 
 void ser_putch(unsigned char c)
 {
-    while (((txiptr + 1) & SER_FIFO_MASK) == txoptr)
+    while (((txiptr + 1) & SER_TX_MASK) == txoptr)
         continue;
     GIE = 0;
     txfifo[txiptr] = c;
-    txiptr = (txiptr + 1) & SER_FIFO_MASK;
+    txiptr = (txiptr + 1) & SER_TX_MASK;
+    if (ser_tx_count() >= SER_TX_HIGH_MARK)
+        ser_flags |= SER_TX_HIGH;
     TXIE = 1;
     GIE = 1;
 }
 
-void ser_puts(const unsigned char * s)
+/*
+ * Queue up to len bytes under a single critical section without waiting.
+ * Returns the number of bytes queued, which is less than len when txfifo
+ * fills up.
+ */
+unsigned char ser_write(const unsigned char * buf, unsigned char len)
+{
+    unsigned char n, i;
+
+    GIE = 0;
+    n = ser_tx_free();
+    if (n > len)
+        n = len;
+    i = txiptr;
+    for (len = n; len; --len) {
+        txfifo[i] = *buf++;
+        i = (i + 1) & SER_TX_MASK;
+    }
+    txiptr = i;
+    if (ser_tx_count() >= SER_TX_HIGH_MARK)
+        ser_flags |= SER_TX_HIGH;
+    if (n)
+        TXIE = 1;
+    GIE = 1;
+    return n;
+}
+
+/*
+ * Queue len bytes staged with ser_stage().
+ */
+void ser_commit(unsigned char len)
+{
+    GIE = 0;
+    txiptr = (txiptr + len) & SER_TX_MASK;
+    if (ser_tx_count() >= SER_TX_HIGH_MARK)
+        ser_flags |= SER_TX_HIGH;
+    if (len)
+        TXIE = 1;
+    GIE = 1;
+}
+
+/*
+ * Queue as much of a string as fits without waiting. Returns the number of
+ * characters queued.
+ */
+unsigned char ser_try_puts(const char * s)
+{
+    const char * p;
+
+    for (p = s; *p && (unsigned char) (p - s) != 0xFF; ++p)
+        continue;
+    return ser_write((const unsigned char *) s, p - s);
+}
+
+void ser_puts(const char * s)
 {
     while (*s)
-        ser_putch(*s++);
+        s += ser_try_puts(s);
 }
 
 void ser_puts2(unsigned char * s)
@@ -118,7 +216,11 @@ void ser_puthex(unsigned char v)
 void ser_init(void)
 {
     BRGH = 1;   /* high speed */
-    SPBRG = 129; /* 9.6K @ 20MHz, SPBRG = (20MHz/(16*BAUD_RATE))-1; */
+#if SER_HAS_BRG16
+    BRG16 = 1;  /* 16-bit generator */
+    SPBRGH = SER_BRG(SER_BAUD) >> 8;
+#endif
+    SPBRG = SER_BRG(SER_BAUD) & 0xFF; /* SPBRG = (Fosc/(div*BAUD_RATE))-1 */
 
     TX9 = 0;    /* 8 bits */
     RX9 = 0;    /*        */
@@ -134,5 +236,88 @@ void ser_init(void)
     GIE = 1;    /* Enable global interrupts */
 
     rxiptr = rxoptr = txiptr = txoptr = 0;
+    ser_flags = 0;
+    ser_rx_dropped = 0;
+#ifdef SER_FLOW_CONTROL
+    ser_flow = SER_FLOW_NONE;
+    ser_xchar = 0;
+#ifdef SER_RTS_PIN
+    SER_RTS_PIN = 0;
+    SER_RTS_TRIS = 0;
+#endif
+#endif
+}
+
+
+#ifdef SER_RUNTIME_BAUD
+/*
+ * Generator value for a baud rate, or -1 if the rate is out of range or
+ * outside SER_BAUD_TOLERANCE.
+ */
+static long ser_baud_brg(unsigned long baud)
+{
+    unsigned long brg, actual, err;
+
+    if (baud == 0)
+        return -1;
+    brg = ((_XTAL_FREQ) + SER_BRG_DIV/2*baud) / (SER_BRG_DIV*baud);
+    if (brg == 0 || brg > (unsigned long) SER_BRG_MAX + 1)
+        return -1;
+    --brg;
+
+    actual = SER_BRG_BAUD(brg);
+    err = (actual > baud) ? actual - baud : baud - actual;
+    if (err * 1000 > SER_BAUD_TOLERANCE * baud)
+        return -1;
+    return (long) brg;
+}
+
+/*
+ * 1 if ser_set_baud() would accept the rate.
+ */
+bit ser_baud_ok(unsigned long baud)
+{
+    return ser_baud_brg(baud) >= 0;
 }
 
+/*
+ * Switch baud rate at runtime. Waits for txfifo to drain so queued bytes
+ * go out at the old rate; call it once ser_tx_idle() to not wait at all.
+ * Returns 0 and leaves the rate unchanged if the new rate is out of range
+ * or outside SER_BAUD_TOLERANCE.
+ */
+bit ser_set_baud(unsigned long baud)
+{
+    long brg;
+
+    brg = ser_baud_brg(baud);
+    if (brg < 0)
+        return 0;
+
+    while (!ser_tx_idle())
+        continue;
+#if SER_HAS_BRG16
+    SPBRGH = brg >> 8;
+#endif
+    SPBRG = brg & 0xFF;
+    return 1;
+}
+#endif
+
+#ifdef SER_FLOW_CONTROL
+/*
+ * Select the receive flow control, SER_FLOW_* bits. A sender stopped under
+ * the old setting is restarted first, and a stop received from the other
+ * end is forgotten.
+ */
+void ser_set_flow(unsigned char flow)
+{
+    GIE = 0;
+    if (ser_flags & SER_RX_STOPPED)
+        ser_flow_start();
+    ser_flow = flow;
+    ser_flags &= ~SER_TX_STOPPED;
+    TXIE = !ser_flow_tx_done();
+    GIE = 1;
+}
+#endif
@@ -30,42 +30,235 @@
 #ifndef SER_H_
 #define SER_H_
 
-/* Valid buffer size value are only power of 2 (ex: 2,4,..,64,128) */
-#define SER_BUFFER_SIZE 16
-		
-#define SER_FIFO_MASK   (SER_BUFFER_SIZE-1)
+/* Baud rate, SPBRG is computed from _XTAL_FREQ at compile time */
+#ifndef SER_BAUD
+#define SER_BAUD    115200
+#endif
+
+/* Largest accepted baud rate error, in tenths of a percent */
+#ifndef SER_BAUD_TOLERANCE
+#define SER_BAUD_TOLERANCE  20
+#endif
+
+/* Parts with an EUSART have a 16-bit baud rate generator */
+#ifndef SER_HAS_BRG16
+#if defined(_BAUDCTL_BRG16_POSN) || defined(_BAUDCON_BRG16_POSN)
+#define SER_HAS_BRG16   1
+#else
+#define SER_HAS_BRG16   0
+#endif
+#endif
+
+/*
+ * Baud rate generator divisor: 4 with BRG16 and BRGH set, otherwise 16
+ * with BRGH set. SER_BRG() rounds to the nearest SPBRG value.
+ */
+#if SER_HAS_BRG16
+#define SER_BRG_DIV     4
+#define SER_BRG_MAX     65535
+#else
+#define SER_BRG_DIV     16
+#define SER_BRG_MAX     255
+#endif
+#define SER_BRG(baud)       (((_XTAL_FREQ) + SER_BRG_DIV/2*(baud)) / (SER_BRG_DIV*(baud)) - 1)
+#define SER_BRG_BAUD(brg)   ((_XTAL_FREQ) / (SER_BRG_DIV*((brg)+1)))
+
+/*
+ * PIC18 and enhanced midrange (PIC16F1) parts reach all of RAM through
+ * their FSRs, so a FIFO may be larger than a bank and needs no qualifier.
+ */
+#ifndef SER_LINEAR_RAM
+#if defined(_PIC18) || defined(_PIC14E)
+#define SER_LINEAR_RAM  1
+#else
+#define SER_LINEAR_RAM  0
+#endif
+#endif
+
+/*
+ * Valid buffer size value are only power of 2 (ex: 2,4,..,64,128). In
+ * banked RAM txfifo holds one telemetry frame (see TELEM_PAYLOAD) and
+ * rxfifo one command line.
+ */
+#ifndef SER_RX_BUFFER_SIZE
+#if SER_LINEAR_RAM
+#define SER_RX_BUFFER_SIZE  128
+#else
+#define SER_RX_BUFFER_SIZE  16
+#endif
+#endif
+#ifndef SER_TX_BUFFER_SIZE
+#if SER_LINEAR_RAM
+#define SER_TX_BUFFER_SIZE  128
+#else
+#define SER_TX_BUFFER_SIZE  32
+#endif
+#endif
+
+/* RAM bank of each FIFO, keep them apart so neither crowds out bank 0 */
+#if SER_LINEAR_RAM
+#ifndef SER_RX_BANK
+#define SER_RX_BANK
+#endif
+#ifndef SER_TX_BANK
+#define SER_TX_BANK
+#endif
+#else
+#ifndef SER_RX_BANK
+#define SER_RX_BANK bank1
+#endif
+#ifndef SER_TX_BANK
+#define SER_TX_BANK bank2
+#endif
+#endif
+
+#define SER_RX_MASK     (SER_RX_BUFFER_SIZE-1)
+#define SER_TX_MASK     (SER_TX_BUFFER_SIZE-1)
+
+/* Watermarks in bytes queued, with hysteresis between high and low */
+#define SER_RX_HIGH_MARK    (SER_RX_BUFFER_SIZE*3/4)
+#define SER_RX_LOW_MARK     (SER_RX_BUFFER_SIZE/4)
+#define SER_TX_HIGH_MARK    (SER_TX_BUFFER_SIZE*3/4)
+#define SER_TX_LOW_MARK     (SER_TX_BUFFER_SIZE/4)
+
+/* ser_flags bits */
+#define SER_RX_HIGH     0x01    /* rxfifo reached its high watermark */
+#define SER_TX_HIGH     0x02    /* txfifo reached its high watermark */
+#define SER_RX_STOPPED  0x04    /* the sender was told to stop */
+#define SER_TX_STOPPED  0x08    /* the receiver told us to stop */
+
+/*
+ * Receive flow control, built with SER_FLOW_CONTROL. Once rxfifo reaches
+ * its high watermark the sender is stopped, with XOFF and/or by raising
+ * RTS, and restarted by ser_getch() at the low watermark. The bytes past
+ * the high watermark are all the sender gets to react. With XON/XOFF, the
+ * XON and XOFF received stop and restart our own transmit side and are
+ * not queued. Define SER_RTS_PIN and SER_RTS_TRIS for an RTS output, low
+ * while rxfifo has room.
+ */
+#define SER_XON         0x11
+#define SER_XOFF        0x13
+
+/* ser_flow bits, see ser_set_flow() */
+#define SER_FLOW_NONE       0x00
+#define SER_FLOW_XONXOFF    0x01
+#define SER_FLOW_RTS        0x02
+
+#define ser_rx_count()  ((rxiptr-rxoptr) & SER_RX_MASK)
+#define ser_tx_count()  ((txiptr-txoptr) & SER_TX_MASK)
+#define ser_tx_free()   (SER_TX_MASK - ser_tx_count())
+#define ser_tx_idle()   (!TXIE && TRMT)     /* txfifo sent and the line quiet */
+
+/*
+ * Staging: bytes written at offsets from txiptr are not sent until
+ * ser_commit() queues them, so a frame can be built in place in txfifo.
+ * Keep within ser_tx_free(), and queue nothing else until the commit.
+ */
+#define ser_stage(off, c)   (txfifo[(txiptr + (off)) & SER_TX_MASK] = (c))
+#define ser_staged(off)     (txfifo[(txiptr + (off)) & SER_TX_MASK])
+
+#ifdef SER_FLOW_CONTROL
+#ifdef SER_RTS_PIN
+#define ser_rts(stop)   (SER_RTS_PIN = ((stop) && (ser_flow & SER_FLOW_RTS)))
+#else
+#define ser_rts(stop)
+#endif
+
+/* XON/XOFF received: stop or restart transmitting, TRUE if consumed */
+#define ser_flow_rx(c)                              \
+    ((ser_flow & SER_FLOW_XONXOFF) &&               \
+     ((c) == SER_XOFF ? (ser_flags |= SER_TX_STOPPED, 1) : \
+      (c) == SER_XON ? (ser_flags &= ~SER_TX_STOPPED, TXIE = !ser_flow_tx_done(), 1) : 0))
+
+/* rxfifo at its high watermark: stop the sender */
+#define ser_flow_stop()                             \
+    if (ser_flow && !(ser_flags & SER_RX_STOPPED)) { \
+        ser_flags |= SER_RX_STOPPED;                \
+        if (ser_flow & SER_FLOW_XONXOFF) {          \
+            ser_xchar = SER_XOFF;                   \
+            TXIE = 1;                               \
+        }                                           \
+        ser_rts(1);                                 \
+    }
+
+/* Transmit: a pending XON/XOFF goes ahead of txfifo, which may be held */
+#define ser_flow_tx()                               \
+    if (ser_xchar) {                                \
+        TXREG = ser_xchar;                          \
+        ser_xchar = 0;                              \
+    } else if (ser_flags & SER_TX_STOPPED) {        \
+        TXIE = 0;                                   \
+    } else
+
+/* TRUE once there is nothing left to send */
+#define ser_flow_tx_done()  (txoptr==txiptr && !ser_xchar)
+#else
+#define ser_flow_rx(c)      0
+#define ser_flow_stop()
+#define ser_flow_tx()
+#define ser_flow_tx_done()  (txoptr==txiptr)
+#endif
 
 /* Insert this macro inside the interrupt routine */
-#define ser_int()                           \
-    if (RCIF) {                             \
-        rxfifo[rxiptr]=RCREG;               \
-        ser_tmp=(rxiptr+1) & SER_FIFO_MASK; \
-        if (ser_tmp!=rxoptr)                \
-            rxiptr=ser_tmp;                 \
-    }                                       \
-    if (TXIF && TXIE) {                     \
-        TXREG = txfifo[txoptr];             \
-        ++txoptr;                           \
-        txoptr &= SER_FIFO_MASK;            \
-        if (txoptr==txiptr) {               \
-            TXIE = 0;                       \
-        }                                   \
+#define ser_int()                                   \
+    if (RCIF) {                                     \
+        ser_tmp=RCREG;                              \
+        if (!ser_flow_rx(ser_tmp)) {                \
+            rxfifo[rxiptr]=ser_tmp;                 \
+            ser_tmp=(rxiptr+1) & SER_RX_MASK;       \
+            if (ser_tmp!=rxoptr)                    \
+                rxiptr=ser_tmp;                     \
+            else                                    \
+                ++ser_rx_dropped;                   \
+            if (ser_rx_count() >= SER_RX_HIGH_MARK) { \
+                ser_flags |= SER_RX_HIGH;           \
+                ser_flow_stop();                    \
+            }                                       \
+        }                                           \
+    }                                               \
+    if (TXIF && TXIE) {                             \
+        ser_flow_tx() {                             \
+            TXREG = txfifo[txoptr];                 \
+            ++txoptr;                               \
+            txoptr &= SER_TX_MASK;                  \
+        }                                           \
+        if (ser_flow_tx_done()) {                   \
+            TXIE = 0;                               \
+        }                                           \
+        if (ser_tx_count() <= SER_TX_LOW_MARK)      \
+            ser_flags &= ~SER_TX_HIGH;              \
     }
 
 bit ser_isrx(void);
 unsigned char ser_getch(void);
 void ser_putch(unsigned char byte);
+unsigned char ser_write(const unsigned char * buf, unsigned char len);
+void ser_commit(unsigned char len);
+unsigned char ser_try_puts(const char * s);
 void ser_puts(const char * s);
 void ser_puts2(unsigned char * s);
 void ser_puthex(unsigned char v);
 void ser_init(void);
+#ifdef SER_RUNTIME_BAUD
+bit ser_baud_ok(unsigned long baud);
+bit ser_set_baud(unsigned long baud);
+#endif
+#ifdef SER_FLOW_CONTROL
+void ser_set_flow(unsigned char flow);
+#endif
 
 #ifndef SER_C_
-extern unsigned char rxfifo[SER_BUFFER_SIZE];
+extern SER_RX_BANK unsigned char rxfifo[SER_RX_BUFFER_SIZE];
 extern volatile unsigned char rxiptr, rxoptr;
-extern bank1 unsigned char txfifo[SER_BUFFER_SIZE];
+extern SER_TX_BANK unsigned char txfifo[SER_TX_BUFFER_SIZE];
 extern volatile unsigned char txiptr, txoptr;
+extern volatile unsigned char ser_flags;
+extern volatile unsigned char ser_rx_dropped;
 extern unsigned char ser_tmp;
+#ifdef SER_FLOW_CONTROL
+extern unsigned char ser_flow;
+extern volatile unsigned char ser_xchar;
+#endif
 #endif
 
 #endif
@@ -1,24 +1,19 @@
 /*
- * File:   ds18b20.h
+ * File:   ds18b20.c
  * Author: Kevin Macksamie
  */
 #include "ds18b20.h"
-#ifndef NODEBUG
-#include "ser.h"
-#endif
+#include "log.h"
 
-unsigned char scratchpad[9];      // latest scratchpad read
-unsigned char latest_ROM[8];      // latest collected ROM from search ROM command
-unsigned char done;               // search ROM done flag
-unsigned char last_discrepancy;   // search ROM last found discrepancy
+unsigned int ds18b20_search_errors;
 
-void setup()
-{
-    last_discrepancy = 0;
-    done = 0;
-}
+#define SEARCH_ERROR 2
 
-unsigned char next()
+/*
+ * One search ROM pass: 1 with the next ROM in search->ROM, 0 once done, or
+ * SEARCH_ERROR with last_discrepancy left alone so the pass can be retried.
+ */
+static unsigned char search_step(ds18b20_search_t *search)
 {
     unsigned char more_searches = 0;      // return variable - indicates if more searching needs to be done
     unsigned char rom_bit_index = 1;      // bit index in ROM array
@@ -28,41 +23,33 @@ unsigned char next()
     unsigned char rom_bit = 0;            // ROM bit to use
     unsigned char mask = 1;               // bit mask for current ROM byte
 
-    if (done)
+    if (search->done)
     {
-#ifndef NODEBUG
-        ser_puts("next(): done flag set - exiting\n\r");
-#endif
-        done = 0;
+        LOG(DS18B20, LOG_DEBUG, "ds18b20_search_next(): done flag set - exiting");
+        search->done = 0;
         return 0;
     }
 
     if (!owire_reset_pulse())
     {
-#ifndef NODEBUG
-        ser_puts("next(): no presence pulse found\n\r");
-#endif
-        last_discrepancy = 0;
-        return 0;
+        LOG(DS18B20, LOG_WARN, "ds18b20_search_next(): no presence pulse found");
+        return SEARCH_ERROR;
     }
 
-#ifndef NODEBUG
-    ser_puts("next(): sending ROM search command\n\r");
-#endif
+    LOG(DS18B20, LOG_DEBUG, "ds18b20_search_next(): sending ROM search command");
     owire_write_byte(DS18B20_ROM_SEARCH);  // send search ROM command
 
     // collect all 8 ROM bytes
     while (rom_byte_index < 8)
     {
+        read_bits = 0;
         if (owire_read_bit() == 1) // read true value of ROM bit
             read_bits = 2;
         __delay_us(15);
         if (owire_read_bit() == 1) // read false value of ROM bit
             read_bits |= 1;
         if (read_bits == 3) {// no devices are on the 1-Wire bus
-#ifndef NODEBUG
-            ser_puts("next(): no devices are on bus\n\r");
-#endif
+            LOG(DS18B20, LOG_WARN, "ds18b20_search_next(): no devices are on bus");
             break;
         }
 
@@ -73,10 +60,10 @@ unsigned char next()
             // if this discrepancy is before the last discrepancy on a previous
             // next then something went wrong; repeat and pick the same as last
             // time
-            if (rom_bit_index < last_discrepancy)
-                rom_bit = (latest_ROM[rom_byte_index] & mask) > 0;
+            if (rom_bit_index < search->last_discrepancy)
+                rom_bit = (search->ROM[rom_byte_index] & mask) > 0;
             else
-                rom_bit = rom_bit_index == last_discrepancy;
+                rom_bit = rom_bit_index == search->last_discrepancy;
 
             // a new discrepancy has been reached, mark its position
             if (rom_bit == 0)
@@ -85,9 +72,9 @@ unsigned char next()
 
         // update ROM bits with new output bit
         if (rom_bit == 1)
-            latest_ROM[rom_byte_index] |= mask;
+            search->ROM[rom_byte_index] |= mask;
         else
-            latest_ROM[rom_byte_index] &= ~mask;
+            search->ROM[rom_byte_index] &= ~mask;
 
         owire_write_bit(rom_bit); // send ROM bit to 1-Wire bus
         rom_bit_index++;  // move to next rom bit position
@@ -96,7 +83,6 @@ unsigned char next()
         // if the mask rolls over back to 0, then go to next ROM byte
         if (mask == 0)
         {
-            // TODO: should do a CRC check here on ROM[rom_byte_index]
             rom_byte_index++;
             mask = 1;
         }
@@ -105,126 +91,212 @@ unsigned char next()
     if (rom_bit_index < 65)
     {
         // search was unsuccessful if not all 64 bits were collected
-        last_discrepancy = 0;
+        return SEARCH_ERROR;
+    }
+    else if (ds18b20_crc8(search->ROM, 8) != 0)
+    {
+        LOG(DS18B20, LOG_WARN, "ds18b20_search_next(): ROM CRC mismatch");
+        return SEARCH_ERROR;
     }
     else
     {
         // search was successful
-        last_discrepancy = discrepancy_marker;
-        done = last_discrepancy == 0;
+        search->last_discrepancy = discrepancy_marker;
+        search->done = search->last_discrepancy == 0;
         more_searches = 1;
     }
 
     return more_searches;
 }
 
-unsigned char first()
-{
-    last_discrepancy = 0;
-    done = 0;
-    return next();
-}
-
-void ds18b20_find_devices(temp_sensors_t *sensors)
+unsigned char ds18b20_search_next(ds18b20_search_t *search)
 {
-    // XXX: before this function is called, disable interrupts while
-    // communicating to device
-    unsigned char num_roms;
+    unsigned char saved[8];
+    unsigned char tries;
     unsigned char lcv;
-    setup();
-    if (owire_reset_pulse())
-    {
-        if (first())
-        {
-            num_roms = 0;
-            do
-            {
-                for (lcv = 0; lcv < 8; lcv++)
-                {
-                    sensors->ROMS[num_roms][lcv] = latest_ROM[lcv];
-                }
-                num_roms++;
-
-#ifndef NODEBUG
-                if (num_roms >= MAX_TEMP_SENSORS)
-                    ser_puts("ds18b20_find_devices(): max temp sensors found\n\r");
-#endif
-                
-            } while (num_roms < MAX_TEMP_SENSORS && next());  // find all devices
-        }
-        else
-        {
-#ifndef NODEBUG
-            ser_puts("ds18b20_find_devices(): no first device found\n\r");
-#endif
-        }
-    }
-    else
+    unsigned char found;
+
+    // a failed pass may have overwritten bits the retry must follow again
+    for (lcv = 0; lcv < 8; lcv++)
+        saved[lcv] = search->ROM[lcv];
+
+    for (tries = 0; tries < DS18B20_SEARCH_TRIES; tries++)
     {
-#ifndef NODEBUG
-        ser_puts("ds18b20_find_devices(): no initial presence pulse\n\r");
-#endif
+        found = search_step(search);
+        if (found != SEARCH_ERROR)
+            return found;
+        ++ds18b20_search_errors;
+        for (lcv = 0; lcv < 8; lcv++)
+            search->ROM[lcv] = saved[lcv];
     }
-    // XXX: after this function is called, re-enable interrupts when
-    // communication is done
+
+    LOG(DS18B20, LOG_ERROR, "ds18b20_search_next(): search failed");
+    search->last_discrepancy = 0;
+    return 0;
+}
+
+unsigned char ds18b20_search_first(ds18b20_search_t *search)
+{
+    search->last_discrepancy = 0;
+    search->done = 0;
+    return ds18b20_search_next(search);
 }
 
-void match_rom(unsigned char ROM[])
+void match_rom(ds18b20_rom_t ROM)
 {
     unsigned char lcv;
     owire_write_byte(DS18B20_ROM_MATCH);
     for (lcv = 0; lcv < 8; lcv++)
     {
-        owire_write_bit(ROM[lcv]);
+#ifdef DS18B20_ROM_FETCH
+        owire_write_byte(ds18b20_rom_byte(ROM, lcv));
+#else
+        owire_write_byte(ROM[lcv]);
+#endif
     }
 }
 
-void ds18b20_convert_temp(unsigned char ROM[])
+static unsigned char select_rom(ds18b20_rom_t ROM)
 {
-    // XXX: before this function is called, disable interrupts while
-    // communicating to device
-    unsigned char lcv;
-    owire_reset_pulse();
-    if (ROM)
+    if (!owire_reset_pulse())
+        return 0;
+    if (ROM != DS18B20_SKIP_ROM)
         match_rom(ROM);
     else
         owire_write_byte(DS18B20_ROM_SKIP);
-    owire_write_byte(DS18B20_CONVERT_TEMP);
+    return 1;
+}
+
+unsigned char ds18b20_convert_temp(ds18b20_rom_t ROM, unsigned char pad[])
+{
+    // the power mode is not known here, parasite is safe for both
+    ds18b20_start_convert(ROM, 1);
 
     // wait for conversion to finish
-    __delay_ms(750);
+    __delay_ms(DS18B20_CONVERT_MS);
 
-    owire_reset_pulse();
-    if (ROM)
-        match_rom(ROM);
+    return ds18b20_read_scratchpad(ROM, pad);
+}
+
+/*
+ * A parasite powered sensor is left converting under the strong pullup;
+ * nothing else may use the bus until the conversion time has passed. An
+ * externally powered one can be polled with ds18b20_busy() instead.
+ */
+void ds18b20_start_convert(ds18b20_rom_t ROM, unsigned char parasite)
+{
+    select_rom(ROM);
+    if (parasite)
+        owire_write_byte_spu(DS18B20_CONVERT_TEMP);
     else
-        owire_write_byte(DS18B20_ROM_SKIP);
+        owire_write_byte(DS18B20_CONVERT_TEMP);
+}
+
+/*
+ * Read slot after a convert or copy: an externally powered sensor holds
+ * it low until done. Only valid while that sensor was the last addressed.
+ */
+unsigned char ds18b20_busy(void)
+{
+    return !owire_read_bit();
+}
+
+/*
+ * Read the scratchpad straight into the caller's pad, which must hold
+ * DS18B20_SCRATCHPAD_LEN bytes.
+ */
+unsigned char ds18b20_read_scratchpad(ds18b20_rom_t ROM, unsigned char pad[])
+{
+    unsigned char lcv;
+    if (!select_rom(ROM))
+        return DS18B20_E_PRESENCE;
     owire_write_byte(DS18B20_READ_SCRATCHPAD);
-    for (lcv = 0; lcv < 9; lcv++)
+    for (lcv = 0; lcv < DS18B20_SCRATCHPAD_LEN; lcv++)
     {
-        scratchpad[lcv] = owire_read_byte();
+        pad[lcv] = owire_read_byte();
     }
 
-#ifndef NODEBUG
-    for (lcv = 0; lcv < 9; lcv++)
-    {
-        if (scratchpad[lcv])
-            ser_puts("scratchpad not empty\n\r");
-        else
-            ser_puts("scratchpad empty\n\r");
+    LOG2(DS18B20, LOG_DEBUG, "scratchpad: temp %04x config %02x", ds18b20_raw(pad), pad[DS18B20_PAD_CONFIG]);
 
+    // a bus stuck low reads all zeros, which passes the CRC; the low five
+    // config bits always read back as ones
+    if (ds18b20_crc8(pad, DS18B20_SCRATCHPAD_LEN) != 0 || (pad[DS18B20_PAD_CONFIG] & 0x1F) != 0x1F)
+        return DS18B20_E_CRC;
+    // 85 C is also what a sensor reads before its first conversion; only
+    // the caller knows whether the sensor could have reset, see sampler.c
+    if (ds18b20_raw(pad) == DS18B20_POR_RAW)
+        return DS18B20_E_POR;
+    return DS18B20_OK;
+}
+
+/*
+ * Write a new resolution into pad and to the sensor. T_H and T_L keep
+ * the values in pad, normally the last ones read back.
+ */
+void ds18b20_set_resolution(ds18b20_rom_t ROM, unsigned char pad[], unsigned char res)
+{
+    pad[DS18B20_PAD_CONFIG] = DS18B20_RES_CONFIG(res);
+    select_rom(ROM);
+    owire_write_byte(DS18B20_WRITE_SCRATCHPAD);
+    owire_write_byte(pad[DS18B20_PAD_TH]);
+    owire_write_byte(pad[DS18B20_PAD_TL]);
+    owire_write_byte(pad[DS18B20_PAD_CONFIG]);
+}
+
+/*
+ * Save T_H, T_L and the configuration to the sensor's EEPROM so they
+ * survive a power cycle. Blocks for at most DS18B20_COPY_MS.
+ */
+void ds18b20_copy_scratchpad(ds18b20_rom_t ROM, unsigned char parasite)
+{
+    unsigned char lcv;
+    select_rom(ROM);
+    if (parasite)
+    {
+        owire_write_byte_spu(DS18B20_COPY_SCRATCHPAD);
+        __delay_ms(DS18B20_COPY_MS);
+        owire_strong_pullup(0);
+    }
+    else
+    {
+        owire_write_byte(DS18B20_COPY_SCRATCHPAD);
+        for (lcv = 0; lcv < DS18B20_COPY_MS && ds18b20_busy(); lcv++)
+            __delay_ms(1);
     }
-#endif
-    // XXX: after this function is called, re-enable interrupts when
-    // communication is done
 }
 
-unsigned char ds18b20_temp_hi(void)
+/*
+ * Returns 1 if the sensor is parasite powered; it pulls the read slot
+ * low. With skip ROM, 1 if any sensor on the bus is.
+ */
+unsigned char ds18b20_read_power(ds18b20_rom_t ROM)
 {
-    return scratchpad[1];
+    select_rom(ROM);
+    owire_write_byte(DS18B20_READ_POWERSUPPLY);
+    return !owire_read_bit();
 }
 
-unsigned char ds18b20_temp_lo(void)
+/*
+ * Dallas/Maxim CRC-8 (x^8 + x^5 + x^4 + 1), LSB first. Running it over
+ * data followed by its CRC byte gives 0.
+ */
+unsigned char ds18b20_crc8(const unsigned char *data, unsigned char len)
 {
-    return scratchpad[0];
+    unsigned char crc = 0;
+    unsigned char byte;
+    unsigned char lcv;
+
+    while (len--)
+    {
+        byte = *data++;
+        for (lcv = 0; lcv < 8; lcv++)
+        {
+            if ((crc ^ byte) & 0x01)
+                crc = (crc >> 1) ^ 0x8C;
+            else
+                crc >>= 1;
+            byte >>= 1;
+        }
+    }
+    return crc;
 }
@@ -8,6 +8,8 @@
 
 #include "owire.h"
 
+#define DS18B20_FAMILY              0x28 // Family code, the first ROM byte
+
 // DS18B20 ROM Command Set
 #define DS18B20_ROM_SEARCH          0xF0 // Learn the ROM codes of all devices on bus
 #define DS18B20_ROM_READ            0x33 // Can only be used when there is one slave on the bus. It allows the bus master to read the slave's 64-bit ROM code without using the Search ROM procedure
@@ -21,20 +23,77 @@
 #define DS18B20_WRITE_SCRATCHPAD    0x4E // Writes data into scratchpad bytes 2, 3, and 4 (T_H, T_L, and configuration registers)
 #define DS18B20_COPY_SCRATCHPAD     0x48 // Copies T_H, T_L, configuration register data from the scratchpad to EEPROM
 #define DS18B20_RECALL_E2           0xB8 // Recalls T_H, T_L, and configuration register data from EEPROM to the scratchpad
-#define DS18B20_READ_POWERSUPPLY    0x84 // Signals DS18B20 power supply mode to the master
+#define DS18B20_READ_POWERSUPPLY    0xB4 // Signals DS18B20 power supply mode to the master
+
+#define DS18B20_CONVERT_MS          750  // Worst case 12-bit conversion time
+
+// Resolution in bits (9-12), set through the configuration register
+#define DS18B20_RES_MIN             9
+#define DS18B20_RES_MAX             12
+#define DS18B20_RES_DEFAULT         12
+#define DS18B20_RES_CONFIG(res)     ((((res) - 9) << 5) | 0x1F)
+#define DS18B20_CONVERT_MS_RES(res) (DS18B20_CONVERT_MS >> (12 - (res)))
+#define DS18B20_RES_MASK(res)       (~((1 << (12 - (res))) - 1)) // Raw bits that hold data
+
+#define DS18B20_COPY_MS             10   // Copy scratchpad to EEPROM time
+#define DS18B20_SEARCH_TRIES        3    // Attempts at each search ROM step
+#define DS18B20_POR_RAW             0x0550 // 85 C, the temperature register at power-on
+
+// Scratchpad layout
+#define DS18B20_SCRATCHPAD_LEN      9
+#define DS18B20_PAD_TEMP_LO         0
+#define DS18B20_PAD_TEMP_HI         1
+#define DS18B20_PAD_TH              2
+#define DS18B20_PAD_TL              3
+#define DS18B20_PAD_CONFIG          4
+#define DS18B20_PAD_CRC             8
 
-#define MAX_TEMP_SENSORS 1
+// Raw Q11.4 temperature word of a scratchpad
+#define ds18b20_raw(pad) \
+    (((pad)[DS18B20_PAD_TEMP_HI] << 8) | (pad)[DS18B20_PAD_TEMP_LO])
 
-typedef struct temp_sensors
+// ds18b20_read_scratchpad() status
+#define DS18B20_OK                  0
+#define DS18B20_E_PRESENCE          1    // no presence pulse
+#define DS18B20_E_CRC               2    // scratchpad failed its CRC
+#define DS18B20_E_POR               3    // reads the power-on value, maybe a real 85 C
+
+// Search ROM state of one bus; ROM holds the device last found
+typedef struct ds18b20_search
 {
-    /*owire_t *bus;                       // the 1-Wire bus used for the sensors*/
-    unsigned char ROMS[MAX_TEMP_SENSORS][8];  // 1-Wire sensors' ROMS
-} temp_sensors_t;
-
-void ds18b20_find_devices(temp_sensors_t *sensors);
-void ds18b20_convert_temp(unsigned char ROM[]);
-unsigned char ds18b20_temp_hi(void);
-unsigned char ds18b20_temp_lo(void);
+    unsigned char ROM[8];             // latest collected ROM
+    unsigned char last_discrepancy;   // bit index of the last discrepancy taken
+    unsigned char done;               // set once the last device was found
+} ds18b20_search_t;
+
+/*
+ * Sensor address. Normally a pointer to the 8 ROM bytes in RAM. Built with
+ * DS18B20_ROM_FETCH it is a one byte sensor id instead, and match ROM
+ * streams each ROM byte from ds18b20_rom_byte(), which the application
+ * provides, e.g. straight from data EEPROM. DS18B20_SKIP_ROM addresses
+ * every sensor, or a lone one, with skip ROM.
+ */
+#ifdef DS18B20_ROM_FETCH
+typedef unsigned char ds18b20_rom_t;
+#define DS18B20_SKIP_ROM            0xFF
+unsigned char ds18b20_rom_byte(ds18b20_rom_t id, unsigned char index);
+#else
+typedef unsigned char *ds18b20_rom_t;
+#define DS18B20_SKIP_ROM            0
+#endif
+
+unsigned char ds18b20_search_first(ds18b20_search_t *search);
+unsigned char ds18b20_search_next(ds18b20_search_t *search);
+unsigned char ds18b20_convert_temp(ds18b20_rom_t ROM, unsigned char pad[]);
+void ds18b20_start_convert(ds18b20_rom_t ROM, unsigned char parasite);
+unsigned char ds18b20_busy(void);
+unsigned char ds18b20_read_scratchpad(ds18b20_rom_t ROM, unsigned char pad[]);
+void ds18b20_set_resolution(ds18b20_rom_t ROM, unsigned char pad[], unsigned char res);
+void ds18b20_copy_scratchpad(ds18b20_rom_t ROM, unsigned char parasite);
+unsigned char ds18b20_read_power(ds18b20_rom_t ROM);
+unsigned char ds18b20_crc8(const unsigned char *data, unsigned char len);
+
+extern unsigned int ds18b20_search_errors;  // search ROM steps that failed
 
 #endif	/* DS18B20_H */
 
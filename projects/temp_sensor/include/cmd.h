@@ -0,0 +1,42 @@
+/*
+ * File:   cmd.h
+ * Author: Kevin Macksamie
+ */
+#ifndef CMD_H
+#define CMD_H
+
+#include "common.h"
+#include "telem_proto.h"
+
+#define CMD_LINE_LEN    16      /* Longest command line, including the argument */
+#define CMD_PENDING     0xFE    /* Handler status: not finished, call again */
+
+/*
+ * Command handler. has_arg is TRUE when the line carried an argument; a
+ * number is passed as its value, a letter as its lowercase character.
+ * Returns a TELEM_R_* status, or CMD_PENDING to be called again on the
+ * next poll with the same argument. A handler sets cmd_value before
+ * returning to report it in the REPLY frame.
+ */
+typedef uint8_t (*cmd_fn_t)(uint8_t has_arg, uint16_t arg);
+
+typedef struct cmd_entry
+{
+    const char *name;       // command word
+    uint8_t code;           // TELEM_CMD_* code used in the reply
+    cmd_fn_t fn;            // handler
+} cmd_entry_t;
+
+/* Bind the parser to a command table */
+void cmd_init(const cmd_entry_t *table, uint8_t count);
+
+/*
+ * Consume received bytes and run commands. Never waits: a command that
+ * cannot finish stays pending and later input is left in rxfifo until it
+ * is done.
+ */
+void cmd_poll(void);
+
+extern uint16_t cmd_value;
+
+#endif
@@ -8,6 +8,8 @@
 
 #define TRUE    1
 #define FALSE   0
+
+#ifdef __XC8
 #define NULL    0
 
 typedef unsigned char uint8_t;
@@ -16,5 +18,18 @@ typedef signed char int8_t;
 typedef unsigned int uint16_t;
 typedef signed int int16_t;
 
-#endif	/* COMMON_H */
+typedef unsigned short long uint24_t;
+typedef signed short long int24_t;
+
+typedef unsigned long uint32_t;
+typedef signed long int32_t;
+#else
+/* Host build: take the exact-width types from the C library */
+#include <stddef.h>
+#include <stdint.h>
 
+typedef uint32_t uint24_t;
+typedef int32_t int24_t;
+#endif
+
+#endif	/* COMMON_H */
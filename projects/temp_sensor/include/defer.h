@@ -0,0 +1,75 @@
+/*
+ * File:   defer.h
+ * Author: Kevin Macksamie
+ */
+#ifndef DEFER_H
+#define DEFER_H
+
+#include "common.h"
+
+/*
+ * Valid queue size values are only power of 2 (ex: 2,4,..,64,128). The
+ * button is the only source, so a few entries are plenty.
+ */
+#ifndef DEFER_QUEUE_SIZE
+#define DEFER_QUEUE_SIZE    4
+#endif
+#define DEFER_QUEUE_MASK    (DEFER_QUEUE_SIZE-1)
+
+/* Event codes posted from interrupt context */
+#define DEFER_EV_BUTTON     0   /* RB0 falling edge */
+#define DEFER_NUM_EVENTS    1
+
+/* Handler run in the main loop for a posted event */
+typedef void (*defer_fn_t)(void);
+
+/*
+ * Insert this macro inside the interrupt routine to queue an event. A full
+ * queue drops the event and counts it in defer_dropped.
+ */
+#define defer_post(ev)                              \
+    {                                               \
+        defer_tmp = (defer_in + 1) & DEFER_QUEUE_MASK; \
+        if (defer_tmp != defer_out) {               \
+            defer_queue[defer_in] = (ev);           \
+            defer_in = defer_tmp;                   \
+        } else {                                    \
+            ++defer_dropped;                        \
+        }                                           \
+    }
+
+/*
+ * Insert these macros at the very start and end of the interrupt routine
+ * to track the longest ISR run in instruction cycles. Timer0 must be free
+ * running from Fosc/4 without prescaler, with its interrupt disabled. It
+ * restarts from 0 on entry, so an ISR of 256 cycles or more overflows it
+ * and counts as 0xFF. The write holds Timer0 for two cycles, which are
+ * not counted.
+ */
+#define defer_isr_enter()                           \
+    {                                               \
+        TMR0 = 0;                                   \
+        T0IF = 0;                                   \
+    }
+#define defer_isr_exit()                            \
+    {                                               \
+        defer_tmp = TMR0;                           \
+        if (T0IF)                                   \
+            defer_tmp = 0xFF;                       \
+        if (defer_tmp > defer_isr_max)              \
+            defer_isr_max = defer_tmp;              \
+    }
+
+/* Register the handler for an event code */
+void defer_register(uint8_t ev, defer_fn_t fn);
+
+/* Run the handlers of every queued event; call from the main loop */
+void defer_dispatch(void);
+
+extern volatile uint8_t defer_queue[DEFER_QUEUE_SIZE];
+extern volatile uint8_t defer_in, defer_out;
+extern volatile uint8_t defer_dropped;
+extern volatile uint8_t defer_isr_max;
+extern uint8_t defer_tmp;
+
+#endif
@@ -0,0 +1,30 @@
+/*
+ * File:   eeprom.h
+ * Author: Kevin Macksamie
+ */
+#ifndef EEPROM_H
+#define EEPROM_H
+
+#include <xc.h>
+#include "common.h"
+
+/*
+ * Data EEPROM bytes: 256 on the PIC16F913. Addresses are 8 bits, so a
+ * larger EEPROM is used up to 256 bytes.
+ */
+#if defined(_EEPROMSIZE) && _EEPROMSIZE < 256
+#define EE_SIZE     _EEPROMSIZE
+#else
+#define EE_SIZE     256
+#endif
+
+/* TRUE while a byte write is in progress */
+#define ee_busy()   WR
+
+/* Read a byte, waiting out a write in progress */
+uint8_t ee_read(uint8_t addr);
+
+/* Start writing a byte, waiting out a write in progress first */
+void ee_write(uint8_t addr, uint8_t val);
+
+#endif
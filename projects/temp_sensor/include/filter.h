@@ -0,0 +1,54 @@
+/*
+ * File:   filter.h
+ * Author: Kevin Macksamie
+ */
+#ifndef FILTER_H
+#define FILTER_H
+
+#include "common.h"
+#include "temp.h"
+
+/* Filter stages, applied in this order */
+#define FILTER_MEDIAN   0x01    /* Median-of-3 spike rejection */
+#define FILTER_SLEW     0x02    /* Limit change per sample */
+#define FILTER_EWMA     0x04    /* Exponentially weighted moving average */
+
+#define FILTER_FRAC     4       /* Extra fraction bits kept by the EWMA */
+#define FILTER_SHIFT_MAX FILTER_FRAC    /* Slowest EWMA that still settles exactly */
+
+/* Default configuration for every sensor */
+#define FILTER_DEFAULT_FLAGS    (FILTER_MEDIAN | FILTER_EWMA)
+#define FILTER_DEFAULT_SHIFT    2   /* New sample weighs 1/4 */
+#define FILTER_DEFAULT_SLEW     16  /* 1 degC per sample */
+#define FILTER_DEFAULT  { FILTER_DEFAULT_FLAGS, FILTER_DEFAULT_SHIFT, FILTER_DEFAULT_SLEW }
+
+/* A filter's configuration, e.g. in a table of one per sensor */
+typedef struct filter_config
+{
+    uint8_t flags;      // enabled FILTER_* stages
+    uint8_t shift;      // EWMA weight is 1/2^shift
+    uint8_t slew;       // maximum change per sample in raw LSBs
+} filter_config_t;
+
+/*
+ * Per sensor filter state. Everything is integer math on raw temp_t
+ * values and each stage runs in a fixed number of steps per sample.
+ */
+typedef struct filter
+{
+    temp_t hist[2];     // previous two inputs, newest first
+    temp_t out;         // last output
+    int16_t acc;        // EWMA accumulator, scaled by 2^FILTER_FRAC
+    uint8_t flags;      // enabled FILTER_* stages
+    uint8_t shift;      // EWMA weight is 1/2^shift
+    uint8_t slew;       // maximum change per sample in raw LSBs
+    uint8_t count;      // samples seen, saturates at 2
+} filter_t;
+
+/* Configure a filter and forget its history */
+void filter_init(filter_t *f, uint8_t flags, uint8_t shift, uint8_t slew);
+
+/* Run one sample through the filter and return the filtered value */
+temp_t filter_update(filter_t *f, temp_t x);
+
+#endif
@@ -5,10 +5,47 @@
 #ifndef INIT_H
 #define INIT_H
 
+#include "util.h"
+#include "sn74htc138.h"
+
+/* Timer1 runs from Fosc/4 with a 1:1 prescaler and overflows every 1 ms */
+#define TMR1_TICK_COUNTS    (_XTAL_FREQ / 4 / 1000)
+#define TMR1_RELOAD         (65536 - TMR1_TICK_COUNTS)
+
+/*
+ * Counts Timer1 misses while sched_int() has it stopped to add the reload,
+ * the instructions between clearing and setting TMR1ON. About 16 for the
+ * code XC8 makes of it; check the listing after changing the macro.
+ */
+#ifndef TMR1_STOP_COUNTS
+#define TMR1_STOP_COUNTS    16
+#endif
+
+#ifdef LAMP_SCAN
+/*
+ * Timer2 paces the lamp scan: Fosc/4 with a 1:16 prescaler, one tick per
+ * PR2 match. Each refresh is SN74HTC138_LINES * SN74HTC138_STEPS ticks.
+ */
+#ifndef LAMP_REFRESH_HZ
+#define LAMP_REFRESH_HZ     100
+#endif
+#define TMR2_TICK_HZ        (LAMP_REFRESH_HZ * SN74HTC138_LINES * SN74HTC138_STEPS)
+#define TMR2_PERIOD         (_XTAL_FREQ / 4 / 16 / TMR2_TICK_HZ - 1)
+
+#if TMR2_PERIOD > 255 || TMR2_PERIOD < 1
+#error "LAMP_REFRESH_HZ out of Timer2 range"
+#endif
+#endif
+
 /* Initialize the I/O ports on MCU */
 void io_init(void);
 
-/* Initialize any timers */
+/* Initialize the Timer1 1 ms tick */
 void timer_init(void);
 
+#ifdef LAMP_SCAN
+/* Start or stop the Timer2 lamp scan tick */
+void lamp_timer_enable(unsigned char on);
+#endif
+
 #endif
\ No newline at end of file
@@ -0,0 +1,30 @@
+/*
+ * File:   power.h
+ * Author: Kevin Macksamie
+ */
+#ifndef POWER_H
+#define POWER_H
+
+#include "common.h"
+#include "target.h"
+
+#define POWER_MIN_SLEEP_MS  4   /* Shorter idle periods are spent awake */
+#define POWER_MAX_WDTPS     10  /* Longest sleep step, WDT 1:32768 (~1 s) */
+
+/* WDT period set by the configuration word where it cannot be changed, see main.c */
+#define POWER_FIXED_WDT_MS  128
+
+/* Set up the WDT for wakeups; sleeping starts disabled */
+void power_init(void);
+
+/* Allow or forbid sleeping */
+void power_enable(uint8_t on);
+
+/* Scheduler idle function: sleep until the next task or timer is due */
+void power_idle(void);
+
+extern uint8_t power_enabled;
+extern uint16_t power_asleep;   // ms spent asleep, cleared by the reader
+extern uint16_t power_wakes;    // sleeps, cleared by the reader
+
+#endif
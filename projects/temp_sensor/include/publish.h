@@ -0,0 +1,45 @@
+/*
+ * File:   publish.h
+ * Author: Kevin Macksamie
+ */
+#ifndef PUBLISH_H
+#define PUBLISH_H
+
+#include "common.h"
+#include "registry.h"
+#include "temp.h"
+
+#define PUBLISH_MAX_SINKS           3
+
+#define PUBLISH_DEADBAND_DEFAULT    0   /* Raw LSBs (1/16 degC) a reading may move silently */
+#define PUBLISH_HEARTBEAT_DEFAULT   50  /* Samples between forced updates, 0 disables */
+
+/* Output stage callback, receives the sensor index and its reading */
+typedef void (*publish_sink_t)(uint8_t id, temp_t t);
+
+/*
+ * Publication stage between sensor acquisition and the outputs. A reading
+ * is only fanned out to the sinks when it moved more than the deadband
+ * from the last published value or when the heartbeat expired.
+ */
+typedef struct publish
+{
+    temp_t last[MAX_TEMP_SENSORS];          // last published reading
+    uint8_t age[MAX_TEMP_SENSORS];          // samples since last publish
+    uint8_t valid;                          // bit per sensor, set once published
+    uint8_t deadband;                       // see PUBLISH_DEADBAND_DEFAULT
+    uint8_t heartbeat;                      // see PUBLISH_HEARTBEAT_DEFAULT
+    uint8_t num_sinks;                      // number of registered sinks
+    publish_sink_t sinks[PUBLISH_MAX_SINKS];
+} publish_t;
+
+/* Initialize the stage with no sinks */
+void publish_init(publish_t *pub, uint8_t deadband, uint8_t heartbeat);
+
+/* Register an output sink; returns FALSE if the sink table is full */
+uint8_t publish_add_sink(publish_t *pub, publish_sink_t sink);
+
+/* Offer a new sample; returns TRUE if it was published */
+uint8_t publish_offer(publish_t *pub, uint8_t id, temp_t t);
+
+#endif
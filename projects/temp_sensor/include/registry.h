@@ -0,0 +1,70 @@
+/*
+ * File:   registry.h
+ * Author: Kevin Macksamie
+ */
+#ifndef REGISTRY_H
+#define REGISTRY_H
+
+#include "common.h"
+#include "ds18b20.h"
+#include "eeprom.h"
+#include "target.h"
+
+#ifndef DS18B20_ROM_FETCH
+#error "the registry addresses sensors by id, build with -DDS18B20_ROM_FETCH"
+#endif
+
+/*
+ * A sensor costs 6 bytes of RAM in the sampler and publication tables,
+ * and 12 more with SAMPLE_FILTER, 8 with SER_COMMANDS, 2 with SAMPLE_LOG
+ * and 2 for the dump command with both. Banked RAM has room for a few
+ * without those.
+ */
+#ifndef MAX_TEMP_SENSORS
+#if TARGET_LINEAR_RAM
+#define MAX_TEMP_SENSORS 8
+#else
+#define MAX_TEMP_SENSORS 4
+#endif
+#endif
+
+#if MAX_TEMP_SENSORS > 8
+#error "temp_sensors_t holds one bit per sensor"
+#endif
+
+/*
+ * Data EEPROM layout. The ROM codes sit at the top of the EEPROM, one
+ * 8-byte slot per sensor id. A slot whose family code is not the
+ * DS18B20's, e.g. erased EEPROM, or whose ROM fails its CRC, is free.
+ */
+#define REGISTRY_BASE       (EE_SIZE - MAX_TEMP_SENSORS * 8)
+#define REGISTRY_FREE       0xFF    /* Family code of a free slot */
+#define REGISTRY_NONE       0xFF    /* No such sensor id */
+
+#define registry_addr(id)   (REGISTRY_BASE + (id) * 8)
+
+/*
+ * Sensors known to the registry. An id is its EEPROM slot, so it stays the
+ * same across scans and power cycles; ids in use may have gaps.
+ */
+typedef struct temp_sensors
+{
+    uint8_t count;          // highest id in use plus one, 0 if none
+    uint8_t used;           // bit per id, set if its slot holds a ROM
+    uint8_t present;        // bit per id, set if it answered the last scan
+    uint8_t parasite;       // bit per id, set if parasite powered
+#ifdef OWIRE_SEGMENTS
+    uint8_t segment[MAX_TEMP_SENSORS];  // bus segment each sensor was found on
+#endif
+} temp_sensors_t;
+
+/* Load the ids in use from EEPROM; call once at startup */
+void registry_init(temp_sensors_t *sensors);
+
+/* Search the bus, giving new sensors free ids; returns the number found */
+uint8_t registry_scan(temp_sensors_t *sensors);
+
+/* Free a sensor's id; FALSE if it was not in use */
+uint8_t registry_forget(temp_sensors_t *sensors, uint8_t id);
+
+#endif
@@ -0,0 +1,64 @@
+/*
+ * File:   samplelog.h
+ * Author: Kevin Macksamie
+ */
+#ifndef SAMPLELOG_H
+#define SAMPLELOG_H
+
+#include "common.h"
+#include "registry.h"
+#include "temp.h"
+
+/*
+ * Data EEPROM layout. The log is a ring of fixed size blocks filling the
+ * EEPROM below the sensor registry, see registry.h.
+ */
+#define SAMPLELOG_BASE          0x00    /* Address of the first block */
+#define SAMPLELOG_BLOCK_SIZE    16      /* Bytes per block, header included */
+#define SAMPLELOG_BLOCKS        ((REGISTRY_BASE - SAMPLELOG_BASE) / SAMPLELOG_BLOCK_SIZE)
+
+#define SAMPLELOG_HOLD          2       /* Samples kept while a block is written */
+#define SAMPLELOG_PERIOD_MS     2       /* Poll interval while writing a block */
+#define SAMPLELOG_TIMER         1       /* One-shot timer used for writing */
+
+#if MAX_TEMP_SENSORS > 8
+#error "samplelog records hold a 3-bit sensor index"
+#endif
+
+/*
+ * Read position in the log, see samplelog_rewind()
+ */
+typedef struct samplelog_iter
+{
+    uint8_t block;                      // block being decoded
+    uint8_t off;                        // next byte in the block
+    uint8_t blocks;                     // blocks left to visit
+    uint8_t run_id;                     // sensor of the open repeat record
+    uint8_t run;                        // samples left in that record
+    temp_t prev[MAX_TEMP_SENSORS];      // last value decoded per sensor
+} samplelog_iter_t;
+
+/* Recover the log from EEPROM; call once at startup */
+void samplelog_init(void);
+
+/* Publication sink: append a sample */
+void samplelog_sink(uint8_t id, temp_t t);
+
+/* Timer handler: write a full block to EEPROM one byte at a time */
+void samplelog_task(void);
+
+/* TRUE while a block is being written */
+uint8_t samplelog_busy(void);
+
+/* Number of samples held */
+uint16_t samplelog_count(void);
+
+/* Position it at the oldest sample, then skip samples forward */
+void samplelog_rewind(samplelog_iter_t *it, uint16_t skip);
+
+/* Read the next sample, oldest first; FALSE past the newest */
+uint8_t samplelog_next(samplelog_iter_t *it, uint8_t *id, temp_t *t);
+
+extern uint8_t samplelog_dropped;
+
+#endif
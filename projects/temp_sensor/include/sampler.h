@@ -0,0 +1,78 @@
+/*
+ * File:   sampler.h
+ * Author: Kevin Macksamie
+ */
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include "common.h"
+#include "registry.h"
+#include "filter.h"
+#include "publish.h"
+
+#define SAMPLER_TIMER   0   /* One-shot timer used to wait out conversions */
+#define SAMPLER_POLL_MS 10  /* Read slot poll interval, externally powered sensors */
+
+#define SAMPLER_RETRIES     1   /* Extra scratchpad reads after a CRC failure */
+#define SAMPLER_QUARANTINE  3   /* Failed reads in a row that quarantine a sensor */
+#define SAMPLER_BACKOFF_MAX 64  /* Most passes a quarantined sensor sits out */
+#define SAMPLER_POR_STEP    32  /* Raw LSBs from the last reading a real 85 degC may be */
+
+/*
+ * Externally powered sensors converting at the same time. Keep it within
+ * what the bus supply can feed, about 1.5 mA per converting DS18B20.
+ * Parasite powered sensors always convert alone.
+ */
+#ifndef SAMPLER_CONCURRENT
+#define SAMPLER_CONCURRENT  2
+#endif
+
+/*
+ * Per sensor health. A quarantined sensor sits out backoff passes before
+ * it is probed again; each failed probe doubles backoff. The counters are
+ * only kept for the health command, built with SER_COMMANDS.
+ */
+typedef struct sampler_health
+{
+#ifdef SER_COMMANDS
+    uint16_t presence;  // reads with no presence pulse
+    uint16_t crc;       // reads that failed the CRC, retries included
+    uint16_t por;       // power-on values read
+    uint16_t retries;   // scratchpad reads repeated
+#endif
+    uint8_t fails;      // failed reads in a row
+    uint8_t backoff;    // passes sat out per probe, 0 unless quarantined
+    uint8_t skip;       // passes left before the next probe
+} sampler_health_t;
+
+extern sampler_health_t sampler_health[MAX_TEMP_SENSORS];
+
+/*
+ * Bind the sampler to the sensor table, filters and publication stage.
+ * Readings are only filtered when built with SAMPLE_FILTER; pass NULL
+ * for the filters otherwise.
+ */
+void sampler_init(temp_sensors_t *sensors, filter_t *filters, publish_t *pub);
+
+/* Periodic task: start a pass over every sensor unless one is running */
+void sampler_task(void);
+
+/* TRUE when no pass is in progress and the bus is free */
+uint8_t sampler_idle(void);
+
+/*
+ * Set every sensor's resolution (9-12 bits); call only while idle. Returns
+ * a bit per sensor id that could not be read and was left alone.
+ */
+uint8_t sampler_set_resolution(uint8_t res);
+
+/* Current resolution in bits */
+uint8_t sampler_resolution(void);
+
+/* Clear every sensor's health, e.g. after the sensor table changed */
+void sampler_clear_health(void);
+
+/* Number of quarantined sensors */
+uint8_t sampler_quarantined(void);
+
+#endif
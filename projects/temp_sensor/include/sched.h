@@ -0,0 +1,89 @@
+/*
+ * File:   sched.h
+ * Author: Kevin Macksamie
+ */
+#ifndef SCHED_H
+#define SCHED_H
+
+#include "common.h"
+#include "init.h"
+
+#define SCHED_MAX_TASKS     4   /* Size of the periodic task table: sampler, display, serial, status */
+#ifdef SAMPLE_LOG
+#define SCHED_MAX_TIMERS    2   /* Number of one-shot timers: sampler, sample log */
+#else
+#define SCHED_MAX_TIMERS    1   /* Number of one-shot timers: sampler */
+#endif
+
+/* Task or timer body, must run to completion without blocking */
+typedef void (*sched_fn_t)(void);
+
+/*
+ * Periodic task. Periods, deadlines and run times are in ticks (ms).
+ */
+typedef struct sched_task
+{
+    sched_fn_t fn;          // task body
+    uint16_t period;        // ticks between releases
+    uint16_t deadline;      // allowed start latency after release
+    uint16_t due;           // tick of next release
+    uint8_t worst;          // longest observed run time, saturates at 255
+    uint8_t late;           // releases that started past their deadline
+} sched_task_t;
+
+/*
+ * Insert this macro inside the interrupt routine. The reload is added to
+ * the count Timer1 has reached since it overflowed, so neither interrupt
+ * latency nor slots run with interrupts off make the tick late.
+ */
+#define sched_int()                                             \
+    if (TMR1IF) {                                               \
+        uint16_t t1;                                            \
+        TMR1IF = 0;                                             \
+        TMR1ON = 0;                                             \
+        t1 = ((uint16_t) TMR1H << 8) | TMR1L;                   \
+        t1 += TMR1_RELOAD + TMR1_STOP_COUNTS;                   \
+        TMR1H = t1 >> 8;                                        \
+        TMR1L = t1 & 0xFF;                                      \
+        TMR1ON = 1;                                             \
+        ++sched_ticks;                                          \
+    }
+
+/* Clear the task and timer tables */
+void sched_init(void);
+
+/* Add a periodic task; returns its index, or 0xFF if the table is full */
+uint8_t sched_add(sched_fn_t fn, uint16_t period, uint16_t deadline);
+
+/* Change a task's period, taking effect from its next release */
+void sched_set_period(uint8_t idx, uint16_t period);
+
+/* Run fn once, delay ticks from now, on one-shot timer number timer */
+void sched_oneshot(uint8_t timer, uint16_t delay, sched_fn_t fn);
+
+/* Cancel a pending one-shot timer */
+void sched_cancel(uint8_t timer);
+
+/* Current tick count */
+uint16_t sched_now(void);
+
+/* Dispatch everything that is due; returns TRUE if anything ran */
+uint8_t sched_poll(void);
+
+/* Ticks until the next task release or timer, 0 if something is due */
+uint16_t sched_idle_ticks(void);
+
+/* Move the tick count forward, e.g. by the time spent with Timer1 stopped */
+void sched_advance(uint16_t ticks);
+
+/* Function sched_run() calls whenever a poll found nothing to do */
+void sched_set_idle(sched_fn_t fn);
+
+/* Dispatch deferred work, tasks and timers forever */
+void sched_run(void);
+
+extern volatile uint16_t sched_ticks;
+extern sched_task_t sched_tasks[SCHED_MAX_TASKS];
+extern uint8_t sched_num_tasks;
+
+#endif
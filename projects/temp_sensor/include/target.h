@@ -0,0 +1,70 @@
+/*
+ * File:   target.h
+ * Author: Kevin Macksamie
+ *
+ * The part the firmware is built for. XC8 defines _PIC18 for PIC18 parts
+ * and _PIC14E for the enhanced midrange PIC16F1xxx; neither is defined for
+ * the midrange PIC16F913 the board was designed around. The rest of the
+ * firmware asks for a TARGET_* feature rather than a family, and keeps the
+ * PIC16F913 register names, which are mapped here for the other families.
+ */
+#ifndef TARGET_H
+#define TARGET_H
+
+#include <xc.h>
+#include "util.h"
+
+#if defined(_PIC18)
+#define TARGET_HW_MULTIPLY  1   /* MULWF, 8x8 bits in one cycle */
+#define TARGET_LINEAR_RAM   1   /* FSRs reach all of RAM */
+#define TARGET_WDT_PRESCALE 0   /* WDT period is fixed by the configuration word */
+#elif defined(_PIC14E)
+#define TARGET_HW_MULTIPLY  0
+#define TARGET_LINEAR_RAM   1   /* Linear data memory through FSR0/FSR1 */
+#define TARGET_WDT_PRESCALE 1   /* WDTCON WDTPS, as on the PIC16F913 */
+#else
+#define TARGET_HW_MULTIPLY  0
+#define TARGET_LINEAR_RAM   0   /* Arrays must fit an 80 byte bank */
+#define TARGET_WDT_PRESCALE 1
+#endif
+
+/* An HS crystal goes up to 20 MHz; above that it runs through the 4x PLL */
+#define TARGET_PLL          (_XTAL_FREQ > 20000000)
+
+#if TARGET_PLL && !defined(_PIC18) && !defined(_PIC14E)
+#error "the PIC16F913 has no PLL, build with _XTAL_FREQ of 20 MHz or less"
+#endif
+
+/* LCD driver module, which must be off for PORTB to be used as I/O */
+#if defined(_LCDCON_LCDEN_POSN) || (!defined(_PIC18) && !defined(_PIC14E))
+#define TARGET_HAS_LCD_MODULE   1
+#else
+#define TARGET_HAS_LCD_MODULE   0
+#endif
+
+#if defined(_PIC18)
+/* RB0/INT is INT0 */
+#define INTE                INT0IE
+#define INTF                INT0IF
+#define INTEDG              INTEDG0
+#define EEDAT               EEDATA
+#define T0IF                TMR0IF
+
+/* Timer0 free running: on, 8 bits, instruction clock, no prescaler */
+#define target_timer0_init()    (T0CON = 0xC8)
+
+/* The last wakeup was a watchdog time-out */
+#define target_wdt_timeout()    (!RCONbits.nTO)
+#else
+#if defined(_PIC14E)
+#define EEADR               EEADRL
+#define EEDAT               EEDATL
+#endif
+
+/* Timer0 free running: PSA = 1, no prescaler */
+#define target_timer0_init()    (OPTION_REG = (OPTION_REG & 0xF8) | 0x08)
+
+#define target_wdt_timeout()    (!STATUSbits.nTO)
+#endif
+
+#endif
@@ -0,0 +1,47 @@
+/*
+ * File:   temp.h
+ * Author: Kevin Macksamie
+ */
+#ifndef TEMP_H
+#define TEMP_H
+
+#include "common.h"
+
+/* Temperature units */
+#define TEMP_UNIT_C         0
+#define TEMP_UNIT_F         1
+#define TEMP_UNIT_K         2
+
+/* Rounding modes */
+#define TEMP_ROUND_TRUNC    0   /* Truncate toward zero */
+#define TEMP_ROUND_NEAREST  1   /* Round half away from zero */
+
+#define TEMP_PREC_MAX       2   /* Maximum number of decimal places */
+#define TEMP_STR_LEN        8   /* Buffer size for temp_format(), "-459.67" */
+
+/*
+ * Raw DS18B20 temperature: signed Q11.4 fixed point, 1/16 degC per LSB,
+ * exactly as read from the scratchpad's TEMP_MSB:TEMP_LSB word.
+ */
+typedef int16_t temp_t;
+
+/*
+ * Decimal temperature: magnitude scaled by 10^prec plus a sign flag, so
+ * 40.5 degF at a precision of 1 is { 0, 405 }.
+ */
+typedef struct temp_dec
+{
+    uint8_t neg;    // non-zero if the temperature is below zero
+    uint16_t mag;   // absolute value scaled by 10^prec
+} temp_dec_t;
+
+/* Build a temperature from the raw scratchpad bytes */
+temp_t temp_from_raw(uint8_t hi, uint8_t lo);
+
+/* Convert to unit at prec decimal places using rounding mode rnd */
+void temp_convert(temp_t t, uint8_t unit, uint8_t prec, uint8_t rnd, temp_dec_t *out);
+
+/* Format as a signed, null-terminated string; returns the length */
+uint8_t temp_format(const temp_dec_t *dec, uint8_t prec, char *str);
+
+#endif
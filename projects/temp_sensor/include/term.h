@@ -0,0 +1,28 @@
+/*
+ * File:   term.h
+ * Author: Kevin Macksamie
+ */
+#ifndef TERM_H
+#define TERM_H
+
+#include "common.h"
+#include "lcd.h"
+
+#define TERM_PERIOD_MS  1       /* Serial task period while the terminal runs */
+#define TERM_EXIT       0x04    /* EOT (Ctrl-D) leaves terminal mode */
+#define TERM_MAX_ARGS   2       /* Numeric parameters kept per escape sequence */
+
+#ifdef LCD_TERM
+/* Hand the LCD and serial input to the terminal, with SER_FLOW_* flow control */
+void term_start(LCD_t *lcd, uint8_t flow);
+
+/* TRUE from term_start() until TERM_EXIT is received */
+uint8_t term_active(void);
+
+/* Serial task body while active: draw all received text */
+void term_poll(void);
+#else
+#define term_active()   FALSE
+#endif
+
+#endif
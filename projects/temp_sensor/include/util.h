@@ -5,7 +5,10 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+/* Oscillator frequency, from the Makefile's F_CPU */
+#ifndef _XTAL_FREQ
 #define _XTAL_FREQ 20000000
+#endif
 
 /* Useful macros */
 #define SETBIT(ADDR,BIT) (ADDR |= (1<<BIT))
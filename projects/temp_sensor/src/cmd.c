@@ -0,0 +1,221 @@
+/*
+ * File:   cmd.c
+ * Author: Kevin Macksamie
+ *
+ * Line based command interface on the serial port. Bytes are taken from
+ * rxfifo as they arrive, each completed line runs one command and gets one
+ * REPLY frame back.
+ *
+ * Built with -DSER_COMMANDS.
+ */
+#include <xc.h>
+#include "cmd.h"
+#include "ser.h"
+#include "telem.h"
+
+#ifdef SER_COMMANDS
+
+#define CMD_IDLE        0   // assembling a line
+#define CMD_RUN         1   // handler returned CMD_PENDING
+#define CMD_REPLY       2   // waiting for txfifo room to reply
+
+#define CMD_REPLY_LEN   4
+
+uint16_t cmd_value;
+
+static const cmd_entry_t *cmd_table;
+static uint8_t cmd_count;
+static char cmd_line[CMD_LINE_LEN];
+static uint8_t cmd_len;
+static uint8_t cmd_overflow;    // TRUE when the current line was too long
+static uint8_t cmd_state;
+static const cmd_entry_t *cmd_cur;
+static uint8_t cmd_has_arg;
+static uint16_t cmd_arg;
+static uint8_t cmd_code, cmd_status;
+
+static uint8_t cmd_reply(void);
+static void cmd_dispatch(void);
+static uint8_t cmd_parse_arg(const char *p);
+
+/*****************************************************************************
+ * Subroutine: cmd_init
+ *
+ * Description:
+ * This subroutine binds the command parser to its command table and
+ * discards any partial line.
+ *
+ * Input Parameters:
+ * Command table
+ * Number of table entries
+ *
+ * Output Parameters:
+ * None
+ *
+ * Subroutines:
+ * None
+ *****************************************************************************/
+void cmd_init(const cmd_entry_t *table, uint8_t count)
+{
+    cmd_table = table;
+    cmd_count = count;
+    cmd_len = 0;
+    cmd_overflow = FALSE;
+    cmd_state = CMD_IDLE;
+}
+
+/*****************************************************************************
+ * Subroutine: cmd_poll
+ *
+ * Description:
+ * This subroutine advances the command interface without blocking. It
+ * finishes a pending reply or command first, then reads received bytes
+ * until a line is complete. Input is only taken while txfifo has room for
+ * the reply, so replies are never dropped.
+ *
+ * Input Parameters:
+ * None
+ *
+ * Output Parameters:
+ * None
+ *
+ * Subroutines:
+ * ser_getch
+ * cmd_reply
+ * command handlers
+ *****************************************************************************/
+void cmd_poll(void)
+{
+    char c;
+
+    if (cmd_state == CMD_RUN)
+    {
+        cmd_status = cmd_cur->fn(cmd_has_arg, cmd_arg);
+        if (cmd_status == CMD_PENDING)
+            return;
+        cmd_state = CMD_REPLY;
+    }
+
+    if (cmd_state == CMD_REPLY && !cmd_reply())
+        return;
+
+    while (cmd_state == CMD_IDLE && ser_isrx())
+    {
+        c = ser_getch();
+        if (c == '\r' || c == '\n')
+        {
+            // ignore the second half of CR LF and empty lines
+            if (cmd_len || cmd_overflow)
+                cmd_dispatch();
+        }
+        else if (cmd_len < CMD_LINE_LEN - 1)
+            cmd_line[cmd_len++] = c;
+        else
+            cmd_overflow = TRUE;
+    }
+
+    // reply to a command that just finished without waiting for the next poll
+    if (cmd_state == CMD_REPLY)
+        cmd_reply();
+}
+
+/*
+ * Send the REPLY frame of the last command; FALSE while txfifo has no room.
+ */
+static uint8_t cmd_reply(void)
+{
+    unsigned char reply[CMD_REPLY_LEN];
+
+    if (ser_tx_free() < TELEM_HDR_LEN + CMD_REPLY_LEN + TELEM_CRC_LEN)
+        return FALSE;
+    reply[0] = cmd_code;
+    reply[1] = cmd_status;
+    reply[2] = cmd_value >> 8;
+    reply[3] = cmd_value & 0xFF;
+    telem_emit(TELEM_T_REPLY, reply, CMD_REPLY_LEN);
+    cmd_state = CMD_IDLE;
+    return TRUE;
+}
+
+/*
+ * Look up and run the command in cmd_line.
+ */
+static void cmd_dispatch(void)
+{
+    const char *name, *p;
+    uint8_t lcv;
+
+    cmd_line[cmd_len] = '\0';
+    cmd_value = 0;
+    cmd_code = TELEM_CMD_UNKNOWN;
+    cmd_state = CMD_REPLY;
+
+    if (cmd_overflow)
+        cmd_status = TELEM_R_OVERFLOW;
+    else
+    {
+        cmd_status = TELEM_R_UNKNOWN;
+        for (lcv = 0; lcv < cmd_count; lcv++)
+        {
+            // match the command word up to the first space
+            name = cmd_table[lcv].name;
+            p = cmd_line;
+            while (*name && *name == *p)
+            {
+                ++name;
+                ++p;
+            }
+            if (*name || (*p && *p != ' '))
+                continue;
+
+            cmd_cur = &cmd_table[lcv];
+            cmd_code = cmd_cur->code;
+            if (!cmd_parse_arg(p))
+                cmd_status = TELEM_R_BADARG;
+            else if ((cmd_status = cmd_cur->fn(cmd_has_arg, cmd_arg)) == CMD_PENDING)
+                cmd_state = CMD_RUN;
+            break;
+        }
+    }
+
+    cmd_len = 0;
+    cmd_overflow = FALSE;
+}
+
+/*
+ * Parse the optional argument after the command word into cmd_has_arg and
+ * cmd_arg. Returns FALSE if it is malformed.
+ */
+static uint8_t cmd_parse_arg(const char *p)
+{
+    uint16_t v;
+
+    while (*p == ' ')
+        ++p;
+    cmd_has_arg = *p != '\0';
+    cmd_arg = 0;
+    if (!cmd_has_arg)
+        return TRUE;
+
+    if (*p >= '0' && *p <= '9')
+    {
+        v = 0;
+        while (*p >= '0' && *p <= '9')
+        {
+            if (v > 6553 || (v == 6553 && *p > '5'))
+                return FALSE;
+            v = v * 10 + (*p++ - '0');
+        }
+        cmd_arg = v;
+    }
+    else
+    {
+        cmd_arg = *p++ | 0x20;     // letters are passed lowercase
+    }
+
+    while (*p == ' ')
+        ++p;
+    return *p == '\0';
+}
+
+#endif
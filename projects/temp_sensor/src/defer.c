@@ -0,0 +1,72 @@
+/*
+ * File:   defer.c
+ * Author: Kevin Macksamie
+ *
+ * Deferred interrupt work. Interrupt routines only queue an event code;
+ * the work itself runs later from the main loop.
+ */
+#include <xc.h>
+#include "defer.h"
+
+volatile uint8_t defer_queue[DEFER_QUEUE_SIZE];
+volatile uint8_t defer_in, defer_out;
+volatile uint8_t defer_dropped;
+volatile uint8_t defer_isr_max;
+uint8_t defer_tmp;
+static defer_fn_t defer_handlers[DEFER_NUM_EVENTS];
+
+/*****************************************************************************
+ * Subroutine: defer_register
+ *
+ * Description:
+ * This subroutine sets the handler to run for an event code.
+ *
+ * Input Parameters:
+ * Event code (DEFER_EV_*)
+ * Handler, NULL to ignore the event
+ *
+ * Output Parameters:
+ * None
+ *
+ * Subroutines:
+ * None
+ *****************************************************************************/
+void defer_register(uint8_t ev, defer_fn_t fn)
+{
+    defer_handlers[ev] = fn;
+}
+
+/*****************************************************************************
+ * Subroutine: defer_dispatch
+ *
+ * Description:
+ * This subroutine drains the event queue, running each event's handler
+ * outside of interrupt context. Only the ISR writes defer_in and only this
+ * subroutine writes defer_out, so no critical section is needed.
+ *
+ * Input Parameters:
+ * None
+ *
+ * Output Parameters:
+ * None
+ *
+ * Subroutines:
+ * event handlers
+ *****************************************************************************/
+void defer_dispatch(void)
+{
+    defer_fn_t fn;
+    uint8_t ev;
+
+    while (defer_out != defer_in)
+    {
+        ev = defer_queue[defer_out];
+        defer_out = (defer_out + 1) & DEFER_QUEUE_MASK;
+        if (ev < DEFER_NUM_EVENTS)
+        {
+            fn = defer_handlers[ev];
+            if (fn)
+                fn();
+        }
+    }
+}
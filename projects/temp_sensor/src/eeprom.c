@@ -0,0 +1,48 @@
+/*
+ * File:   eeprom.c
+ * Author: Kevin Macksamie
+ *
+ * Data EEPROM access shared by the sample log and the sensor registry.
+ * Writes only start here; ee_busy() stays TRUE for the ~4 ms a write
+ * takes, and the next access waits it out.
+ */
+#include <xc.h>
+#include "eeprom.h"
+#include "target.h"
+
+uint8_t ee_read(uint8_t addr)
+{
+    while (WR)
+        continue;
+    EEADR = addr;
+    EEPGD = 0;
+#ifdef _EECON1_CFGS_POSN
+    CFGS = 0;       // data EEPROM, not the configuration words
+#endif
+    RD = 1;
+    return EEDAT;
+}
+
+/*
+ * The unlock sequence must not be interrupted between the EECON2 writes.
+ */
+void ee_write(uint8_t addr, uint8_t val)
+{
+    uint8_t gie = GIE;
+
+    while (WR)
+        continue;
+    EEADR = addr;
+    EEDAT = val;
+    EEPGD = 0;
+#ifdef _EECON1_CFGS_POSN
+    CFGS = 0;       // data EEPROM, not the configuration words
+#endif
+    WREN = 1;
+    GIE = 0;
+    EECON2 = 0x55;
+    EECON2 = 0xAA;
+    WR = 1;
+    GIE = gie;
+    WREN = 0;
+}
@@ -0,0 +1,114 @@
+/*
+ * File:   filter.c
+ * Author: Kevin Macksamie
+ */
+#include "filter.h"
+
+static temp_t median3(temp_t a, temp_t b, temp_t c);
+
+/*****************************************************************************
+ * Subroutine: filter_init
+ *
+ * Description:
+ * This subroutine configures a sensor filter. The first sample after
+ * initialization passes through every stage unchanged. A shift above
+ * FILTER_SHIFT_MAX is taken as FILTER_SHIFT_MAX.
+ *
+ * Input Parameters:
+ * Filter reference
+ * Enabled stages (FILTER_*)
+ * EWMA shift (weight of a new sample is 1/2^shift)
+ * Slew limit in raw LSBs per sample
+ *
+ * Output Parameters:
+ * None
+ *
+ * Subroutines:
+ * None
+ *****************************************************************************/
+void filter_init(filter_t *f, uint8_t flags, uint8_t shift, uint8_t slew)
+{
+    f->flags = flags;
+    f->shift = shift > FILTER_SHIFT_MAX ? FILTER_SHIFT_MAX : shift;
+    f->slew = slew;
+    f->count = 0;
+}
+
+/*****************************************************************************
+ * Subroutine: filter_update
+ *
+ * Description:
+ * This subroutine feeds a raw sample through the enabled stages: median of
+ * the last three inputs, slew-rate limit against the last output, then the
+ * shift based EWMA. The EWMA step is rounded on its magnitude, so rising
+ * and falling inputs settle alike, on the input itself while the shift is
+ * at most FILTER_SHIFT_MAX.
+ *
+ * Input Parameters:
+ * Filter reference
+ * Raw sample
+ *
+ * Output Parameters:
+ * Filtered sample
+ *
+ * Subroutines:
+ * median3
+ *****************************************************************************/
+temp_t filter_update(filter_t *f, temp_t x)
+{
+    temp_t in;
+    int24_t diff, step;
+
+    in = x;
+    if (f->count == 0)
+    {
+        // prime every stage with the first sample
+        f->hist[0] = f->hist[1] = x;
+        f->out = x;
+        f->acc = x << FILTER_FRAC;
+        f->count = 1;
+        return x;
+    }
+
+    if ((f->flags & FILTER_MEDIAN) && f->count > 1)
+        x = median3(in, f->hist[0], f->hist[1]);
+    f->hist[1] = f->hist[0];
+    f->hist[0] = in;
+    f->count = 2;
+
+    if (f->flags & FILTER_SLEW)
+    {
+        if (x > f->out + f->slew)
+            x = f->out + f->slew;
+        else if (x < f->out - f->slew)
+            x = f->out - f->slew;
+    }
+
+    if (f->flags & FILTER_EWMA)
+    {
+        // difference needs 24 bits, the accumulator itself fits in 16
+        diff = ((int24_t) x << FILTER_FRAC) - f->acc;
+        step = ((diff < 0 ? -diff : diff) + ((1 << f->shift) >> 1)) >> f->shift;
+        f->acc += (int16_t) (diff < 0 ? -step : step);
+        x = (f->acc + (1 << (FILTER_FRAC - 1))) >> FILTER_FRAC;
+    }
+
+    f->out = x;
+    return x;
+}
+
+/*
+ * Median of three values in at most three comparisons.
+ */
+static temp_t median3(temp_t a, temp_t b, temp_t c)
+{
+    if (a > b)
+    {
+        if (b > c)
+            return b;
+        return (a > c) ? c : a;
+    }
+    if (a > c)
+        return a;
+    return (b > c) ? c : b;
+}
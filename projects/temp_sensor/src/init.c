@@ -4,6 +4,7 @@
  */
 #include <xc.h>
 #include "init.h"
+#include "target.h"
 
 /*****************************************************************************
  * Subroutine: io_init
@@ -12,9 +13,11 @@
  * This subroutine sets up the input/output ports on the PIC.
  *
  * Modified Registers:
+ * ANSELB, ANSELC (parts with analog inputs on them)
  * INTCON
  * LCDCON
  * OPTION_REG
+ * TMR0
  * TRISB
  * TRISC
  *
@@ -29,11 +32,20 @@
  *****************************************************************************/
 void io_init(void)
 {
+#if TARGET_HAS_LCD_MODULE
     LCDCON = 0;     // Disable LCD control register
+#endif
+#ifdef _ANSELB_ANSB0_POSN
+    ANSELB = 0;     // RB0 and the LCD pins are digital
+#endif
+#ifdef _ANSELC_ANSC4_POSN
+    ANSELC = 0;     // So is the 1-Wire DQ on RC4
+#endif
     TRISB = 0x01;   // PORTB is used for LCD control and external interrupt
     TRISC = 0xf0;   // PORTC 0:6 are outputs
     PORTC = 0;      // Clear PORTC
     INTEDG = 0;     // Detect falling edge on RB0
+    T0CS = 0;       // Timer 0 counts instruction cycles (prescaler stays on WDT)
     INTE = 1;       // Enable RB0 interrupt
     GIE = 1;        // Enable global interrupts
 }
@@ -42,7 +54,8 @@ void io_init(void)
  * Subroutine: timer_init
  *
  * Description:
- * This subroutine sets up the clock on the PIC.
+ * This subroutine sets up Timer1 to interrupt once every millisecond. The
+ * ISR reloads the timer, see sched_int().
  *
  * Modified Registers:
  * INTCON
@@ -71,7 +84,45 @@ void timer_init(void)
     GIE = 1;        // Enable global interrupts
     
     // Setup and enable timer
-    TMR1H = 0xd8;
-    TMR1L = 0xf0;
+    TMR1H = TMR1_RELOAD >> 8;
+    TMR1L = TMR1_RELOAD & 0xFF;
     TMR1ON = 1;     // Turn on timer 1
 }
+
+#ifdef LAMP_SCAN
+/*****************************************************************************
+ * Subroutine: lamp_timer_enable
+ *
+ * Description:
+ * This subroutine starts or stops Timer2, which interrupts once per lamp
+ * scan tick, see sn74htc138_scan_int().
+ *
+ * Modified Registers:
+ * PIE
+ * PR2
+ * T2CON
+ *
+ * Input Parameters:
+ * TRUE to start the tick, FALSE to stop it
+ *
+ * Output Parameters:
+ * None
+ *
+ * Subroutines:
+ * None
+ *****************************************************************************/
+void lamp_timer_enable(unsigned char on)
+{
+    TMR2ON = 0;
+    TMR2IE = 0;
+    if (!on)
+        return;
+
+    TMR2 = 0;
+    PR2 = TMR2_PERIOD;
+    T2CON = 0x02;   // 1:16 prescaler, 1:1 postscaler
+    TMR2IF = 0;
+    TMR2IE = 1;     // Timer 2 interrupt enabled, PEIE is set by timer_init
+    TMR2ON = 1;
+}
+#endif
@@ -3,13 +3,65 @@
  * Author: Kevin Macksamie
  */
 #include <xc.h>
+#include "cmd.h"
+#include "defer.h"
 #include "ds18b20.h"
+#include "filter.h"
 #include "init.h"
 #include "lcd.h"
+#include "log.h"
+#include "power.h"
+#include "publish.h"
+#include "registry.h"
+#include "samplelog.h"
+#include "sampler.h"
+#include "sched.h"
 #include "ser.h"
+#include "sn74htc138.h"
+#include "target.h"
+#include "telem.h"
+#include "temp.h"
+#include "term.h"
 #include "util.h"
 
+/* SCK and SDO are the USART TX (RC6) and the 1-Wire DQ (RC4) on this board */
+#ifdef LCD_SPI
+#error "the LCD is on the parallel bus here, build without LCD_SPI"
+#endif
+
+/* The terminal and the baud rate are set by commands */
+#if !defined(SER_COMMANDS) && (defined(LCD_TERM) || defined(SER_RUNTIME_BAUD))
+#error "LCD_TERM and SER_RUNTIME_BAUD need SER_COMMANDS"
+#endif
+
+/* With OWIRE_SEGMENTS the decoder selects bus segments, not lamps */
+#if defined(LAMP_SCAN) && defined(OWIRE_SEGMENTS)
+#error "the decoder drives the bus segments, build without LAMP_SCAN"
+#endif
+
 // CONFIG
+#if defined(_PIC18)
+// PIC18FxxK22: HS crystal through the 4x PLL above 20 MHz, WDT under SWDTEN at 1:32 (128 ms)
+#pragma config FOSC = HSHP, PRICLKEN = ON, FCMEN = OFF, IESO = OFF
+#if TARGET_PLL
+#pragma config PLLCFG = ON
+#else
+#pragma config PLLCFG = OFF
+#endif
+#pragma config PWRTEN = OFF, BOREN = OFF, WDTEN = SWON, WDTPS = 32
+#pragma config PBADEN = OFF, MCLRE = INTMCLR, STVREN = ON, LVP = OFF, XINST = OFF, DEBUG = OFF
+#pragma config CP0 = OFF, CP1 = OFF, CPD = OFF
+#elif defined(_PIC14E)
+// PIC16F1xxx: HS crystal through the 4x PLL above 20 MHz, WDT under SWDTEN
+#pragma config FOSC = HS, WDTE = SWDTEN, PWRTE = OFF, MCLRE = OFF, CP = OFF, CPD = OFF
+#pragma config BOREN = OFF, CLKOUTEN = OFF, IESO = OFF, FCMEN = OFF
+#if TARGET_PLL
+#pragma config PLLEN = ON
+#else
+#pragma config PLLEN = OFF
+#endif
+#pragma config WRT = OFF, STVREN = ON, LVP = OFF
+#else
 #pragma config FOSC = HS    // Oscillator Selection bits (HS oscillator: High-speed crystal/resonator on RA6/OSC2/CLKOUT/T1OSO and RA7/OSC1/CLKIN/T1OSI)
 #pragma config WDTE = OFF   // Watchdog Timer Enable bit (WDT disabled and can be enabled by SWDTEN bit of the WDTCON register)
 #pragma config PWRTE = OFF  // Power Up Timer Enable bit (PWRT disabled)
@@ -20,161 +72,769 @@
 #pragma config IESO = OFF   // Internal External Switchover bit (Internal/External Switchover mode is disabled)
 #pragma config FCMEN = OFF  // Fail-Safe Clock Monitor Enabled bit (Fail-Safe Clock Monitor is disabled)
 #pragma config DEBUG = OFF  // In-Circuit Debugger Mode bit (In-Circuit Debugger disabled, RB6/ISCPCLK and RB7/ICSPDAT are general purpose I/O pins)
+#endif
+
+/* Task periods and deadlines in ms */
+#define SAMPLE_PERIOD_MS    1000
+#define DISPLAY_PERIOD_MS   100
+#define SERIAL_PERIOD_MS    10
+#define STATS_PERIOD_MS     5000
+
+/* Display and serial periods in low-power mode, so the MCU can sleep */
+#define LOWPOWER_PERIOD_MS  1000
+
+/* Build battery powered nodes with -DLOWPOWER_DEFAULT=1 */
+#ifndef LOWPOWER_DEFAULT
+#define LOWPOWER_DEFAULT    0
+#endif
+
+/* Limits of the sample period set by the period command */
+#define SAMPLE_PERIOD_MIN   100
+#define SAMPLE_PERIOD_MAX   60000
+
+/*
+ * Lamp per sensor: dim while healthy, full brightness while quarantined.
+ * Without LAMP_SCAN only the first quarantined sensor's lamp is lit.
+ */
+#define LAMP_HEALTHY        1
+#define LAMP_ALARM          SN74HTC138_STEPS
+
+/* health command: no frames being sent */
+#define HEALTH_IDLE         0xFF
+
+/* ROM table: no frames being sent */
+#define ROMS_IDLE           0xFF
+
+/* Frames of a status report, in the order they are sent */
+#define STATS_STATUS        0
+#define STATS_COUNTERS      1
+#define STATS_TASKS         2
+#define STATS_DONE          3
 
 temp_sensors_t temp_sensors;
+#ifdef SAMPLE_FILTER
+filter_t filters[MAX_TEMP_SENSORS];
+/* Filter stages of each sensor id, up to the registry's limit of 8 */
+static const filter_config_t filter_config[8] = {
+    FILTER_DEFAULT, FILTER_DEFAULT, FILTER_DEFAULT, FILTER_DEFAULT,
+    FILTER_DEFAULT, FILTER_DEFAULT, FILTER_DEFAULT, FILTER_DEFAULT
+};
+#endif
 LCD_t lcd;
-//sn74htc138_t decoder;
-volatile unsigned char rx_data = 0xaa;
-//unsigned char index = 0;
-unsigned char tmp = 0;
+#ifdef LCD_SCROLL
+unsigned char lcd_shadow[LCD_SHADOW_LEN(16, 2)];  // scroll copy of line 2
+#endif
+publish_t publisher;
+temp_t display_temp;            // latest reading for the LCD
+unsigned char display_dirty;    // TRUE when the LCD needs a redraw
+unsigned char welcome;          // TRUE while the welcome screen is up
+unsigned int uptime;            // seconds since startup
+unsigned char display_unit = TEMP_UNIT_C;   // unit of the first LCD line
+unsigned char sample_task;      // scheduler index of the sampler
+unsigned char display_task_idx; // scheduler index of the display task
+unsigned char serial_task_idx;  // scheduler index of the serial task
+unsigned char roms_next = ROMS_IDLE;        // ROM table: next sensor to send
+unsigned char stats_next = STATS_DONE;      // status report: next frame to send
+#ifdef SER_COMMANDS
+#ifdef SAMPLE_LOG
+samplelog_iter_t dump_it;       // dump command: read position
+unsigned int dump_left;         // dump command: samples still to send
+unsigned int dump_total;        // dump command: samples requested
+unsigned char dump_active;      // dump command: TRUE while sending
+#endif
+unsigned char health_next = HEALTH_IDLE;    // health command: next sensor to send
+#ifdef LCD_TERM
+unsigned char term_power;       // term command: low-power mode to restore
+#endif
+#ifdef SER_RUNTIME_BAUD
+unsigned int baud_rate = SER_BAUD / 100;    // baud command: rate in hundreds
+unsigned int baud_next;         // baud command: rate to switch to, 0 if none
+#endif
+#endif
+
+static void flush_readings(void);
+static void stats_send(void);
+static void send_roms(void);
+static void set_power(uint8_t on);
+#ifdef SAMPLE_FILTER
+static void filters_init(void);
+#endif
+#ifdef SER_COMMANDS
+static uint8_t cmd_period(uint8_t has_arg, uint16_t arg);
+static uint8_t cmd_res(uint8_t has_arg, uint16_t arg);
+static uint8_t cmd_scan(uint8_t has_arg, uint16_t arg);
+static uint8_t cmd_unit(uint8_t has_arg, uint16_t arg);
+static uint8_t cmd_roms(uint8_t has_arg, uint16_t arg);
+#ifdef SAMPLE_LOG
+static uint8_t cmd_dump(uint8_t has_arg, uint16_t arg);
+#endif
+static uint8_t cmd_power(uint8_t has_arg, uint16_t arg);
+static uint8_t cmd_health(uint8_t has_arg, uint16_t arg);
+static uint8_t cmd_forget(uint8_t has_arg, uint16_t arg);
+#ifdef LCD_TERM
+static uint8_t cmd_term(uint8_t has_arg, uint16_t arg);
+#endif
+#ifdef SER_RUNTIME_BAUD
+static uint8_t cmd_baud(uint8_t has_arg, uint16_t arg);
+#endif
+
+const cmd_entry_t commands[] = {
+    { "period", TELEM_CMD_PERIOD, cmd_period },
+    { "res",    TELEM_CMD_RES,    cmd_res },
+    { "scan",   TELEM_CMD_SCAN,   cmd_scan },
+    { "unit",   TELEM_CMD_UNIT,   cmd_unit },
+    { "roms",   TELEM_CMD_ROMS,   cmd_roms },
+#ifdef SAMPLE_LOG
+    { "dump",   TELEM_CMD_DUMP,   cmd_dump },
+#endif
+    { "power",  TELEM_CMD_POWER,  cmd_power },
+    { "health", TELEM_CMD_HEALTH, cmd_health },
+    { "forget", TELEM_CMD_FORGET, cmd_forget },
+#ifdef LCD_TERM
+    { "term",   TELEM_CMD_TERM,   cmd_term },
+#endif
+#ifdef SER_RUNTIME_BAUD
+    { "baud",   TELEM_CMD_BAUD,   cmd_baud },
+#endif
+};
+#endif
+sn74htc138_t decoder;          // drives the lamps, or the bus segments with OWIRE_SEGMENTS
+#ifdef LAMP_SCAN
+sn74htc138_scan_t lamps;
+#endif
 
 interrupt void ISR(void)
 {
+    defer_isr_enter();
+
     // RB0 interrupt (on falling edge) detected
     if (INTF)
     {
         INTF = 0;
-        lcd_clear(&lcd);
-        rx_data = 0;
+        defer_post(DEFER_EV_BUTTON);
         INTE = 1;
     }
 
-    // Timer 1 overflowed to 0x0000
-//    if (TMR1IF)
-//    {
-//        TMR1IF = 0;
-//        if ((tmp = (rx_data >> index) & 0x1))
-//        {
-//            sn74htc138_decode(&decoder, index);
-//        }
-//        else
-//        {
-//            sn74htc138_disable(&decoder);
-//        }
-//
-//        index = (index + 1) % 8;
-//        TMR1H = 0xf8;
-//        TMR1L = 0xf0;
-//        TMR1IE = 1;
-//    }
+#ifdef LAMP_SCAN
+    // Timer 2 matched PR2: next lamp scan tick
+    if (TMR2IF && TMR2IE)
+    {
+        TMR2IF = 0;
+        sn74htc138_scan_int(&lamps);
+    }
+#endif
 
+    sched_int();
     ser_int();
+
+    defer_isr_exit();
 }
 
 /*
- *********************************************************************************************************
- * long_to_string_lz()
- *
- * Description : Convert a "long" to a null-terminated string, with leading zeros
- *               (base = decimal)
- * Arguments   : input = number to be converted
- *               str = pointer to string (i.e. display buffer)
- *               numdigits = number of digits to display
- * Returns     : none
- *********************************************************************************************************
+ * Deferred RB0 handler: clear the display.
  */
-void long_to_string_lz(unsigned int input, char *str, char numdigits)
+static void button_event(void)
 {
-    char digit;
-    for (digit = numdigits; digit > 0; digit--)
+    lcd_clear(&lcd);
+}
+
+/*
+ * Publication sink: hand a reading to the display task.
+ */
+static void lcd_sink(uint8_t id, temp_t t)
+{
+    if (id == 0)
     {
-        str[digit - 1] = (input % 10) + '0';
-        input = input / 10;
+        display_temp = t;
+        display_dirty = TRUE;
     }
-    str[numdigits] = 0; // null-terminate the string
 }
 
-void km_long_to_string_lz(unsigned int input, unsigned char *str, unsigned char len)
+/*
+ * Draw display_temp in one unit on the current LCD line.
+ */
+static void display_line(unsigned char unit)
 {
-    signed char digit;
-    unsigned char first = 1;
-#ifndef NODEBUG
-    ser_puts("converting to ascii:\n\r");
+    temp_dec_t dec;
+    char strbuf[TEMP_STR_LEN];
+
+    temp_convert(display_temp, unit, TEMP_PREC_MAX, TEMP_ROUND_NEAREST, &dec);
+    temp_format(&dec, TEMP_PREC_MAX, strbuf);
+    lcd_puts(&lcd, strbuf);
+    if (unit == TEMP_UNIT_K)
+    {
+        lcd_puts(&lcd, "K");
+        return;
+    }
+    lcd_putch(&lcd, CHAR_DEGREE);
+    lcd_puts(&lcd, unit == TEMP_UNIT_F ? "F" : "C");
+}
+
+#ifdef LAMP_SCAN
+/*
+ * Show each sensor's state on its lamp.
+ */
+static void lamp_update(void)
+{
+    unsigned char id, used;
+
+    // a lone sensor found by neither search is still sampled as sensor 0
+    used = temp_sensors.count ? temp_sensors.used : 1;
+    for (id = 0; id < SN74HTC138_LINES; id++)
+    {
+        if (!((used >> id) & 1))
+            sn74htc138_scan_level(&lamps, id, 0);
+        else if (sampler_health[id].backoff)
+            sn74htc138_scan_level(&lamps, id, LAMP_ALARM);
+        else
+            sn74htc138_scan_level(&lamps, id, LAMP_HEALTHY);
+    }
+}
+#elif !defined(OWIRE_SEGMENTS)
+/*
+ * Light the lamp of the first quarantined sensor, none while all are
+ * healthy.
+ */
+static void lamp_update(void)
+{
+    unsigned char id;
+
+    for (id = 0; id < MAX_TEMP_SENSORS; id++)
+    {
+        if (sampler_health[id].backoff)
+        {
+            sn74htc138_decode(&decoder, id);
+            return;
+        }
+    }
+    sn74htc138_disable(&decoder);
+}
+#endif
+
+/*
+ * Display task: show the latest reading in the selected unit, with Celsius
+ * (or Fahrenheit when Celsius is selected) on the second line.
+ */
+static void display_task(void)
+{
+#ifndef OWIRE_SEGMENTS
+    lamp_update();
 #endif
-    for (digit = len - 2; digit >= 0; digit--)
+    if (welcome || term_active() || !display_dirty)
+        return;
+    display_dirty = FALSE;
+
+    lcd_clear(&lcd);
+    lcd_home(&lcd);
+    display_line(display_unit);
+    lcd_goto(&lcd, LCD_LINE2, 0);
+    display_line(display_unit == TEMP_UNIT_C ? TEMP_UNIT_F : TEMP_UNIT_C);
+}
+
+/*
+ * Serial task: send the pending READINGS frame and run received commands.
+ * The first byte dismisses the welcome screen. In terminal mode received
+ * text goes to the LCD instead, until the terminal exits. After a baud
+ * command nothing is sent or read until its reply has gone out at the old
+ * rate and the new rate is set. Without SER_COMMANDS received bytes are
+ * only read to dismiss the welcome screen.
+ */
+static void serial_task(void)
+{
+#if defined(SER_COMMANDS) && defined(SER_RUNTIME_BAUD)
+    if (baud_next)
     {
-        str[digit] = (input % 10) + '0';
-        input /= 10;
-#ifndef NODEBUG
-        ser_putch(str[digit]);
-        ser_puts("\n\r");
+        if (!ser_tx_idle())
+            return;
+        ser_set_baud(baud_next * 100UL);
+        baud_rate = baud_next;
+        baud_next = 0;
+    }
 #endif
-        if (first)
+#ifdef LCD_TERM
+    if (term_active())
+    {
+        term_poll();
+        if (!term_active())
         {
-            str[--digit] = '.';
-#ifndef NODEBUG
-            ser_putch(str[digit]);
-            ser_puts("\n\r");
-#endif
+            set_power(term_power);
+            display_dirty = TRUE;
         }
+        return;
+    }
+#endif
 
-        first = 0;
+    flush_readings();
+    stats_send();
+    if (welcome && ser_isrx())
+    {
+        welcome = FALSE;
+        display_dirty = TRUE;
     }
-    str[len-1] = 0; // null-terminate the string
-#ifndef NODEBUG
-    ser_putch(str[len-1]);
-    ser_puts("\n\r");
+#ifdef SER_COMMANDS
+    cmd_poll();
+#else
+    while (ser_isrx())
+        ser_getch();
 #endif
 }
 
 /*
- *********************************************************************************************************
- * long_to_string()
- *
- * Description : Convert a "long" to a null-terminated string
- *               (base = decimal)
- * Arguments   : input = number to be converted
- *               str = pointer to string (i.e. display buffer)
- *               numdigits = number of digits to display
- * Returns     : none
- *********************************************************************************************************
+ * Close the pending READINGS frame, if any, and queue it.
  */
-void long_to_string(unsigned int input, char *str, char numdigits)
+static void flush_readings(void)
 {
-    char digit;
-    int blank = 1;
+    if (telem_type() == TELEM_T_READINGS)
+        telem_send();
+}
 
-    long_to_string_lz(input, str, numdigits);
+/*
+ * Publication sink: append a reading to the pending READINGS frame. The
+ * frame goes out when it fills up or at the next serial task run, so one
+ * frame carries a whole pass over the sensors.
+ */
+static void ser_sink(uint8_t id, temp_t t)
+{
+    if (telem_type() == TELEM_T_READINGS && telem_room() < 3)
+        telem_send();
+    if (telem_type() != TELEM_T_READINGS)
+    {
+        flush_readings();
+        telem_begin(TELEM_T_READINGS);
+        telem_put16(sched_now());
+    }
+    telem_put(id);
+    telem_put16(t);
+}
+
+/*
+ * Send the ROMS frames of the registry that txfifo has room for, the ROM
+ * bytes straight from EEPROM. Set roms_next to 0 to start, and call again
+ * until it is back to ROMS_IDLE. An empty registry is one empty frame.
+ */
+static void send_roms(void)
+{
+    unsigned char j, tag;
 
-    for (digit = 0; digit < numdigits - 1; digit++)
+    flush_readings();
+    while (roms_next != ROMS_IDLE && ser_tx_free() >= TELEM_FRAME_ROOM)
     {
-        if (str[digit] == '0')
+        telem_begin(TELEM_T_ROMS);
+        for (; roms_next < temp_sensors.count && telem_room() >= 9; roms_next++)
         {
-            if (blank == 1)
-                str[digit] = ' ';
-        } 
-        else
-        {
-            blank = 0;
+            if (!((temp_sensors.used >> roms_next) & 1))
+                continue;
+            tag = roms_next;
+            if ((temp_sensors.parasite >> roms_next) & 1)
+                tag |= TELEM_ROM_PARASITE;
+            if (!((temp_sensors.present >> roms_next) & 1))
+                tag |= TELEM_ROM_MISSING;
+            telem_put(tag);
+            for (j = 0; j < 8; j++)
+                telem_put(ds18b20_rom_byte(roms_next, j));
         }
+        telem_send();
+        if (roms_next >= temp_sensors.count)
+            roms_next = ROMS_IDLE;
     }
 }
 
-void km_long_to_string(unsigned int input, unsigned char *str, unsigned char len)
+#ifdef SAMPLE_FILTER
+/*
+ * Configure each sensor's filter from filter_config and forget its history.
+ */
+static void filters_init(void)
+{
+    unsigned char i;
+
+    for (i = 0; i < MAX_TEMP_SENSORS; i++)
+        filter_init(&filters[i], filter_config[i].flags, filter_config[i].shift, filter_config[i].slew);
+}
+#endif
+
+/*
+ * Enter or leave low-power mode. In low-power mode the display and serial
+ * tasks slow down to LOWPOWER_PERIOD_MS and the MCU sleeps whenever nothing
+ * is due.
+ */
+static void set_power(uint8_t on)
 {
-    unsigned char digit;
-    unsigned char blank = 1;
+    power_enable(on);
+#ifdef LAMP_SCAN
+    // Timer2 stops while asleep, so the lamps are dark in low-power mode
+    lamp_timer_enable(!on);
+    if (on)
+        sn74htc138_disable(&decoder);
+#endif
+    sched_set_period(display_task_idx, on ? LOWPOWER_PERIOD_MS : DISPLAY_PERIOD_MS);
+    sched_set_period(serial_task_idx, on ? LOWPOWER_PERIOD_MS : SERIAL_PERIOD_MS);
+}
 
-    km_long_to_string_lz(input, str, len);
+#ifdef SER_COMMANDS
+/*
+ * period [ms]: report or set the sample period.
+ */
+static uint8_t cmd_period(uint8_t has_arg, uint16_t arg)
+{
+    if (has_arg)
+    {
+        if (arg < SAMPLE_PERIOD_MIN || arg > SAMPLE_PERIOD_MAX)
+            return TELEM_R_BADARG;
+        sched_set_period(sample_task, arg);
+    }
+    cmd_value = sched_tasks[sample_task].period;
+    return TELEM_R_OK;
+}
+
+/*
+ * res [bits]: report or set the resolution, once no pass is converting. If
+ * a sensor could not be read to set it, the reply is TELEM_R_DEVICE with
+ * a bit per such sensor id.
+ */
+static uint8_t cmd_res(uint8_t has_arg, uint16_t arg)
+{
+    if (has_arg)
+    {
+        if (arg < DS18B20_RES_MIN || arg > DS18B20_RES_MAX)
+            return TELEM_R_BADARG;
+        if (!sampler_idle())
+            return CMD_PENDING;
+        cmd_value = sampler_set_resolution(arg);
+        if (cmd_value)
+            return TELEM_R_DEVICE;
+    }
+    cmd_value = sampler_resolution();
+    return TELEM_R_OK;
+}
 
-#ifndef NODEBUG
-    ser_puts("removing leading zeros:\n\r");
+/*
+ * scan: search the bus again once no pass is converting and report the
+ * number of sensors found. Known sensors keep their ids; the registry is
+ * read with the roms command.
+ */
+static uint8_t cmd_scan(uint8_t has_arg, uint16_t arg)
+{
+    (void) arg;
+    if (has_arg)
+        return TELEM_R_BADARG;
+    if (!sampler_idle())
+        return CMD_PENDING;
+
+    cmd_value = registry_scan(&temp_sensors);
+#ifdef SAMPLE_FILTER
+    filters_init();
 #endif
-    for (digit = 0; digit < len - 1; digit++)
+    sampler_clear_health();
+    return TELEM_R_OK;
+}
+
+/*
+ * unit [c|f|k]: report or set the unit of the first LCD line.
+ */
+static uint8_t cmd_unit(uint8_t has_arg, uint16_t arg)
+{
+    static const char letters[] = { 'c', 'f', 'k' };    // by TEMP_UNIT_*
+    unsigned char unit;
+
+    if (has_arg)
+    {
+        for (unit = 0; unit < sizeof(letters) && letters[unit] != arg; unit++)
+            continue;
+        if (unit == sizeof(letters))
+            return TELEM_R_BADARG;
+        display_unit = unit;
+        display_dirty = TRUE;
+    }
+    cmd_value = letters[display_unit];
+    return TELEM_R_OK;
+}
+
+/*
+ * roms: send the ROM table, one frame per call as txfifo drains.
+ */
+static uint8_t cmd_roms(uint8_t has_arg, uint16_t arg)
+{
+    (void) arg;
+    if (has_arg)
+        return TELEM_R_BADARG;
+    if (roms_next == ROMS_IDLE)
+        roms_next = 0;
+    send_roms();
+    if (roms_next != ROMS_IDLE)
+        return CMD_PENDING;
+    cmd_value = temp_sensors.count;
+    return TELEM_R_OK;
+}
+
+#ifdef SAMPLE_LOG
+/*
+ * dump [n]: send the n newest logged samples (all without n), oldest
+ * first, one SAMPLES frame per call as txfifo drains. EEPROM is only read
+ * while the log is not writing a block.
+ */
+static uint8_t cmd_dump(uint8_t has_arg, uint16_t arg)
+{
+    uint8_t id;
+    temp_t t;
+
+    flush_readings();
+    if (samplelog_busy() || ser_tx_free() < TELEM_FRAME_ROOM)
+        return CMD_PENDING;
+
+    if (!dump_active)
+    {
+        dump_total = samplelog_count();
+        if (has_arg && arg < dump_total)
+            dump_total = arg;
+        samplelog_rewind(&dump_it, samplelog_count() - dump_total);
+        dump_left = dump_total;
+        dump_active = TRUE;
+    }
+
+    if (dump_left)
     {
-        if (str[digit] == '0')
+        telem_begin(TELEM_T_SAMPLES);
+        telem_put16(dump_left - 1);
+        while (dump_left && telem_room() >= 3)
         {
-            if (blank == 1)
-                str[digit] = ' ';
+            if (!samplelog_next(&dump_it, &id, &t))
+            {
+                dump_total -= dump_left;
+                dump_left = 0;
+                break;
+            }
+            --dump_left;
+            telem_put(id);
+            telem_put16(t);
         }
-        else
+        if (telem_len() > 2)
+            telem_send();
+        if (dump_left)
+            return CMD_PENDING;
+    }
+
+    dump_active = FALSE;
+    cmd_value = dump_total;
+    return TELEM_R_OK;
+}
+#endif
+
+/*
+ * power [0|1]: report or set low-power mode, see set_power(). Bytes
+ * received while asleep are lost, so a host should repeat a command until
+ * it gets the reply.
+ */
+static uint8_t cmd_power(uint8_t has_arg, uint16_t arg)
+{
+    if (has_arg)
+    {
+        if (arg > 1)
+            return TELEM_R_BADARG;
+        set_power(arg);
+    }
+    cmd_value = power_enabled;
+    return TELEM_R_OK;
+}
+
+/*
+ * health: send the bus counters in a COUNTERS frame, then the sensors'
+ * health in HEALTH frames, one frame per call as txfifo drains. The reply
+ * value is the number of quarantined sensors.
+ */
+static uint8_t cmd_health(uint8_t has_arg, uint16_t arg)
+{
+    sampler_health_t *h;
+    unsigned char num;
+
+    (void) arg;
+    if (has_arg)
+        return TELEM_R_BADARG;
+    flush_readings();
+    if (ser_tx_free() < TELEM_FRAME_ROOM)
+        return CMD_PENDING;
+
+    if (health_next == HEALTH_IDLE)
+    {
+        telem_begin(TELEM_T_COUNTERS);
+        telem_put(TELEM_C_NO_DEVICE);
+        telem_put16(owire_no_presence);
+        telem_put(TELEM_C_BUS_SHORT);
+        telem_put16(owire_shorts);
+        telem_put(TELEM_C_SEARCH_ERR);
+        telem_put16(ds18b20_search_errors);
+#ifdef OWIRE_SEGMENTS
+        telem_put(TELEM_C_SEG_SWITCH);
+        telem_put16(owire_switches);
+#endif
+        telem_send();
+        health_next = 0;
+        return CMD_PENDING;
+    }
+
+    // a lone sensor found by neither search is still sampled as sensor 0
+    num = temp_sensors.count ? temp_sensors.count : 1;
+    telem_begin(TELEM_T_HEALTH);
+    // unused ids go out too, with zero counts, to keep the loop simple
+    while (health_next < num && telem_room() >= 10)
+    {
+        h = &sampler_health[health_next];
+        telem_put(health_next);
+        telem_put(h->backoff);
+        telem_put16(h->presence);
+        telem_put16(h->crc);
+        telem_put16(h->por);
+        telem_put16(h->retries);
+        ++health_next;
+    }
+    telem_send();
+    if (health_next < num)
+        return CMD_PENDING;
+
+    health_next = HEALTH_IDLE;
+    cmd_value = sampler_quarantined();
+    return TELEM_R_OK;
+}
+
+/*
+ * forget <id>: free a sensor's registry slot once no pass is converting,
+ * e.g. after it was replaced, so the next scan can reuse the id. The reply
+ * value is the id.
+ */
+static uint8_t cmd_forget(uint8_t has_arg, uint16_t arg)
+{
+    if (!has_arg || arg >= MAX_TEMP_SENSORS)
+        return TELEM_R_BADARG;
+    if (!sampler_idle())
+        return CMD_PENDING;
+    if (!registry_forget(&temp_sensors, arg))
+        return TELEM_R_BADARG;
+    cmd_value = arg;
+    return TELEM_R_OK;
+}
+
+#ifdef LCD_TERM
+/*
+ * term [flow]: turn the serial port into a text terminal for the LCD until
+ * EOT (Ctrl-D) is received. flow is the SER_FLOW_* bits, 1 (XON/XOFF) by
+ * default. Low-power mode is suspended meanwhile, since bytes received in
+ * sleep are lost. The reply value is the flow control in use.
+ */
+static uint8_t cmd_term(uint8_t has_arg, uint16_t arg)
+{
+    if (!has_arg)
+        arg = SER_FLOW_XONXOFF;
+#ifdef SER_RTS_PIN
+    if (arg > (SER_FLOW_XONXOFF | SER_FLOW_RTS))
+#else
+    if (arg > SER_FLOW_XONXOFF)
+#endif
+        return TELEM_R_BADARG;
+    // room for the reply, the last frame before the terminal takes over
+    if (ser_tx_free() < TELEM_FRAME_ROOM)
+        return CMD_PENDING;
+
+    term_power = power_enabled;
+    set_power(FALSE);
+    sched_set_period(serial_task_idx, TERM_PERIOD_MS);
+    welcome = FALSE;
+    term_start(&lcd, arg);
+    cmd_value = arg;
+    return TELEM_R_OK;
+}
+#endif
+
+#ifdef SER_RUNTIME_BAUD
+/*
+ * baud [rate/100]: report or set the baud rate in hundreds of baud, e.g.
+ * 1152 for 115200. The reply goes out at the old rate and the serial task
+ * switches once it has been sent, so the host switches on the reply.
+ */
+static uint8_t cmd_baud(uint8_t has_arg, uint16_t arg)
+{
+    if (has_arg)
+    {
+        if (!ser_baud_ok(arg * 100UL))
+            return TELEM_R_BADARG;
+        baud_next = arg;
+    }
+    cmd_value = has_arg ? arg : baud_rate;
+    return TELEM_R_OK;
+}
+#endif
+#endif
+
+/*
+ * Status task: start a report of uptime and sensor count in a STATUS
+ * frame, then the interrupt, power and scheduler counters in two COUNTERS
+ * frames. Together they overflow txfifo, so frames that do not fit now
+ * are left to the serial task.
+ */
+static void stats_task(void)
+{
+    uptime += STATS_PERIOD_MS / 1000;
+    flush_readings();
+    stats_next = STATS_STATUS;
+    stats_send();
+}
+
+/*
+ * Send the frames of the status report that txfifo has room for. The
+ * sleep counters cover the time since the previous report.
+ */
+static void stats_send(void)
+{
+    static unsigned int last;
+    unsigned int now;
+    unsigned char lcv;
+
+    while (stats_next != STATS_DONE && ser_tx_free() >= TELEM_FRAME_ROOM)
+    {
+        switch (stats_next)
         {
-            blank = 0;
-        }
-#ifndef NODEBUG
-        ser_putch(str[digit]);
-        ser_puts("\n\r");
+        case STATS_STATUS:
+            telem_begin(TELEM_T_STATUS);
+            telem_put16(uptime);
+            telem_put(temp_sensors.count);
+            telem_put(welcome);
+            break;
+        case STATS_COUNTERS:
+            telem_begin(TELEM_T_COUNTERS);
+            telem_put(TELEM_C_ISR_MAX);
+            telem_put16(defer_isr_max);
+            telem_put(TELEM_C_DEFER_DROP);
+            telem_put16(defer_dropped);
+            telem_put(TELEM_C_RX_DROP);
+            telem_put16(ser_rx_dropped);
+            telem_put(TELEM_C_TX_DROP);
+            telem_put16(telem_dropped);
+#ifdef SAMPLE_LOG
+            telem_put(TELEM_C_LOG_DROP);
+            telem_put16(samplelog_dropped);
 #endif
+            now = sched_now();
+            telem_put(TELEM_C_AWAKE_MS);
+            telem_put16(now - last - power_asleep);
+            telem_put(TELEM_C_ASLEEP_MS);
+            telem_put16(power_asleep);
+            telem_put(TELEM_C_WAKES);
+            telem_put16(power_wakes);
+            last = now;
+            power_asleep = 0;
+            power_wakes = 0;
+            break;
+        default:
+            telem_begin(TELEM_T_COUNTERS);
+            for (lcv = 0; lcv < sched_num_tasks && telem_room() >= 6; lcv++)
+            {
+                telem_put(TELEM_C_TASK_WORST + lcv);
+                telem_put16(sched_tasks[lcv].worst);
+                telem_put(TELEM_C_TASK_LATE + lcv);
+                telem_put16(sched_tasks[lcv].late);
+            }
+            break;
+        }
+        telem_send();
+        ++stats_next;
     }
 }
 
@@ -182,11 +842,17 @@ void km_long_to_string(unsigned int input, unsigned char *str, unsigned char len
  * Entry point to the MCU application.
  */
 int main(void) {
+
     lcd.data_bus = (unsigned char *) &PORTB;
     lcd.bus_offset = 4;
-    lcd.en_pin = (unsigned char*)((((unsigned char) &PORTB) << 3) + 3);
-    lcd.rs_pin = (unsigned char*)((((unsigned char) &PORTB) << 3) + 2);
-    lcd.rw_pin = (unsigned char*)((((unsigned char) &PORTB) << 3) + 1);
+    lcd.ctrl_port = (unsigned char *) &PORTB;
+    lcd.en_mask = 1 << 3;
+    lcd.rs_mask = 1 << 2;
+    lcd.rw_mask = 1 << 1;
+    lcd.geo = &lcd_16x2;
+#ifdef LCD_SCROLL
+    lcd.shadow = lcd_shadow;
+#endif
 
     // Initialization procedure
     io_init();
@@ -199,157 +865,62 @@ int main(void) {
     owire_hw.tris = (uint8_t *) &TRISC;
     temp_sensors.bus = &owire_hw;*/
     
-//    decoder.a_bit = 0;
-//    decoder.b_bit = 1;
-//    decoder.c_bit = 2;
-//    decoder.enable_bit = 3;
-//    decoder.zero_based = 1;
-//    decoder.port = (unsigned char *) &PORTC;
-
-    //timer_init();
-#ifndef NODEBUG
-    ser_puts("Detecting sensors...\n\r");
-#endif
-    ds18b20_find_devices(&temp_sensors);
-#ifndef NODEBUG
-    ser_puts("Detection complete\n\r");
+    decoder.a_bit = 0;
+    decoder.b_bit = 1;
+    decoder.c_bit = 2;
+    decoder.enable_bit = 3;
+    decoder.zero_based = 1;
+    decoder.port = (unsigned char *) &PORTC;
+#ifdef OWIRE_SEGMENTS
+    owire_segment_init(&decoder);
+#elif defined(LAMP_SCAN)
+    sn74htc138_scan_init(&lamps, &decoder);
 #endif
 
-#ifndef NODEBUG
-    unsigned char i, j, k;
-    for (i = 0; i < MAX_TEMP_SENSORS; i++)
-    {
-        ser_puts("Device: ");
-        for (j = 0; j < 8; j++)
-        {
-            for (k = 0; k < 8; k++)
-            {
-                if ((temp_sensors.ROMS[i][j] >> k) & 0x01)
-                    ser_puts("1");
-                else
-                    ser_puts("0");
-            }
-        }
-        ser_puts("\n\r");
-    }
-
+    defer_register(DEFER_EV_BUTTON, button_event);
+    sched_init();
+    power_init();
+    timer_init();
+    LOG(MAIN, LOG_INFO, "Detecting sensors...");
+    registry_init(&temp_sensors);
+    registry_scan(&temp_sensors);
+    LOG1(MAIN, LOG_DEBUG, "Detection complete, bus reads %u", owire_read());
 
-    if (owire_read())
-        ser_puts("read 1");
-    else
-        ser_puts("read 0");
-    ser_puts("\n\r");
-#endif
+    roms_next = 0;
+    while (roms_next != ROMS_IDLE)
+        send_roms();
 
     lcd_puts(&lcd, "Welcome!\nStart typing @$%");
-    ser_puts("Welcome to the LCD module serial interface!\n\r");
+    LOG(MAIN, LOG_INFO, "Welcome to the LCD module serial interface!");
 
-    rx_data = ser_getch();
-    lcd_clear(&lcd);
-//    lcd_putch(rx_data);
-//    ser_putch(rx_data);
-
-    unsigned char T_MSB;
-    unsigned char T_LSB;
-    unsigned char TempHi_C; // Raw high byte
-    unsigned char TempLo_C; // Raw low byte
-    unsigned char strbuf[8];
-    unsigned int tmp16;
-    while (1)
-    {
-//    	rx_data = ser_getch();  // Block on serial line
-//    	ser_putch(rx_data);     // Echo input back to transmitter
-//    	lcd_putch(rx_data);     // Write received data to LCD
-//
-        ds18b20_convert_temp(0);//temp_sensors.ROMS[curr_ROM]);
-        TempHi_C = ds18b20_temp_hi();
-        TempLo_C = ds18b20_temp_lo();
-
-        // partition number from fraction
-        T_MSB = ((TempHi_C << 4) & 0xF0) | ((TempLo_C >> 4) & 0x0F);
-        T_LSB = TempLo_C & 0x0F;
-
-        lcd_clear(&lcd);
-        lcd_home(&lcd);
-        if (TempHi_C & 0x80)
-        {
-            lcd_puts(&lcd, "-");
-            T_MSB ^= 0xFF;
-            T_LSB = ((T_LSB ^ 0xFF) + 1) & 0x0F;
-        }
-        else
-        {
-            lcd_puts(&lcd, "+");
-        }
-        long_to_string(T_MSB, strbuf, 3);   // integer is 3 sig figs
-        lcd_puts(&lcd, strbuf);
-        lcd_puts(&lcd, ".");
-        tmp16 = ((unsigned int) T_LSB) * 625;
-        long_to_string_lz(tmp16, strbuf, 4);  // fraction is 4 sig figs
-        lcd_puts(&lcd, strbuf);
-        lcd_putch(&lcd, CHAR_DEGREE);
-        lcd_puts(&lcd, "C");
-
-        lcd_goto(&lcd, LCD_LINE2);
-
-        // ----- Conversion to Fahrenheit -----
-        // 10F = 16C + (16C + 4) / 8 + 320
-        // where: 16C = TempHi_C:TempLo_C
-
-        unsigned char _TempLo_C;    // modified low byte
-        unsigned char _TempHi_C;    // modified high byte
-
-        _TempLo_C = TempLo_C;
-        _TempHi_C = TempHi_C;
-
-        // add 4 to round fraction part, but ignore overflow into the integer part
-        _TempLo_C = ((_TempLo_C + 4) & 0x0F) | (_TempLo_C & 0xF0); // add 4
-
-        // divide by 8: >> 3 both bytes, carry bottom 3 from high byte to the lower
-        _TempLo_C >>= 3;         // shift low byte
-        tmp = TempHi_C & 0x03;   // capture bottom 3 bits from high byte
-        _TempLo_C |= (tmp << 5); // insert bottom 3 bits of high byte to top of lower
-        _TempHi_C >>= 3;         // shift high byte
-        if (TempHi_C & 0x80)     // is measured temperature negative?
-            _TempHi_C |= 0xE0;   // sign extend
-
-        // add measured temperture to divided temperature
-        _TempLo_C += TempLo_C;   // add two low bytes
-        if (STATUSbits.C)
-            _TempHi_C++;         // mind overflow
-        _TempHi_C += TempHi_C;   // add two high bytes
-
-        // add 320
-        _TempLo_C += 0x40;       // add low byte of 320
-        if (STATUSbits.C)
-            _TempHi_C++;         // mind overflow
-        _TempHi_C += 0x01;       // add high byte of 320
-
-        //
-        // <_TempHi_C:_TempLo_C> stores the approx. F temp multipled by 10
-        //
-
-        unsigned int temperature = _TempHi_C;
-        temperature = (temperature << 8) | _TempLo_C;
-
-        km_long_to_string(temperature, strbuf, 8);
-
-        if (TempHi_C & 0x80)
-            lcd_puts(&lcd, "- ");
-        else
-            lcd_puts(&lcd, "+ ");
+    welcome = TRUE;
 
-        // trim string to display
-        for (tmp = 0; tmp < 8; tmp++)
-        {
-            if (strbuf[tmp] != ' ' && strbuf[tmp] != 0)
-                lcd_putch(&lcd, strbuf[tmp]);
-        }
-        lcd_putch(&lcd, CHAR_DEGREE);
-        lcd_puts(&lcd, "F");
+#ifdef SAMPLE_FILTER
+    filters_init();
+#endif
+    publish_init(&publisher, PUBLISH_DEADBAND_DEFAULT, PUBLISH_HEARTBEAT_DEFAULT);
+    publish_add_sink(&publisher, lcd_sink);
+    publish_add_sink(&publisher, ser_sink);
+#ifdef SAMPLE_LOG
+    publish_add_sink(&publisher, samplelog_sink);
+    samplelog_init();
+#endif
+#ifdef SAMPLE_FILTER
+    sampler_init(&temp_sensors, filters, &publisher);
+#else
+    sampler_init(&temp_sensors, NULL, &publisher);
+#endif
+#ifdef SER_COMMANDS
+    cmd_init(commands, sizeof(commands) / sizeof(commands[0]));
+#endif
 
-        __delay_ms(100);
-    }
+    sample_task = sched_add(sampler_task, SAMPLE_PERIOD_MS, SAMPLE_PERIOD_MS / 10);
+    display_task_idx = sched_add(display_task, DISPLAY_PERIOD_MS, DISPLAY_PERIOD_MS);
+    serial_task_idx = sched_add(serial_task, SERIAL_PERIOD_MS, SERIAL_PERIOD_MS);
+    sched_add(stats_task, STATS_PERIOD_MS, STATS_PERIOD_MS);
+    sched_set_idle(power_idle);
+    set_power(LOWPOWER_DEFAULT);
+    sched_run();
 
     return 0;
 }
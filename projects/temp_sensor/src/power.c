@@ -0,0 +1,126 @@
+/*
+ * File:   power.c
+ * Author: Kevin Macksamie
+ *
+ * Low-power idle. When nothing is due for a while the MCU sleeps and the
+ * watchdog wakes it. Timer1 runs from the instruction clock and stops in
+ * sleep, so the scheduler tick is moved forward by the nominal watchdog
+ * period after each wakeup.
+ *
+ * Timer1's own oscillator would keep better time, but on this board its
+ * T1OSO/T1OSI pins are taken by the HS crystal.
+ */
+#include <xc.h>
+#include "power.h"
+#include "sched.h"
+#include "ser.h"
+
+uint8_t power_enabled;
+uint16_t power_asleep;
+uint16_t power_wakes;
+
+#if TARGET_WDT_PRESCALE
+/* Nominal WDT period in ms by WDTPS: 32 << WDTPS cycles of the 31 kHz LFINTOSC */
+static const uint16_t power_wdt_ms[POWER_MAX_WDTPS + 1] = {
+    1, 2, 4, 8, 17, 33, 66, 132, 264, 529, 1057
+};
+#endif
+
+/*****************************************************************************
+ * Subroutine: power_init
+ *
+ * Description:
+ * This subroutine gives the watchdog its base period. The Timer0/WDT
+ * prescaler stays assigned to the WDT at 1:1 so that Timer0 keeps counting
+ * every instruction cycle. The WDT itself is only enabled around SLEEP
+ * (WDTE is off in the configuration word). On a PIC18 the period is set
+ * by the configuration word instead, POWER_FIXED_WDT_MS.
+ *
+ * Input Parameters:
+ * None
+ *
+ * Output Parameters:
+ * None
+ *
+ * Subroutines:
+ * None
+ *****************************************************************************/
+void power_init(void)
+{
+    target_timer0_init();
+#if TARGET_WDT_PRESCALE
+    WDTCON = 0;     // 1:32, SWDTEN = 0
+#else
+    SWDTEN = 0;
+#endif
+    power_enabled = FALSE;
+    power_asleep = 0;
+    power_wakes = 0;
+}
+
+void power_enable(uint8_t on)
+{
+    power_enabled = on;
+}
+
+/*****************************************************************************
+ * Subroutine: power_idle
+ *
+ * Description:
+ * This subroutine sleeps through idle time. It picks the longest WDT
+ * period that ends before the next task or timer is due and sleeps once.
+ * It stays awake while the serial port or EEPROM still has work, since
+ * both stop in sleep. A wakeup by an interrupt (not the WDT time-out)
+ * comes at an unknown point of the period and moves the tick by nothing,
+ * so the clock runs late by at most one period in that case.
+ *
+ * Input Parameters:
+ * None
+ *
+ * Output Parameters:
+ * None
+ *
+ * Subroutines:
+ * sched_idle_ticks
+ * sched_advance
+ *****************************************************************************/
+void power_idle(void)
+{
+    uint16_t idle, ms;
+#if TARGET_WDT_PRESCALE
+    uint8_t ps;
+#endif
+
+    if (!power_enabled)
+        return;
+    idle = sched_idle_ticks();
+    if (idle < POWER_MIN_SLEEP_MS)
+        return;
+    if (ser_tx_count() || !TRMT || ser_isrx() || WR)
+        return;
+
+#if TARGET_WDT_PRESCALE
+    ps = POWER_MAX_WDTPS;
+    while (ps && power_wdt_ms[ps] > idle)
+        --ps;
+    ms = power_wdt_ms[ps];
+    WDTCON = ps << 1;
+#else
+    if (idle < POWER_FIXED_WDT_MS)
+        return;
+    ms = POWER_FIXED_WDT_MS;
+#endif
+
+    CLRWDT();
+    SWDTEN = 1;
+    SLEEP();
+    NOP();
+    SWDTEN = 0;
+
+    ++power_wakes;
+    if (target_wdt_timeout())
+    {
+        sched_advance(ms);
+        power_asleep += ms;
+    }
+}
@@ -0,0 +1,103 @@
+/*
+ * File:   publish.c
+ * Author: Kevin Macksamie
+ */
+#include "publish.h"
+
+/*****************************************************************************
+ * Subroutine: publish_init
+ *
+ * Description:
+ * This subroutine resets the publication stage. Every sensor is published
+ * on its first sample.
+ *
+ * Input Parameters:
+ * Publication stage reference
+ * Deadband in raw LSBs
+ * Heartbeat in samples (0 disables)
+ *
+ * Output Parameters:
+ * None
+ *
+ * Subroutines:
+ * None
+ *****************************************************************************/
+void publish_init(publish_t *pub, uint8_t deadband, uint8_t heartbeat)
+{
+    pub->valid = 0;
+    pub->deadband = deadband;
+    pub->heartbeat = heartbeat;
+    pub->num_sinks = 0;
+}
+
+/*****************************************************************************
+ * Subroutine: publish_add_sink
+ *
+ * Description:
+ * This subroutine registers an output to be notified of published samples.
+ *
+ * Input Parameters:
+ * Publication stage reference
+ * Sink callback
+ *
+ * Output Parameters:
+ * TRUE if registered, FALSE if the sink table is full
+ *
+ * Subroutines:
+ * None
+ *****************************************************************************/
+uint8_t publish_add_sink(publish_t *pub, publish_sink_t sink)
+{
+    if (pub->num_sinks >= PUBLISH_MAX_SINKS)
+        return FALSE;
+    pub->sinks[pub->num_sinks++] = sink;
+    return TRUE;
+}
+
+/*****************************************************************************
+ * Subroutine: publish_offer
+ *
+ * Description:
+ * This subroutine compares a new sample against the last published value
+ * of its sensor and fans it out to every sink if it changed by more than
+ * the deadband or if the heartbeat interval has elapsed.
+ *
+ * Input Parameters:
+ * Publication stage reference
+ * Sensor index
+ * Sample
+ *
+ * Output Parameters:
+ * TRUE if the sample was published
+ *
+ * Subroutines:
+ * sink callbacks
+ *****************************************************************************/
+uint8_t publish_offer(publish_t *pub, uint8_t id, temp_t t)
+{
+    temp_t delta;
+    uint8_t mask;
+    uint8_t lcv;
+
+    mask = 1 << id;
+    if (pub->valid & mask)
+    {
+        delta = t - pub->last[id];
+        if (delta < 0)
+            delta = -delta;
+
+        ++pub->age[id];
+        if (delta <= pub->deadband &&
+                (pub->heartbeat == 0 || pub->age[id] < pub->heartbeat))
+            return FALSE;
+    }
+
+    pub->last[id] = t;
+    pub->age[id] = 0;
+    pub->valid |= mask;
+
+    for (lcv = 0; lcv < pub->num_sinks; lcv++)
+        pub->sinks[lcv](id, t);
+
+    return TRUE;
+}
@@ -0,0 +1,261 @@
+/*
+ * File:   registry.c
+ * Author: Kevin Macksamie
+ *
+ * Sensor registry. ROM codes live in data EEPROM and each sensor is known
+ * by its slot number, a one byte id. A scan keeps the id of every sensor
+ * it finds again and gives a new sensor the lowest free slot, so ids (and
+ * the sample log and telemetry that use them) survive rescans and power
+ * cycles. Match ROM streams the ROM bytes from EEPROM, so no ROM table is
+ * held in RAM.
+ */
+#include "registry.h"
+#include "log.h"
+#include "owire.h"
+
+static uint8_t registry_valid(uint8_t id);
+static uint8_t registry_find(temp_sensors_t *sensors, const uint8_t ROM[]);
+static uint8_t registry_add(temp_sensors_t *sensors, const uint8_t ROM[]);
+static uint8_t registry_scan_bus(temp_sensors_t *sensors, uint8_t segment);
+static void registry_count(temp_sensors_t *sensors);
+
+/*
+ * ROM byte source for match ROM, see ds18b20.h
+ */
+unsigned char ds18b20_rom_byte(ds18b20_rom_t id, unsigned char index)
+{
+    return ee_read(registry_addr(id) + index);
+}
+
+/*****************************************************************************
+ * Subroutine: registry_init
+ *
+ * Description:
+ * This subroutine loads which ids are in use from the EEPROM slots. A
+ * slot without the DS18B20 family code or that fails its ROM CRC, e.g.
+ * one holding sample log data from an older build, counts as free. No sensor counts as present until the
+ * first scan.
+ *
+ * Input Parameters:
+ * Sensor table reference
+ *
+ * Output Parameters:
+ * None
+ *
+ * Subroutines:
+ * registry_valid
+ *****************************************************************************/
+void registry_init(temp_sensors_t *sensors)
+{
+    uint8_t id;
+
+    sensors->used = 0;
+    sensors->present = 0;
+    sensors->parasite = 0;
+    for (id = 0; id < MAX_TEMP_SENSORS; id++)
+    {
+        if (registry_valid(id))
+            sensors->used |= 1 << id;
+#ifdef OWIRE_SEGMENTS
+        sensors->segment[id] = 0;
+#endif
+    }
+    registry_count(sensors);
+    LOG2(REGISTRY, LOG_INFO, "%u slot(s) in use, ids %02x", sensors->count, sensors->used);
+}
+
+/*****************************************************************************
+ * Subroutine: registry_scan
+ *
+ * Description:
+ * This subroutine searches every bus segment. A sensor already in the
+ * registry keeps its id; a new one is written to the lowest free slot.
+ * Sensors that do not answer keep their ids until forgotten. The power
+ * mode of each sensor found is read back.
+ *
+ * Input Parameters:
+ * Sensor table reference
+ *
+ * Output Parameters:
+ * Number of sensors found
+ *
+ * Subroutines:
+ * owire_segment
+ * registry_scan_bus
+ *****************************************************************************/
+uint8_t registry_scan(temp_sensors_t *sensors)
+{
+    uint8_t found = 0;
+#ifdef OWIRE_SEGMENTS
+    uint8_t segment;
+#endif
+
+    sensors->present = 0;
+    sensors->parasite = 0;
+#ifdef OWIRE_SEGMENTS
+    for (segment = 0; segment < OWIRE_SEGMENT_COUNT; segment++)
+    {
+        owire_segment(segment);
+        found += registry_scan_bus(sensors, segment);
+    }
+#else
+    found = registry_scan_bus(sensors, 0);
+#endif
+
+    if (sensors->count == 0)
+        sensors->parasite = 1;  // a lone sensor read with skip ROM, assume the worst
+    LOG2(REGISTRY, LOG_INFO, "found %u sensor(s), parasite powered %02x", found, sensors->parasite);
+    return found;
+}
+
+/*****************************************************************************
+ * Subroutine: registry_forget
+ *
+ * Description:
+ * This subroutine frees a sensor's slot by erasing its family code, so a
+ * replaced sensor's id can be reused by the next scan.
+ *
+ * Input Parameters:
+ * Sensor table reference
+ * Sensor id
+ *
+ * Output Parameters:
+ * TRUE if the id was in use
+ *
+ * Subroutines:
+ * ee_write
+ *****************************************************************************/
+uint8_t registry_forget(temp_sensors_t *sensors, uint8_t id)
+{
+    if (id >= MAX_TEMP_SENSORS || !((sensors->used >> id) & 1))
+        return FALSE;
+    ee_write(registry_addr(id), REGISTRY_FREE);
+    sensors->used &= ~(1 << id);
+    sensors->present &= ~(1 << id);
+    sensors->parasite &= ~(1 << id);
+    registry_count(sensors);
+    LOG1(REGISTRY, LOG_INFO, "sensor %u forgotten", id);
+    return TRUE;
+}
+
+/*
+ * TRUE if a slot holds a DS18B20 ROM with a good CRC. The family code
+ * check also turns down an all-zero slot, whose CRC is good.
+ */
+static uint8_t registry_valid(uint8_t id)
+{
+    uint8_t ROM[8], lcv;
+
+    for (lcv = 0; lcv < 8; lcv++)
+        ROM[lcv] = ee_read(registry_addr(id) + lcv);
+    return ROM[0] == DS18B20_FAMILY && ds18b20_crc8(ROM, 8) == 0;
+}
+
+/*
+ * Id whose slot holds ROM, REGISTRY_NONE if there is none.
+ */
+static uint8_t registry_find(temp_sensors_t *sensors, const uint8_t ROM[])
+{
+    uint8_t id, lcv;
+
+    for (id = 0; id < MAX_TEMP_SENSORS; id++)
+    {
+        if (!((sensors->used >> id) & 1))
+            continue;
+        for (lcv = 0; lcv < 8 && ee_read(registry_addr(id) + lcv) == ROM[lcv]; lcv++)
+            continue;
+        if (lcv == 8)
+            return id;
+    }
+    return REGISTRY_NONE;
+}
+
+/*
+ * Write ROM to the lowest free slot; REGISTRY_NONE if the registry is
+ * full. The family code goes last, so a slot cut short by a reset still
+ * reads as free.
+ */
+static uint8_t registry_add(temp_sensors_t *sensors, const uint8_t ROM[])
+{
+    uint8_t id, lcv;
+
+    for (id = 0; id < MAX_TEMP_SENSORS; id++)
+    {
+        if ((sensors->used >> id) & 1)
+            continue;
+        for (lcv = 7; lcv > 0; lcv--)
+            ee_write(registry_addr(id) + lcv, ROM[lcv]);
+        ee_write(registry_addr(id), ROM[0]);
+        sensors->used |= 1 << id;
+        registry_count(sensors);
+        return id;
+    }
+    return REGISTRY_NONE;
+}
+
+/*
+ * Search the connected bus segment; returns the number of sensors found.
+ */
+static uint8_t registry_scan_bus(temp_sensors_t *sensors, uint8_t segment)
+{
+    ds18b20_search_t search;
+    uint8_t id, found = 0;
+
+    if (!owire_reset_pulse())
+    {
+        LOG1(REGISTRY, LOG_WARN, "no presence pulse on segment %u", segment);
+        return 0;
+    }
+    if (!ds18b20_search_first(&search))
+    {
+        LOG1(REGISTRY, LOG_WARN, "no device found on segment %u", segment);
+        return 0;
+    }
+
+    do
+    {
+        id = registry_find(sensors, search.ROM);
+        if (id == REGISTRY_NONE)
+        {
+            id = registry_add(sensors, search.ROM);
+            if (id == REGISTRY_NONE)
+            {
+                LOG(REGISTRY, LOG_WARN, "registry full, sensor not added");
+                continue;
+            }
+            LOG2(REGISTRY, LOG_INFO, "new sensor %u on segment %u", id, segment);
+        }
+        else if ((sensors->present >> id) & 1)
+        {
+            // a misread bit can send the search down a path already taken
+            LOG1(REGISTRY, LOG_WARN, "sensor %u found twice", id);
+            ++ds18b20_search_errors;
+            continue;
+        }
+
+        sensors->present |= 1 << id;
+#ifdef OWIRE_SEGMENTS
+        sensors->segment[id] = segment;
+#endif
+        ++found;
+        // every search step starts with a reset, so the bus is free here
+        if (ds18b20_read_power(id))
+            sensors->parasite |= 1 << id;
+    } while (ds18b20_search_next(&search));
+    return found;
+}
+
+/*
+ * Recompute count from the ids in use.
+ */
+static void registry_count(temp_sensors_t *sensors)
+{
+    uint8_t id;
+
+    sensors->count = 0;
+    for (id = 0; id < MAX_TEMP_SENSORS; id++)
+    {
+        if ((sensors->used >> id) & 1)
+            sensors->count = id + 1;
+    }
+}
@@ -0,0 +1,525 @@
+/*
+ * File:   samplelog.c
+ * Author: Kevin Macksamie
+ *
+ * History of published samples in a ring of data EEPROM blocks.
+ *
+ * Samples are delta encoded against the previous sample of the same sensor
+ * into a block assembled in RAM. Only full blocks are written, one byte
+ * per task run, so EEPROM write time never lands on the sampling path.
+ * Blocks are used in turn, which spreads wear evenly, and the write
+ * position is recovered at startup from the block sequence numbers
+ * instead of being stored in a fixed cell.
+ *
+ * Block: SEQ | CHECK | records...
+ *   SEQ    0-254, one more than the previous block; 0xFF is unwritten
+ *   CHECK  complement of the sum of SEQ and the record bytes
+ * Records:
+ *   0iiidddd          delta -8..7 from sensor i's previous sample
+ *   10iiirrr          sensor i repeated its previous sample r + 1 times
+ *   11000iii HI LO    absolute sample, first of each sensor in a block
+ *   11001iii V...     zigzag delta as a little-endian base-128 varint
+ *   0xFF              end of block
+ * Every block starts each sensor with an absolute sample, so losing the
+ * oldest block to the ring never breaks decoding of the rest.
+ *
+ * Built with -DSAMPLE_LOG.
+ */
+#include <xc.h>
+#include "eeprom.h"
+#include "samplelog.h"
+#include "sched.h"
+
+#ifdef SAMPLE_LOG
+
+#define SL_HDR_LEN      2
+#define SL_SEQ          0
+#define SL_CHECK        1
+#define SL_SEQ_WRAP     255     // sequence numbers run 0-254
+#define SL_NONE         0xFF
+
+#define SL_TAG_RUN      0x80
+#define SL_TAG_ABS      0xC0
+#define SL_TAG_VAR      0xC8
+#define SL_TAG_END      0xFF
+
+#define sl_addr(block, off) \
+    (SAMPLELOG_BASE + (block) * SAMPLELOG_BLOCK_SIZE + (off))
+
+#if SAMPLELOG_BLOCKS > 16
+#error "samplelog_valid holds one bit per block"
+#endif
+
+uint8_t samplelog_dropped;      // samples lost while the hold buffer was full
+
+static uint8_t sl_buf[SAMPLELOG_BLOCK_SIZE];    // block being assembled
+static uint8_t sl_len;              // bytes used in sl_buf
+static uint8_t sl_cur;              // ring index of sl_buf
+static uint8_t sl_seq;              // sequence number of sl_buf
+static uint8_t sl_seen;             // bit per sensor with a sample in sl_buf
+static uint8_t sl_run;              // offset of a repeat record ending sl_buf
+static temp_t sl_prev[MAX_TEMP_SENSORS];
+static uint16_t sl_valid;           // bit per block holding written samples
+static uint16_t sl_total;           // samples held
+static uint8_t sl_flush;            // bytes of sl_buf written, SL_NONE if idle
+static uint8_t sl_hold_id[SAMPLELOG_HOLD];
+static temp_t sl_hold_t[SAMPLELOG_HOLD];
+static uint8_t sl_held;
+
+static void sl_open(void);
+static uint8_t sl_encode(uint8_t id, temp_t t);
+static uint8_t sl_read(uint8_t block, uint8_t off);
+static uint8_t sl_block_ok(uint8_t block);
+
+/*
+ * Byte of a block: the RAM copy for the current block, EEPROM otherwise.
+ * The EEPROM must not be busy writing.
+ */
+static uint8_t sl_read(uint8_t block, uint8_t off)
+{
+    if (block == sl_cur)
+        return sl_buf[off];
+    return ee_read(sl_addr(block, off));
+}
+
+/*
+ * TRUE if a block in EEPROM carries a sequence number and a good check.
+ */
+static uint8_t sl_block_ok(uint8_t block)
+{
+    uint8_t lcv, sum;
+
+    sum = sl_read(block, SL_SEQ);
+    if (sum == SL_NONE)
+        return FALSE;
+    for (lcv = SL_HDR_LEN; lcv < SAMPLELOG_BLOCK_SIZE; lcv++)
+        sum += sl_read(block, lcv);
+    sum = ~sum;
+    return sum == sl_read(block, SL_CHECK);
+}
+
+/*****************************************************************************
+ * Subroutine: samplelog_init
+ *
+ * Description:
+ * This subroutine recovers the log at startup. It checks every block,
+ * takes the valid block with the highest sequence number as the newest and
+ * starts assembling the next block after it. The sequence numbers of the
+ * ring span at most SAMPLELOG_BLOCKS, so "highest" is measured as a signed
+ * distance from the first valid block found.
+ *
+ * Input Parameters:
+ * None
+ *
+ * Output Parameters:
+ * None
+ *
+ * Subroutines:
+ * sl_block_ok
+ * samplelog_rewind
+ * samplelog_next
+ *****************************************************************************/
+void samplelog_init(void)
+{
+    samplelog_iter_t it;
+    uint8_t block, seq, base, newest;
+    int8_t dist, best;
+    uint8_t id;
+    temp_t t;
+
+    sl_cur = SL_NONE;
+    sl_flush = SL_NONE;
+    sl_valid = 0;
+    newest = SL_NONE;
+    best = 0;
+    base = 0;
+
+    for (block = 0; block < SAMPLELOG_BLOCKS; block++)
+    {
+        if (!sl_block_ok(block))
+            continue;
+        sl_valid |= 1 << block;
+
+        seq = sl_read(block, SL_SEQ);
+        if (newest == SL_NONE)
+            base = seq;
+        dist = (int8_t) (seq >= base ? seq - base : seq + SL_SEQ_WRAP - base);
+        if (newest == SL_NONE || dist > best)
+        {
+            best = dist;
+            newest = block;
+        }
+    }
+
+    // the newest block becomes the current one, with a RAM copy to decode
+    if (newest == SL_NONE)
+    {
+        sl_cur = SAMPLELOG_BLOCKS - 1;
+        sl_seq = SL_SEQ_WRAP - 1;
+        sl_len = SL_HDR_LEN;
+    }
+    else
+    {
+        for (block = 0; block < SAMPLELOG_BLOCK_SIZE; block++)
+            sl_buf[block] = sl_read(newest, block);
+        sl_cur = newest;
+        sl_seq = sl_buf[SL_SEQ];
+        sl_len = SAMPLELOG_BLOCK_SIZE;
+    }
+
+    sl_total = 0;
+    samplelog_rewind(&it, 0);
+    while (samplelog_next(&it, &id, &t))
+        ++sl_total;
+
+    sl_held = 0;
+    sl_open();
+}
+
+/*
+ * Move to the next ring block and empty sl_buf for it. The samples of the
+ * oldest block are dropped from the count before it is reused. The EEPROM
+ * must not be busy writing.
+ */
+static void sl_open(void)
+{
+    samplelog_iter_t it;
+    uint8_t lcv, id;
+    temp_t t;
+
+    sl_cur = sl_cur + 1 == SAMPLELOG_BLOCKS ? 0 : sl_cur + 1;
+    sl_seq = sl_seq + 1 == SL_SEQ_WRAP ? 0 : sl_seq + 1;
+
+    if (sl_valid & (1 << sl_cur))
+    {
+        it.block = sl_cur;
+        it.blocks = 0;
+        it.off = SL_HDR_LEN;
+        it.run = 0;
+        lcv = sl_cur;
+        sl_cur = SL_NONE;           // make sl_read go to EEPROM
+        while (samplelog_next(&it, &id, &t))
+            --sl_total;
+        sl_cur = lcv;
+        sl_valid &= ~(1 << sl_cur);
+    }
+
+    for (lcv = 0; lcv < SAMPLELOG_BLOCK_SIZE; lcv++)
+        sl_buf[lcv] = SL_TAG_END;
+    sl_len = SL_HDR_LEN;
+    sl_seen = 0;
+    sl_run = SL_NONE;
+}
+
+/*
+ * Append one sample to sl_buf. Returns FALSE if the record does not fit.
+ */
+static uint8_t sl_encode(uint8_t id, temp_t t)
+{
+    uint8_t rec[4];
+    uint8_t n, lcv;
+    int16_t d;
+    uint16_t z;
+
+    d = t - sl_prev[id];
+    if (!(sl_seen & (1 << id)))
+    {
+        rec[0] = SL_TAG_ABS | id;
+        rec[1] = (uint16_t) t >> 8;
+        rec[2] = t & 0xFF;
+        n = 3;
+    }
+    else if (d == 0)
+    {
+        // grow the repeat record if it is the last one for this sensor
+        if (sl_run == sl_len - 1 && ((sl_buf[sl_run] >> 3) & 0x07) == id
+                && (sl_buf[sl_run] & 0x07) < 7)
+        {
+            ++sl_buf[sl_run];
+            ++sl_total;
+            return TRUE;
+        }
+        rec[0] = SL_TAG_RUN | (id << 3);
+        n = 1;
+    }
+    else if (d >= -8 && d <= 7)
+    {
+        rec[0] = (id << 4) | (d & 0x0F);
+        n = 1;
+    }
+    else
+    {
+        rec[0] = SL_TAG_VAR | id;
+        z = ((uint16_t) d << 1) ^ (uint16_t) (d >> 15);
+        for (n = 1; z >= 0x80; n++)
+        {
+            rec[n] = (z & 0x7F) | 0x80;
+            z >>= 7;
+        }
+        rec[n++] = z;
+    }
+
+    if (sl_len + n > SAMPLELOG_BLOCK_SIZE)
+        return FALSE;
+
+    sl_run = (rec[0] & 0xC0) == SL_TAG_RUN ? sl_len : SL_NONE;
+    for (lcv = 0; lcv < n; lcv++)
+        sl_buf[sl_len++] = rec[lcv];
+    sl_seen |= 1 << id;
+    sl_prev[id] = t;
+    ++sl_total;
+    return TRUE;
+}
+
+/*****************************************************************************
+ * Subroutine: samplelog_sink
+ *
+ * Description:
+ * This subroutine is a publication sink that appends a sample to the
+ * block in RAM. A full block is handed to samplelog_task, on its one-shot
+ * timer, to be written.
+ * While a block is being written samples wait in a small hold buffer;
+ * samples that find it full are counted in samplelog_dropped.
+ *
+ * Input Parameters:
+ * Sensor index
+ * Reading
+ *
+ * Output Parameters:
+ * None
+ *
+ * Subroutines:
+ * sl_encode
+ *****************************************************************************/
+void samplelog_sink(uint8_t id, temp_t t)
+{
+    if (sl_flush == SL_NONE && sl_encode(id, t))
+        return;
+
+    // block full: write it out and keep the sample for the next one
+    if (sl_flush == SL_NONE)
+    {
+        sl_flush = 0;
+        sched_oneshot(SAMPLELOG_TIMER, SAMPLELOG_PERIOD_MS, samplelog_task);
+    }
+    if (sl_held < SAMPLELOG_HOLD)
+    {
+        sl_hold_id[sl_held] = id;
+        sl_hold_t[sl_held] = t;
+        ++sl_held;
+    }
+    else if (samplelog_dropped < 0xFF)
+        ++samplelog_dropped;
+}
+
+/*****************************************************************************
+ * Subroutine: samplelog_task
+ *
+ * Description:
+ * This subroutine is the EEPROM writer. It runs from a one-shot timer that
+ * it re-arms until the block is done, so it costs nothing between blocks.
+ * Each run starts at most one byte write and returns while the EEPROM is
+ * busy.
+ * Bytes already holding the right value are skipped. The check and the
+ * sequence number go last, so a block cut short by a reset fails its
+ * check. Once the block is written the next one is opened and held
+ * samples are encoded into it.
+ *
+ * Input Parameters:
+ * None
+ *
+ * Output Parameters:
+ * None
+ *
+ * Subroutines:
+ * ee_write
+ * sl_open
+ * sl_encode
+ * sched_oneshot
+ *****************************************************************************/
+void samplelog_task(void)
+{
+    uint8_t off, sum, lcv;
+
+    if (sl_flush == SL_NONE)
+        return;
+    if (ee_busy())
+    {
+        sched_oneshot(SAMPLELOG_TIMER, SAMPLELOG_PERIOD_MS, samplelog_task);
+        return;
+    }
+
+    if (sl_flush == 0)
+    {
+        sl_buf[SL_SEQ] = sl_seq;
+        sum = sl_seq;
+        for (lcv = SL_HDR_LEN; lcv < SAMPLELOG_BLOCK_SIZE; lcv++)
+            sum += sl_buf[lcv];
+        sl_buf[SL_CHECK] = ~sum;
+    }
+
+    // body first, then CHECK, then SEQ
+    while (sl_flush < SAMPLELOG_BLOCK_SIZE)
+    {
+        off = sl_flush < SAMPLELOG_BLOCK_SIZE - SL_HDR_LEN ? sl_flush + SL_HDR_LEN
+                : SAMPLELOG_BLOCK_SIZE - 1 - sl_flush;
+        ++sl_flush;
+        if (ee_read(sl_addr(sl_cur, off)) != sl_buf[off])
+        {
+            ee_write(sl_addr(sl_cur, off), sl_buf[off]);
+            sched_oneshot(SAMPLELOG_TIMER, SAMPLELOG_PERIOD_MS, samplelog_task);
+            return;
+        }
+    }
+
+    sl_valid |= 1 << sl_cur;
+    sl_flush = SL_NONE;
+    sl_open();
+    for (lcv = 0; lcv < sl_held; lcv++)
+        sl_encode(sl_hold_id[lcv], sl_hold_t[lcv]);
+    sl_held = 0;
+}
+
+uint8_t samplelog_busy(void)
+{
+    return sl_flush != SL_NONE || ee_busy();
+}
+
+uint16_t samplelog_count(void)
+{
+    return sl_total;
+}
+
+/*****************************************************************************
+ * Subroutine: samplelog_rewind
+ *
+ * Description:
+ * This subroutine positions an iterator at the oldest held sample and
+ * skips forward. Reading EEPROM blocks requires samplelog_busy() to be
+ * FALSE.
+ *
+ * Input Parameters:
+ * Iterator
+ * Samples to skip
+ *
+ * Output Parameters:
+ * None
+ *
+ * Subroutines:
+ * samplelog_next
+ *****************************************************************************/
+void samplelog_rewind(samplelog_iter_t *it, uint16_t skip)
+{
+    uint8_t id;
+    temp_t t;
+
+    it->block = sl_cur;
+    it->blocks = SAMPLELOG_BLOCKS;
+    it->off = SAMPLELOG_BLOCK_SIZE;
+    it->run = 0;
+    while (skip-- && samplelog_next(it, &id, &t))
+        continue;
+}
+
+/*****************************************************************************
+ * Subroutine: samplelog_next
+ *
+ * Description:
+ * This subroutine decodes the next sample. Blocks are visited from the one
+ * after the current block around to the current block, skipping blocks
+ * that were never written or failed their check. Unknown records end a
+ * block.
+ *
+ * Input Parameters:
+ * Iterator
+ * Sensor index destination
+ * Reading destination
+ *
+ * Output Parameters:
+ * TRUE if a sample was read, FALSE past the newest sample
+ *
+ * Subroutines:
+ * sl_read
+ *****************************************************************************/
+uint8_t samplelog_next(samplelog_iter_t *it, uint8_t *id, temp_t *t)
+{
+    uint8_t tag, b, shift, len;
+    uint16_t z;
+
+    for (;;)
+    {
+        if (it->run)
+        {
+            --it->run;
+            *id = it->run_id;
+            *t = it->prev[*id];
+            return TRUE;
+        }
+
+        len = it->block == sl_cur ? sl_len : SAMPLELOG_BLOCK_SIZE;
+        if (it->off >= len)
+        {
+            // on to the next block that holds samples
+            do
+            {
+                if (!it->blocks)
+                    return FALSE;
+                --it->blocks;
+                it->block = it->block + 1 == SAMPLELOG_BLOCKS ? 0 : it->block + 1;
+            } while (it->block != sl_cur && !(sl_valid & (1 << it->block)));
+            it->off = SL_HDR_LEN;
+            continue;
+        }
+
+        tag = sl_read(it->block, it->off++);
+        *id = (tag >> ((tag & 0x80) ? ((tag & 0x40) ? 0 : 3) : 4)) & 0x07;
+        if (*id >= MAX_TEMP_SENSORS || tag == SL_TAG_END)
+        {
+            it->off = SAMPLELOG_BLOCK_SIZE;
+            continue;
+        }
+
+        if (!(tag & 0x80))
+        {
+            // sign extend the 4-bit delta
+            it->prev[*id] += (int8_t) (tag << 4) >> 4;
+        }
+        else if ((tag & 0xC0) == SL_TAG_RUN)
+        {
+            it->run_id = *id;
+            it->run = tag & 0x07;
+        }
+        else if ((tag & 0xF8) == SL_TAG_ABS && it->off + 2 <= len)
+        {
+            z = sl_read(it->block, it->off++) << 8;
+            it->prev[*id] = z | sl_read(it->block, it->off++);
+        }
+        else if ((tag & 0xF8) == SL_TAG_VAR)
+        {
+            z = 0;
+            b = 0x80;
+            for (shift = 0; (b & 0x80) && shift <= 14 && it->off < len; shift += 7)
+            {
+                b = sl_read(it->block, it->off++);
+                z |= (uint16_t) (b & 0x7F) << shift;
+            }
+            if (b & 0x80)
+            {
+                // cut short, drop the rest of the block
+                it->off = SAMPLELOG_BLOCK_SIZE;
+                continue;
+            }
+            it->prev[*id] += (int16_t) ((z >> 1) ^ (0 - (z & 1)));
+        }
+        else
+        {
+            it->off = SAMPLELOG_BLOCK_SIZE;
+            continue;
+        }
+
+        *t = it->prev[*id];
+        return TRUE;
+    }
+}
+
+#endif
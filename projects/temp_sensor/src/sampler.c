@@ -0,0 +1,444 @@
+/*
+ * File:   sampler.c
+ * Author: Kevin Macksamie
+ *
+ * Sensor sampling as scheduler work. Each sensor's conversion is started,
+ * a one-shot timer waits out the conversion time and the scratchpad is
+ * read back, so the CPU is free while the sensor converts.
+ *
+ * Up to SAMPLER_CONCURRENT sensors convert at once. Each one sits in a
+ * slot until its conversion time has passed; when it is read the slot
+ * starts the next sensor of the pass straight away. A pass over N sensors
+ * therefore takes about N / SAMPLER_CONCURRENT conversion times.
+ *
+ * How a conversion is waited out depends on the sensor's power mode:
+ *  - externally powered, and still the last sensor addressed on the bus:
+ *    its read slot is polled every SAMPLER_POLL_MS, which ends the wait as
+ *    soon as the sensor is done rather than at the worst case time.
+ *  - externally powered, but the bus has been used since: full wait.
+ *  - parasite powered: full wait with the strong pullup on. The pullup
+ *    holds the bus, so such a sensor only starts once every other slot is
+ *    read and nothing else starts until it is read.
+ *
+ * A read that fails its CRC is repeated up to SAMPLER_RETRIES times. A
+ * sensor that fails SAMPLER_QUARANTINE reads in a row is quarantined: it
+ * sits out whole passes, twice as many after every failed probe, so a
+ * dead or flaky sensor costs the bus almost nothing.
+ *
+ * A sensor that lost power reads 85 degC, the power-on value, until it
+ * converts again. That value is only taken as a reading once the sensor
+ * has been read since startup or the last scan, and then only within
+ * SAMPLER_POR_STEP of its last reading if it has one. A sensor really at
+ * 85 degC is thus read normally from its second read on, while one that
+ * resets in use keeps failing.
+ *
+ * A pass goes over the registry ids in use. A registered sensor that is
+ * missing fails its reads and ends up quarantined until it is back or
+ * forgotten.
+ *
+ * With bus segments, ids keep their registry slot rather than segment
+ * order, so a pass may switch segments more than once per segment. An
+ * externally powered sensor keeps converting while its segment is
+ * switched away; a parasite powered one holds the bus, and with it its
+ * segment, until it is read.
+ */
+#include "sampler.h"
+#include "sched.h"
+#include "log.h"
+
+sampler_health_t sampler_health[MAX_TEMP_SENSORS];
+
+static temp_sensors_t *sampler_sensors;
+#ifdef SAMPLE_FILTER
+static filter_t *sampler_filters;
+#endif
+static publish_t *sampler_pub;
+static uint8_t sampler_slot[SAMPLER_CONCURRENT];     // sensor converting in each slot
+static uint16_t sampler_due[SAMPLER_CONCURRENT];     // tick its conversion is done
+static uint8_t sampler_next;    // next sensor of the pass to start
+static uint8_t sampler_active;  // slots in use
+static uint8_t sampler_busy;    // TRUE while a pass is in progress
+static uint8_t sampler_res;     // resolution in bits
+static uint16_t sampler_conv;   // conversion time at that resolution
+static uint8_t sampler_last;    // slot of the last sensor addressed, if pollable
+static uint8_t sampler_spu;     // TRUE while a parasite conversion holds the bus
+static uint8_t sampler_seen;    // bit per sensor, set once read since a scan
+
+static void sampler_fill(void);
+static void sampler_read(void);
+static uint8_t sampler_check(uint8_t id, uint8_t status);
+static uint8_t sampler_real_por(uint8_t id);
+
+#define SAMPLER_FREE    0xFF
+
+/* Count a failure in a sensor's health, see sampler_health_t */
+#ifdef SER_COMMANDS
+#define sampler_count(h, counter)   (++(h)->counter)
+#else
+#define sampler_count(h, counter)
+#endif
+
+/* Address of a sensor; an empty registry addresses a lone sensor with skip ROM */
+#define sampler_rom(id) \
+    (sampler_sensors->count ? (id) : DS18B20_SKIP_ROM)
+
+/* Ids in a pass; a lone sensor found by neither search is still read */
+#define sampler_num() \
+    (sampler_sensors->count ? sampler_sensors->count : 1)
+
+/* TRUE if an id below sampler_num() is in use */
+#define sampler_used(id) \
+    (sampler_sensors->count ? (sampler_sensors->used >> (id)) & 1 : 1)
+
+/* Bus segment of a sensor; connect it before addressing the sensor */
+#ifdef OWIRE_SEGMENTS
+#define sampler_segment(id) \
+    (sampler_sensors->count ? sampler_sensors->segment[id] : 0)
+#define sampler_select(id)  owire_segment(sampler_segment(id))
+#else
+#define sampler_segment(id) 0
+#define sampler_select(id)
+#endif
+
+/* TRUE if a sensor needs the strong pullup while converting */
+#define sampler_parasite(id) \
+    ((sampler_sensors->parasite >> (id)) & 1)
+
+/*****************************************************************************
+ * Subroutine: sampler_init
+ *
+ * Description:
+ * This subroutine binds the sampler to its inputs and outputs.
+ *
+ * Input Parameters:
+ * Sensor table reference
+ * Filter table reference, one filter per sensor, NULL without SAMPLE_FILTER
+ * Publication stage reference
+ *
+ * Output Parameters:
+ * None
+ *
+ * Subroutines:
+ * None
+ *****************************************************************************/
+void sampler_init(temp_sensors_t *sensors, filter_t *filters, publish_t *pub)
+{
+    sampler_sensors = sensors;
+#ifdef SAMPLE_FILTER
+    sampler_filters = filters;
+#else
+    (void) filters;
+#endif
+    sampler_pub = pub;
+    sampler_busy = FALSE;
+    sampler_res = DS18B20_RES_DEFAULT;
+    sampler_conv = DS18B20_CONVERT_MS_RES(DS18B20_RES_DEFAULT);
+    sampler_clear_health();
+}
+
+/*****************************************************************************
+ * Subroutine: sampler_task
+ *
+ * Description:
+ * This subroutine is the periodic sampling task. It starts a new pass over
+ * the sensor table unless the previous pass is still converting, filling
+ * every slot the power modes allow.
+ *
+ * Input Parameters:
+ * None
+ *
+ * Output Parameters:
+ * None
+ *
+ * Subroutines:
+ * sampler_fill
+ * sched_oneshot
+ *****************************************************************************/
+void sampler_task(void)
+{
+    uint8_t slot;
+
+    if (sampler_busy)
+        return;
+    sampler_busy = TRUE;
+    sampler_next = 0;
+    sampler_active = 0;
+    sampler_spu = FALSE;
+    for (slot = 0; slot < SAMPLER_CONCURRENT; slot++)
+        sampler_slot[slot] = SAMPLER_FREE;
+    sampler_fill();
+    sched_oneshot(SAMPLER_TIMER,
+                  sampler_last == SAMPLER_FREE ? sampler_conv : SAMPLER_POLL_MS,
+                  sampler_read);
+}
+
+uint8_t sampler_idle(void)
+{
+    return !sampler_busy;
+}
+
+/*****************************************************************************
+ * Subroutine: sampler_set_resolution
+ *
+ * Description:
+ * This subroutine writes a new resolution to every sensor, one at a time
+ * by its own ROM, and copies it to the sensor's EEPROM so it survives a
+ * power cycle. The write covers the alarm thresholds too, so each sensor
+ * is read first and gets its own back. A sensor that cannot be read is
+ * left alone. The conversion wait follows the new resolution, unless a
+ * sensor left alone may still convert for longer. It must not be called
+ * during a pass.
+ *
+ * Input Parameters:
+ * Resolution in bits, DS18B20_RES_MIN to DS18B20_RES_MAX
+ *
+ * Output Parameters:
+ * Bit per sensor id that was left alone, 0 if all took the resolution
+ *
+ * Subroutines:
+ * ds18b20_read_scratchpad
+ * ds18b20_set_resolution
+ * ds18b20_copy_scratchpad
+ *****************************************************************************/
+uint8_t sampler_set_resolution(uint8_t res)
+{
+    uint8_t id, status, failed = 0;
+    uint8_t pad[DS18B20_SCRATCHPAD_LEN];
+
+    for (id = 0; id < sampler_num(); id++)
+    {
+        if (!sampler_used(id))
+            continue;
+        sampler_select(id);
+        // a power-on read still has a good CRC, so its thresholds are real
+        status = ds18b20_read_scratchpad(sampler_rom(id), pad);
+        if (status != DS18B20_OK && status != DS18B20_E_POR)
+        {
+            LOG2(SAMPLER, LOG_WARN, "sensor %u resolution not set, status %u", id, status);
+            failed |= 1 << id;
+            continue;
+        }
+        ds18b20_set_resolution(sampler_rom(id), pad, res);
+        ds18b20_copy_scratchpad(sampler_rom(id), sampler_parasite(id));
+    }
+    if (!failed || res > sampler_res)
+        sampler_conv = DS18B20_CONVERT_MS_RES(res);
+    sampler_res = res;
+    return failed;
+}
+
+uint8_t sampler_resolution(void)
+{
+    return sampler_res;
+}
+
+void sampler_clear_health(void)
+{
+    uint8_t *p = (uint8_t *) sampler_health;
+    uint8_t n;
+
+    for (n = 0; n < sizeof(sampler_health); n++)
+        *p++ = 0;
+    sampler_seen = 0;
+}
+
+uint8_t sampler_quarantined(void)
+{
+    uint8_t id, n = 0;
+
+    for (id = 0; id < MAX_TEMP_SENSORS; id++)
+    {
+        if (sampler_health[id].backoff)
+            ++n;
+    }
+    return n;
+}
+
+/*
+ * Start sensors of the pass in free slots, passing over unused ids and
+ * quarantined sensors.
+ * A parasite powered sensor waits for an empty bus and then has it to
+ * itself.
+ */
+static void sampler_fill(void)
+{
+    uint8_t slot, id;
+
+    sampler_last = SAMPLER_FREE;
+    for (slot = 0; slot < SAMPLER_CONCURRENT; slot++)
+    {
+        if (sampler_slot[slot] != SAMPLER_FREE)
+            continue;
+        if (sampler_spu)
+            return;
+        for (; sampler_next < sampler_num(); ++sampler_next)
+        {
+            if (!sampler_used(sampler_next))
+                continue;
+            if (!sampler_health[sampler_next].skip)
+                break;
+            --sampler_health[sampler_next].skip;
+        }
+        id = sampler_next;
+        if (id >= sampler_num())
+            return;
+        if (sampler_parasite(id) && sampler_active)
+            return;
+
+        ++sampler_next;
+        sampler_select(id);
+        ds18b20_start_convert(sampler_rom(id), sampler_parasite(id));
+        sampler_slot[slot] = id;
+        sampler_due[slot] = sched_now() + sampler_conv;
+        ++sampler_active;
+        if (sampler_parasite(id))
+            sampler_spu = TRUE;
+        else
+            sampler_last = slot;
+    }
+}
+
+/*
+ * One-shot timer handler: read, filter and publish every sensor whose
+ * conversion is done, refill the free slots, and wait for the next slot
+ * due or the next poll.
+ */
+static void sampler_read(void)
+{
+    uint8_t slot, id, status, tries;
+    uint8_t pad[DS18B20_SCRATCHPAD_LEN];
+    uint16_t now, wait;
+    temp_t t;
+
+    // an early finish counts as due now
+    if (sampler_last != SAMPLER_FREE && !ds18b20_busy())
+        sampler_due[sampler_last] = sched_now();
+
+    for (slot = 0; slot < SAMPLER_CONCURRENT; slot++)
+    {
+        id = sampler_slot[slot];
+        if (id == SAMPLER_FREE)
+            continue;
+        if ((int16_t) (sched_now() - sampler_due[slot]) < 0)
+            continue;
+
+        // the reset pulse ends any strong pullup
+        sampler_select(id);
+        status = ds18b20_read_scratchpad(sampler_rom(id), pad);
+        for (tries = 0; status == DS18B20_E_CRC && tries < SAMPLER_RETRIES; tries++)
+        {
+            sampler_count(&sampler_health[id], crc);
+            sampler_count(&sampler_health[id], retries);
+            status = ds18b20_read_scratchpad(sampler_rom(id), pad);
+        }
+        sampler_spu = FALSE;
+        sampler_last = SAMPLER_FREE;
+        if (status == DS18B20_E_POR && sampler_real_por(id))
+            status = DS18B20_OK;
+        if (status == DS18B20_OK || status == DS18B20_E_POR)
+            sampler_seen |= 1 << id;
+        if (sampler_check(id, status))
+        {
+            // below 12 bits the low raw bits are undefined
+            t = temp_from_raw(pad[DS18B20_PAD_TEMP_HI], pad[DS18B20_PAD_TEMP_LO]) &
+                DS18B20_RES_MASK(sampler_res);
+#ifdef SAMPLE_FILTER
+            t = filter_update(&sampler_filters[id], t);
+#endif
+            publish_offer(sampler_pub, id, t);
+        }
+
+        sampler_slot[slot] = SAMPLER_FREE;
+        --sampler_active;
+    }
+
+    if (sampler_last == SAMPLER_FREE)
+        sampler_fill();
+    if (!sampler_active)
+    {
+        sampler_busy = FALSE;
+        return;
+    }
+
+    wait = sampler_last == SAMPLER_FREE ? 0xFFFF : SAMPLER_POLL_MS;
+    now = sched_now();
+    for (slot = 0; slot < SAMPLER_CONCURRENT; slot++)
+    {
+        if (sampler_slot[slot] == SAMPLER_FREE)
+            continue;
+        if ((int16_t) (sampler_due[slot] - now) <= 0)
+            wait = 0;
+        else if (sampler_due[slot] - now < wait)
+            wait = sampler_due[slot] - now;
+    }
+    sched_oneshot(SAMPLER_TIMER, wait, sampler_read);
+}
+
+/*
+ * Count a read's outcome in the sensor's health; TRUE if it is good. A
+ * failure may quarantine the sensor or lengthen its quarantine.
+ */
+static uint8_t sampler_check(uint8_t id, uint8_t status)
+{
+    sampler_health_t *h = &sampler_health[id];
+
+    switch (status)
+    {
+    case DS18B20_OK:
+        if (h->backoff)
+            LOG1(SAMPLER, LOG_INFO, "sensor %u back from quarantine", id);
+        h->fails = 0;
+        h->backoff = 0;
+        return TRUE;
+    case DS18B20_E_PRESENCE:
+        sampler_count(h, presence);
+        break;
+    case DS18B20_E_CRC:
+        sampler_count(h, crc);
+        break;
+    case DS18B20_E_POR:
+        sampler_count(h, por);
+        break;
+    }
+
+    if (h->fails < 0xFF)
+        ++h->fails;
+    if (h->backoff)
+    {
+        if (h->backoff < SAMPLER_BACKOFF_MAX)
+            h->backoff <<= 1;
+    }
+    else if (h->fails >= SAMPLER_QUARANTINE)
+    {
+        LOG2(SAMPLER, LOG_WARN, "sensor %u quarantined, status %u", id, status);
+        h->backoff = 1;
+    }
+    h->skip = h->backoff;
+    return FALSE;
+}
+
+/*
+ * TRUE if a power-on value read from a sensor is taken as a real 85 degC:
+ * the sensor was read before, and its last reading, if any, is close to
+ * 85 degC. The last reading is the filter's last input, or without
+ * SAMPLE_FILTER the last one published.
+ */
+static uint8_t sampler_real_por(uint8_t id)
+{
+    temp_t last;
+    int16_t d;
+
+    if (!((sampler_seen >> id) & 1))
+        return FALSE;
+#ifdef SAMPLE_FILTER
+    if (!sampler_filters[id].count)
+        return TRUE;
+    last = sampler_filters[id].hist[0];
+#else
+    if (!((sampler_pub->valid >> id) & 1))
+        return TRUE;
+    last = sampler_pub->last[id];
+#endif
+    d = last - (DS18B20_POR_RAW & DS18B20_RES_MASK(sampler_res));
+    return d <= SAMPLER_POR_STEP && d >= -SAMPLER_POR_STEP;
+}
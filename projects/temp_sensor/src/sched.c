@@ -0,0 +1,366 @@
+/*
+ * File:   sched.c
+ * Author: Kevin Macksamie
+ *
+ * Cooperative run-to-completion scheduler driven by the Timer1 tick.
+ */
+#include <xc.h>
+#include "defer.h"
+#include "sched.h"
+
+/*
+ * One-shot timer
+ */
+typedef struct sched_timer
+{
+    sched_fn_t fn;          // handler, NULL when idle
+    uint16_t due;           // tick to fire at
+} sched_timer_t;
+
+volatile uint16_t sched_ticks;
+sched_task_t sched_tasks[SCHED_MAX_TASKS];
+uint8_t sched_num_tasks;
+static sched_timer_t sched_timers[SCHED_MAX_TIMERS];
+static sched_fn_t sched_idle;
+
+/* TRUE once tick t has been reached */
+#define sched_reached(now, t) ((int16_t) ((now) - (t)) >= 0)
+
+/*****************************************************************************
+ * Subroutine: sched_init
+ *
+ * Description:
+ * This subroutine empties the task and timer tables. Timer1 must be set up
+ * separately with timer_init().
+ *
+ * Input Parameters:
+ * None
+ *
+ * Output Parameters:
+ * None
+ *
+ * Subroutines:
+ * None
+ *****************************************************************************/
+void sched_init(void)
+{
+    uint8_t lcv;
+    sched_num_tasks = 0;
+    sched_idle = NULL;
+    for (lcv = 0; lcv < SCHED_MAX_TIMERS; lcv++)
+        sched_timers[lcv].fn = NULL;
+}
+
+/*****************************************************************************
+ * Subroutine: sched_add
+ *
+ * Description:
+ * This subroutine adds a periodic task. Its first release is one period
+ * from now.
+ *
+ * Input Parameters:
+ * Task body
+ * Period in ticks
+ * Deadline in ticks
+ *
+ * Output Parameters:
+ * Task index, 0xFF if the table is full
+ *
+ * Subroutines:
+ * sched_now
+ *****************************************************************************/
+uint8_t sched_add(sched_fn_t fn, uint16_t period, uint16_t deadline)
+{
+    sched_task_t *task;
+
+    if (sched_num_tasks >= SCHED_MAX_TASKS)
+        return 0xFF;
+
+    task = &sched_tasks[sched_num_tasks];
+    task->fn = fn;
+    task->period = period;
+    task->deadline = deadline;
+    task->due = sched_now() + period;
+    task->worst = 0;
+    task->late = 0;
+    return sched_num_tasks++;
+}
+
+/*****************************************************************************
+ * Subroutine: sched_set_period
+ *
+ * Description:
+ * This subroutine changes the period of a task. The pending release keeps
+ * its old due time, later releases use the new period.
+ *
+ * Input Parameters:
+ * Task index returned by sched_add
+ * Period in ticks
+ *
+ * Output Parameters:
+ * None
+ *
+ * Subroutines:
+ * None
+ *****************************************************************************/
+void sched_set_period(uint8_t idx, uint16_t period)
+{
+    if (idx < sched_num_tasks)
+        sched_tasks[idx].period = period;
+}
+
+/*****************************************************************************
+ * Subroutine: sched_oneshot
+ *
+ * Description:
+ * This subroutine arms a one-shot timer, replacing whatever it was armed
+ * with before.
+ *
+ * Input Parameters:
+ * Timer number
+ * Delay in ticks
+ * Handler
+ *
+ * Output Parameters:
+ * None
+ *
+ * Subroutines:
+ * sched_now
+ *****************************************************************************/
+void sched_oneshot(uint8_t timer, uint16_t delay, sched_fn_t fn)
+{
+    sched_timers[timer].due = sched_now() + delay;
+    sched_timers[timer].fn = fn;
+}
+
+/*****************************************************************************
+ * Subroutine: sched_cancel
+ *
+ * Description:
+ * This subroutine disarms a one-shot timer.
+ *
+ * Input Parameters:
+ * Timer number
+ *
+ * Output Parameters:
+ * None
+ *
+ * Subroutines:
+ * None
+ *****************************************************************************/
+void sched_cancel(uint8_t timer)
+{
+    sched_timers[timer].fn = NULL;
+}
+
+/*****************************************************************************
+ * Subroutine: sched_now
+ *
+ * Description:
+ * This subroutine returns the tick count. The 16-bit counter is updated by
+ * the ISR, so it is copied with interrupts disabled. The interrupt enable
+ * is restored rather than set, so it may be called with interrupts off.
+ *
+ * Input Parameters:
+ * None
+ *
+ * Output Parameters:
+ * Ticks since startup
+ *
+ * Subroutines:
+ * None
+ *****************************************************************************/
+uint16_t sched_now(void)
+{
+    uint16_t now;
+    uint8_t gie = GIE;
+    GIE = 0;
+    now = sched_ticks;
+    GIE = gie;
+    return now;
+}
+
+/*****************************************************************************
+ * Subroutine: sched_poll
+ *
+ * Description:
+ * This subroutine runs every expired one-shot timer and every released
+ * task once, recording the run time and deadline misses of each task.
+ *
+ * Input Parameters:
+ * None
+ *
+ * Output Parameters:
+ * TRUE if anything ran
+ *
+ * Subroutines:
+ * sched_now
+ * timer and task bodies
+ *****************************************************************************/
+uint8_t sched_poll(void)
+{
+    sched_task_t *task;
+    sched_fn_t fn;
+    uint16_t now, start, elapsed;
+    uint8_t lcv;
+    uint8_t ran = FALSE;
+
+    now = sched_now();
+    for (lcv = 0; lcv < SCHED_MAX_TIMERS; lcv++)
+    {
+        fn = sched_timers[lcv].fn;
+        if (fn && sched_reached(now, sched_timers[lcv].due))
+        {
+            sched_timers[lcv].fn = NULL;    // handler may re-arm it
+            fn();
+            ran = TRUE;
+        }
+    }
+
+    for (lcv = 0; lcv < sched_num_tasks; lcv++)
+    {
+        task = &sched_tasks[lcv];
+        start = sched_now();
+        if (!sched_reached(start, task->due))
+            continue;
+
+        if ((uint16_t) (start - task->due) > task->deadline && task->late < 0xFF)
+            ++task->late;
+
+        // release on the period grid so late starts do not accumulate drift
+        task->due += task->period;
+        if (sched_reached(start, task->due))
+            task->due = start + task->period;
+
+        task->fn();
+        ran = TRUE;
+
+        elapsed = sched_now() - start;
+        if (elapsed > 0xFF)
+            elapsed = 0xFF;
+        if (elapsed > task->worst)
+            task->worst = elapsed;
+    }
+
+    return ran;
+}
+
+/*****************************************************************************
+ * Subroutine: sched_idle_ticks
+ *
+ * Description:
+ * This subroutine returns how long the CPU may stay idle: the ticks until
+ * the earliest pending timer or task release.
+ *
+ * Input Parameters:
+ * None
+ *
+ * Output Parameters:
+ * Ticks until something is due, 0 if something already is
+ *
+ * Subroutines:
+ * sched_now
+ *****************************************************************************/
+uint16_t sched_idle_ticks(void)
+{
+    uint16_t now, idle, left;
+    uint8_t lcv;
+
+    now = sched_now();
+    idle = 0xFFFF;
+    for (lcv = 0; lcv < SCHED_MAX_TIMERS; lcv++)
+    {
+        if (!sched_timers[lcv].fn)
+            continue;
+        if (sched_reached(now, sched_timers[lcv].due))
+            return 0;
+        left = sched_timers[lcv].due - now;
+        if (left < idle)
+            idle = left;
+    }
+    for (lcv = 0; lcv < sched_num_tasks; lcv++)
+    {
+        if (sched_reached(now, sched_tasks[lcv].due))
+            return 0;
+        left = sched_tasks[lcv].due - now;
+        if (left < idle)
+            idle = left;
+    }
+    return idle;
+}
+
+/*****************************************************************************
+ * Subroutine: sched_advance
+ *
+ * Description:
+ * This subroutine moves the tick count forward by time Timer1 did not
+ * count. It is meant to credit the WDT period slept through by the idle
+ * function, since Timer1 stops in sleep. The count is updated with
+ * interrupts masked and the interrupt enable is restored rather than set,
+ * so it may be called with interrupts off.
+ *
+ * Input Parameters:
+ * Ticks to add
+ *
+ * Output Parameters:
+ * None
+ *
+ * Subroutines:
+ * None
+ *****************************************************************************/
+void sched_advance(uint16_t ticks)
+{
+    uint8_t gie = GIE;
+    GIE = 0;
+    sched_ticks += ticks;
+    GIE = gie;
+}
+
+/*****************************************************************************
+ * Subroutine: sched_set_idle
+ *
+ * Description:
+ * This subroutine sets the function sched_run() calls when a pass found
+ * nothing to run and no deferred work is queued, e.g. to sleep.
+ *
+ * Input Parameters:
+ * Idle function, NULL for none
+ *
+ * Output Parameters:
+ * None
+ *
+ * Subroutines:
+ * None
+ *****************************************************************************/
+void sched_set_idle(sched_fn_t fn)
+{
+    sched_idle = fn;
+}
+
+/*****************************************************************************
+ * Subroutine: sched_run
+ *
+ * Description:
+ * This subroutine dispatches deferred interrupt work, tasks and timers
+ * forever, calling the idle function when a pass found nothing to run.
+ *
+ * Input Parameters:
+ * None
+ *
+ * Output Parameters:
+ * None
+ *
+ * Subroutines:
+ * defer_dispatch
+ * sched_poll
+ * idle function
+ *****************************************************************************/
+void sched_run(void)
+{
+    while (1)
+    {
+        defer_dispatch();
+        if (!sched_poll() && sched_idle && defer_in == defer_out)
+            sched_idle();
+    }
+}
@@ -0,0 +1,146 @@
+/*
+ * File:   temp.c
+ * Author: Kevin Macksamie
+ */
+#include "target.h"
+#include "temp.h"
+
+/*
+ * Every unit is computed exactly in units of 1e-4 degree:
+ *   C = raw * 625
+ *   F = raw * 1125 + 320000
+ *   K = raw * 625 + 2731500
+ * The 12-bit sensor range (-55..125 degC) keeps this within 24 bits signed.
+ */
+static const uint16_t temp_mul[3] = { 625, 1125, 625 };
+static const int24_t temp_off[3] = { 0, 320000, 2731500 };
+
+/*
+ * Quotient by 10 as a multiply by the reciprocal, exact for any 16-bit
+ * value. Only worth it with a hardware multiplier.
+ */
+#if TARGET_HW_MULTIPLY
+#define temp_div10(x)   ((uint16_t) (((uint32_t) (x) * 52429u) >> 19))
+#endif
+
+/* Divisor from 1e-4 degree down to the requested precision */
+static const uint16_t temp_div[TEMP_PREC_MAX + 1] = { 10000, 1000, 100 };
+
+/*****************************************************************************
+ * Subroutine: temp_from_raw
+ *
+ * Description:
+ * This subroutine joins the scratchpad temperature bytes into a temp_t.
+ *
+ * Input Parameters:
+ * High byte (TEMP_MSB)
+ * Low byte (TEMP_LSB)
+ *
+ * Output Parameters:
+ * Raw temperature
+ *
+ * Subroutines:
+ * None
+ *****************************************************************************/
+temp_t temp_from_raw(uint8_t hi, uint8_t lo)
+{
+    temp_t t;
+    t = (int8_t) hi;    // sign extend the high byte
+    t = (t << 8) | lo;
+    return t;
+}
+
+/*****************************************************************************
+ * Subroutine: temp_convert
+ *
+ * Description:
+ * This subroutine converts a raw temperature to a decimal value in the
+ * requested unit. The conversion is a single multiply-add followed by one
+ * divide, with the sign and rounding folded in by masking instead of
+ * branching.
+ *
+ * Input Parameters:
+ * Raw temperature
+ * Unit (TEMP_UNIT_*)
+ * Decimal places (0..TEMP_PREC_MAX)
+ * Rounding mode (TEMP_ROUND_*)
+ * Reference to result
+ *
+ * Output Parameters:
+ * Decimal temperature
+ *
+ * Subroutines:
+ * None
+ *****************************************************************************/
+void temp_convert(temp_t t, uint8_t unit, uint8_t prec, uint8_t rnd, temp_dec_t *out)
+{
+    int24_t v;
+    int24_t sign;
+    uint24_t mag;
+    uint16_t div;
+
+    v = (int24_t) t * (int24_t) temp_mul[unit] + temp_off[unit];
+
+    // sign is all ones when negative, so (v ^ sign) - sign is |v|
+    sign = -(int24_t) (v < 0);
+    mag = (uint24_t) ((v ^ sign) - sign);
+
+    div = temp_div[prec];
+    mag = (mag + ((div >> 1) & (uint16_t) -(int16_t) rnd)) / div;
+
+    out->mag = (uint16_t) mag;
+    out->neg = (uint8_t) (sign & 1) & (mag != 0);   // no negative zero
+}
+
+/*****************************************************************************
+ * Subroutine: temp_format
+ *
+ * Description:
+ * This subroutine formats a decimal temperature as "+12.34" or "-0.5".
+ * The string buffer must hold at least TEMP_STR_LEN characters.
+ *
+ * Input Parameters:
+ * Reference to decimal temperature
+ * Decimal places the temperature was converted with
+ * String buffer
+ *
+ * Output Parameters:
+ * Length of the string, not counting the null terminator
+ *
+ * Subroutines:
+ * None
+ *****************************************************************************/
+uint8_t temp_format(const temp_dec_t *dec, uint8_t prec, char *str)
+{
+    char digits[5];
+    uint16_t mag;
+#if TARGET_HW_MULTIPLY
+    uint16_t q;
+#endif
+    uint8_t n = 0;
+    uint8_t len = 0;
+
+    // collect digits least significant first, at least one integer digit
+    mag = dec->mag;
+    do
+    {
+#if TARGET_HW_MULTIPLY
+        q = temp_div10(mag);
+        digits[n++] = (char) (mag - (q << 3) - (q << 1)) + '0';
+        mag = q;
+#else
+        digits[n++] = (mag % 10) + '0';
+        mag /= 10;
+#endif
+    } while (mag || n <= prec);
+
+    str[len++] = dec->neg ? '-' : '+';
+    while (n)
+    {
+        if (n == prec)
+            str[len++] = '.';
+        str[len++] = digits[--n];
+    }
+    str[len] = 0;
+    return len;
+}
@@ -0,0 +1,293 @@
+/*
+ * File:   term.c
+ * Author: Kevin Macksamie
+ *
+ * Serial to LCD terminal. Received text is drawn on the LCD as it comes,
+ * with a subset of the VT100 controls:
+ *   CR, LF, BS                 carriage return, line feed, cursor left
+ *   ESC [ row ; col H (or f)   cursor position, 1-based
+ *   ESC [ n A / B / C / D      cursor up / down / right / left
+ *   ESC [ n J                  erase below (0) or the whole screen (2)
+ *   ESC [ n K                  erase to end (0), to start (1), whole line (2)
+ *   ESC c                      reset
+ * Other sequences are consumed and ignored. Text past the end of the last
+ * line, or a line feed on it, scrolls the LCD up a line.
+ *
+ * A character takes the LCD about 50 us and a scroll about 2 ms, against
+ * 87 us per character at 115200 baud. rxfifo takes up the difference and
+ * flow control stops the sender before it overflows, so no character is
+ * lost as long as the sender honours XOFF or RTS. Telemetry is held back
+ * meanwhile, so the only binary bytes on the line are XON and XOFF.
+ *
+ * Built with -DLCD_TERM.
+ */
+#include <xc.h>
+#include "term.h"
+#include "ser.h"
+#include "telem.h"
+
+#ifdef LCD_TERM
+
+#if !defined(SER_FLOW_CONTROL) || !defined(LCD_SCROLL)
+#error "the terminal needs SER_FLOW_CONTROL and LCD_SCROLL"
+#endif
+
+#define TERM_OFF    0   // not running
+#define TERM_START  1   // started, takes over on the next poll
+#define TERM_TEXT   2   // drawing text
+#define TERM_ESC    3   // ESC received
+#define TERM_CSI    4   // ESC [ received, reading parameters
+
+#define TERM_ESC_CHAR   0x1B
+#define TERM_ARG_MAX    99
+
+static LCD_t *term_lcd;
+static uint8_t term_flow;
+static uint8_t term_state;
+static uint8_t term_fresh;      // TRUE until the first byte is drawn
+static uint8_t term_arg[TERM_MAX_ARGS];
+static uint8_t term_nargs;      // ';' seen in the sequence
+
+static void term_putc(uint8_t c);
+static void term_csi(uint8_t c);
+static void term_goto(uint8_t row, uint8_t col);
+static void term_blank(uint8_t row, uint8_t from, uint8_t to);
+static void term_stop(void);
+
+/* Screen size */
+#define term_rows() (term_lcd->geo->lines)
+#define term_cols() (term_lcd->geo->cols)
+
+/* First parameter, 1 when left out */
+#define term_count() (term_arg[0] ? term_arg[0] : 1)
+
+/*****************************************************************************
+ * Subroutine: term_start
+ *
+ * Description:
+ * This subroutine starts terminal mode. It takes over on the next poll, so
+ * the reply to the command that started it still goes out as telemetry.
+ *
+ * Input Parameters:
+ * LCD struct reference
+ * Flow control, SER_FLOW_* bits
+ *
+ * Output Parameters:
+ * None
+ *
+ * Subroutines:
+ * None
+ *****************************************************************************/
+void term_start(LCD_t *lcd, uint8_t flow)
+{
+    term_lcd = lcd;
+    term_flow = flow;
+    term_state = TERM_START;
+}
+
+uint8_t term_active(void)
+{
+    return term_state != TERM_OFF;
+}
+
+/*****************************************************************************
+ * Subroutine: term_poll
+ *
+ * Description:
+ * This subroutine draws everything in rxfifo. Taking bytes out lets
+ * ser_getch() restart a stopped sender once rxfifo is down to its low
+ * watermark. TERM_EXIT ends terminal mode.
+ *
+ * Input Parameters:
+ * None
+ *
+ * Output Parameters:
+ * None
+ *
+ * Subroutines:
+ * ser_set_flow
+ * ser_getch
+ * term_putc
+ *****************************************************************************/
+void term_poll(void)
+{
+    uint8_t c;
+
+    if (term_state == TERM_START)
+    {
+        telem_muted = TRUE;
+        ser_set_flow(term_flow);
+        lcd_clear(term_lcd);
+        term_fresh = TRUE;
+        term_state = TERM_TEXT;
+    }
+
+    while (term_state != TERM_OFF && ser_isrx())
+    {
+        c = ser_getch();
+        // the LF of the CR LF that ended the command line
+        if (term_fresh && c == NWL)
+            continue;
+        term_fresh = FALSE;
+        term_putc(c);
+    }
+}
+
+/*
+ * Feed one received byte through the escape parser.
+ */
+static void term_putc(uint8_t c)
+{
+    uint8_t row, col;
+
+    if (term_state == TERM_ESC)
+    {
+        term_state = TERM_TEXT;
+        if (c == '[')
+        {
+            term_arg[0] = term_arg[1] = 0;
+            term_nargs = 0;
+            term_state = TERM_CSI;
+        }
+        else if (c == 'c')
+            lcd_clear(term_lcd);
+        return;
+    }
+
+    if (term_state == TERM_CSI)
+    {
+        if (c >= '0' && c <= '9')
+        {
+            if (term_nargs < TERM_MAX_ARGS && term_arg[term_nargs] < TERM_ARG_MAX)
+                term_arg[term_nargs] = term_arg[term_nargs] * 10 + c - '0';
+        }
+        else if (c == ';')
+            ++term_nargs;
+        else if (c >= 0x40 && c <= 0x7E)
+        {
+            // final byte; anything else, such as '?', is skipped
+            term_state = TERM_TEXT;
+            term_csi(c);
+        }
+        return;
+    }
+
+    row = term_lcd->line;
+    col = term_lcd->col;
+    switch (c)
+    {
+    case TERM_ESC_CHAR:
+        term_state = TERM_ESC;
+        break;
+    case TERM_EXIT:
+        term_stop();
+        break;
+    case CR:
+        term_goto(row, 0);
+        break;
+    case NWL:
+        if (row == term_rows() - 1)
+            lcd_scroll(term_lcd);
+        term_goto(row + 1, col);
+        break;
+    case BACKSPACE:
+        if (col)
+            term_goto(row, col - 1);
+        break;
+    default:
+        if (c >= SPACE && c != DEL)
+            lcd_putch(term_lcd, c);
+        break;
+    }
+}
+
+/*
+ * Run a control sequence; its parameters are in term_arg.
+ */
+static void term_csi(uint8_t c)
+{
+    uint8_t row, col, n;
+
+    row = term_lcd->line;
+    col = term_lcd->col;
+    n = term_count();
+    switch (c)
+    {
+    case 'H':
+    case 'f':
+        term_goto(term_arg[0] ? term_arg[0] - 1 : 0, term_arg[1] ? term_arg[1] - 1 : 0);
+        break;
+    case 'A':
+        term_goto(row > n ? row - n : 0, col);
+        break;
+    case 'B':
+        term_goto(row + n, col);
+        break;
+    case 'C':
+        term_goto(row, col + n);
+        break;
+    case 'D':
+        term_goto(row, col > n ? col - n : 0);
+        break;
+    case 'J':
+        if (term_arg[0] == 2)
+        {
+            lcd_clear(term_lcd);
+            term_goto(row, col);
+        }
+        else if (term_arg[0] == 0)
+        {
+            term_blank(row, col, term_cols());
+            for (n = row + 1; n < term_rows(); n++)
+                term_blank(n, 0, term_cols());
+            term_goto(row, col);
+        }
+        break;
+    case 'K':
+        if (term_arg[0] == 0)
+            term_blank(row, col, term_cols());
+        else if (term_arg[0] == 1)
+            term_blank(row, 0, col + 1);
+        else if (term_arg[0] == 2)
+            term_blank(row, 0, term_cols());
+        term_goto(row, col);
+        break;
+    }
+}
+
+/*
+ * Move the cursor, clamped to the screen.
+ */
+static void term_goto(uint8_t row, uint8_t col)
+{
+    if (row >= term_rows())
+        row = term_rows() - 1;
+    if (col >= term_cols())
+        col = term_cols() - 1;
+    lcd_goto(term_lcd, row, col);
+}
+
+/*
+ * Write spaces over columns from to to-1 of a line.
+ */
+static void term_blank(uint8_t row, uint8_t from, uint8_t to)
+{
+    if (to > term_cols())
+        to = term_cols();
+    term_goto(row, from);
+    for (; from < to; from++)
+        lcd_putch(term_lcd, SPACE);
+}
+
+/*
+ * Leave terminal mode: flow control off, telemetry back on.
+ */
+static void term_stop(void)
+{
+    term_state = TERM_OFF;
+    ser_set_flow(SER_FLOW_NONE);
+    telem_muted = FALSE;
+    lcd_clear(term_lcd);
+}
+
+#endif
@@ -0,0 +1,297 @@
+/*
+ * File:   collector.cpp
+ * Author: Kevin Macksamie
+ *
+ * Collect READINGS from many telemetry streams into a reading store.
+ *
+ *   collector [-b baud] [-i seconds] [-l] -o store device...
+ *
+ * Every device (serial port, pseudo-terminal or file) is read through one
+ * epoll loop and has its own frame parser. Each reading is stored with
+ * the time its bytes were read and the device's node id, which the store
+ * keeps per device path across runs. Other frame types are counted and
+ * dropped; use telemdec to look at them.
+ *
+ * Every -i seconds (default 5) the buffered rows are written out and a
+ * line of statistics goes to stderr. With -l the READINGS TIME16 field is
+ * taken to be CLOCK_MONOTONIC milliseconds, as devsim sends it, and the
+ * delivery latency is reported too. SIGINT or SIGTERM, or the last device
+ * closing, flushes the store and exits.
+ */
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <vector>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "reading_store.hpp"
+#include "serial_port.hpp"
+#include "telem_frame.hpp"
+
+/* One input stream */
+struct Port
+{
+    std::string path;
+    int fd;
+    uint16_t node;
+    telem::Parser parser;
+
+    Port(const std::string &p, int f, uint16_t n, telem::Parser::Callback cb)
+        : path(p), fd(f), node(n), parser(std::move(cb)) {}
+};
+
+/* Counts since the last statistics line */
+struct Interval
+{
+    uint64_t bytes = 0;
+    uint64_t frames = 0;
+    uint64_t readings = 0;
+    uint64_t other = 0;                 // frames that are not READINGS
+    std::vector<unsigned> latency_ms;
+};
+
+static volatile sig_atomic_t stop;
+static store::Writer writer;
+static Interval interval;
+static int64_t read_time_us;            // time of the read being parsed
+static bool latency;
+static bool store_failed;
+
+static void on_signal(int)
+{
+    stop = 1;
+}
+
+static int64_t now_us(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return int64_t(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void on_frame(const Port &port, const telem::Frame &f)
+{
+    uint16_t time_ms;
+    std::vector<telem::Reading> readings;
+
+    ++interval.frames;
+    if (!telem::decode_readings(f, time_ms, readings))
+    {
+        ++interval.other;
+        return;
+    }
+
+    for (const telem::Reading &r : readings)
+        if (!writer.append({read_time_us, port.node, r.sensor, r.raw}) && !store_failed)
+        {
+            fprintf(stderr, "collector: store: %s\n", strerror(errno));
+            store_failed = true;
+        }
+    interval.readings += readings.size();
+
+    if (latency)
+    {
+        uint16_t now_ms = static_cast<uint16_t>(now_us(CLOCK_MONOTONIC) / 1000);
+        interval.latency_ms.push_back(static_cast<uint16_t>(now_ms - time_ms));
+    }
+}
+
+static unsigned percentile(std::vector<unsigned> &v, unsigned pct)
+{
+    size_t k = (v.size() - 1) * pct / 100;
+    std::nth_element(v.begin(), v.begin() + k, v.end());
+    return v[k];
+}
+
+static void report(double seconds, size_t open_ports, const std::vector<std::unique_ptr<Port>> &ports)
+{
+    uint64_t crc = 0, gaps = 0;
+    for (const auto &p : ports)
+    {
+        crc += p->parser.stats().crc_errors;
+        gaps += p->parser.stats().seq_gaps;
+    }
+
+    fprintf(stderr, "ports %zu, %.0f frames/s, %.0f readings/s, %.1f KiB/s, other %llu, "
+            "crc errors %llu, sequence gaps %llu, stored %llu",
+            open_ports, interval.frames / seconds, interval.readings / seconds,
+            interval.bytes / seconds / 1024, (unsigned long long) interval.other,
+            (unsigned long long) crc, (unsigned long long) gaps,
+            (unsigned long long) writer.rows());
+    if (latency && !interval.latency_ms.empty())
+    {
+        std::vector<unsigned> &v = interval.latency_ms;
+        unsigned p50 = percentile(v, 50);
+        unsigned p99 = percentile(v, 99);
+        fprintf(stderr, ", latency ms p50 %u p99 %u max %u", p50, p99,
+                *std::max_element(v.begin(), v.end()));
+    }
+    fputc('\n', stderr);
+    interval = Interval();
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-b baud] [-i seconds] [-l] -o store device...\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned baud = 115200;
+    unsigned every_s = 5;
+    std::string dir;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:i:lo:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'b':
+            baud = static_cast<unsigned>(strtoul(optarg, nullptr, 10));
+            break;
+        case 'i':
+            every_s = std::max(1ul, strtoul(optarg, nullptr, 10));
+            break;
+        case 'l':
+            latency = true;
+            break;
+        case 'o':
+            dir = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (dir.empty() || optind == argc)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    if (!writer.open(dir))
+    {
+        fprintf(stderr, "%s: %s: %s\n", argv[0], dir.c_str(), strerror(errno));
+        return 1;
+    }
+
+    int ep = epoll_create1(0);
+    if (ep < 0)
+    {
+        perror("epoll_create1");
+        return 1;
+    }
+
+    std::vector<std::unique_ptr<Port>> ports;
+    for (int i = optind; i < argc; i++)
+    {
+        int fd = serial::open_port(argv[i], baud, true);
+        if (fd < 0)
+        {
+            fprintf(stderr, "%s: %s: %s\n", argv[0], argv[i], strerror(errno));
+            return 1;
+        }
+
+        Port *p = new Port(argv[i], fd, writer.node_id(argv[i]), nullptr);
+        p->parser = telem::Parser([p](const telem::Frame &f) { on_frame(*p, f); });
+        ports.emplace_back(p);
+
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.ptr = p;
+        if (epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev) < 0)
+        {
+            // regular files cannot be polled, they are read to the end here
+            if (errno != EPERM)
+            {
+                fprintf(stderr, "%s: %s: %s\n", argv[0], argv[i], strerror(errno));
+                return 1;
+            }
+            uint8_t buf[65536];
+            ssize_t n;
+            read_time_us = now_us(CLOCK_REALTIME);
+            while ((n = read(fd, buf, sizeof buf)) > 0)
+            {
+                interval.bytes += static_cast<size_t>(n);
+                p->parser.feed(buf, static_cast<size_t>(n));
+            }
+            close(fd);
+            p->fd = -1;
+        }
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    size_t open_ports = 0;
+    for (const auto &p : ports)
+        open_ports += p->fd >= 0;
+
+    std::vector<struct epoll_event> events(std::max<size_t>(ports.size(), 1));
+    int64_t last_us = now_us(CLOCK_MONOTONIC);
+    int64_t next_us = last_us + every_s * 1000000ll;
+    uint8_t buf[16384];
+
+    while (!stop && open_ports)
+    {
+        int64_t wait_us = next_us - now_us(CLOCK_MONOTONIC);
+        int n = epoll_wait(ep, events.data(), static_cast<int>(events.size()),
+                           wait_us > 0 ? static_cast<int>(wait_us / 1000) + 1 : 0);
+        if (n < 0 && errno != EINTR)
+        {
+            perror("epoll_wait");
+            break;
+        }
+
+        read_time_us = now_us(CLOCK_REALTIME);
+        for (int i = 0; i < n; i++)
+        {
+            Port *p = static_cast<Port *>(events[i].data.ptr);
+            ssize_t got = read(p->fd, buf, sizeof buf);
+            if (got > 0)
+            {
+                interval.bytes += static_cast<size_t>(got);
+                p->parser.feed(buf, static_cast<size_t>(got));
+            }
+            else if (got == 0 || (errno != EAGAIN && errno != EINTR))
+            {
+                // EOF, or EIO once the other end of a pty has gone
+                fprintf(stderr, "%s: %s: closed\n", argv[0], p->path.c_str());
+                epoll_ctl(ep, EPOLL_CTL_DEL, p->fd, nullptr);
+                close(p->fd);
+                p->fd = -1;
+                --open_ports;
+            }
+        }
+
+        int64_t t = now_us(CLOCK_MONOTONIC);
+        if (t >= next_us)
+        {
+            if (!writer.flush() && !store_failed)
+            {
+                fprintf(stderr, "%s: %s: %s\n", argv[0], dir.c_str(), strerror(errno));
+                store_failed = true;
+            }
+            report((t - last_us) / 1e6, open_ports, ports);
+            last_us = t;
+            next_us = t + every_s * 1000000ll;
+        }
+    }
+
+    int64_t t = now_us(CLOCK_MONOTONIC);
+    if (!writer.flush())
+        fprintf(stderr, "%s: %s: %s\n", argv[0], dir.c_str(), strerror(errno));
+    report(std::max(1e-3, (t - last_us) / 1e6), open_ports, ports);
+    for (const auto &p : ports)
+        if (p->fd >= 0)
+            close(p->fd);
+    close(ep);
+    return store_failed ? 1 : 0;
+}
@@ -0,0 +1,128 @@
+/*
+ * File:   log_dict.cpp
+ * Author: Kevin Macksamie
+ */
+#include "log_dict.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+namespace logdict {
+
+bool Dictionary::load(const std::string &path)
+{
+    std::ifstream in(path);
+    if (!in)
+        return false;
+
+    std::string line;
+    while (std::getline(in, line))
+    {
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        std::vector<std::string> fields;
+        std::istringstream ss(line);
+        std::string field;
+        while (fields.size() < 5 && std::getline(ss, field, '\t'))
+            fields.push_back(field);
+        std::getline(ss, field);    // format may itself contain tabs
+        if (fields.size() < 5)
+            continue;
+
+        Entry e;
+        e.level = static_cast<unsigned>(std::stoul(fields[2]));
+        e.module = fields[3];
+        e.file = fields[4];
+        e.format = field;
+        entries_[{static_cast<unsigned>(std::stoul(fields[0])),
+                  static_cast<unsigned>(std::stoul(fields[1]))}] = e;
+    }
+    return true;
+}
+
+const Entry *Dictionary::find(unsigned module, unsigned line) const
+{
+    auto it = entries_.find({module, line});
+    return it == entries_.end() ? nullptr : &it->second;
+}
+
+bool decode(const telem::Frame &f, Message &msg)
+{
+    const std::vector<uint8_t> &p = f.payload;
+    if (f.type != TELEM_T_LOG || p.size() < 3 || (p.size() - 3) % 2 || p.size() > 7)
+        return false;
+
+    msg.module = p[0] >> 3;
+    msg.level = p[0] & 0x07;
+    msg.line = (p[1] << 8) | p[2];
+    msg.nargs = static_cast<unsigned>((p.size() - 3) / 2);
+    for (unsigned i = 0; i < msg.nargs; i++)
+        msg.args[i] = static_cast<uint16_t>((p[3 + 2 * i] << 8) | p[4 + 2 * i]);
+    return true;
+}
+
+std::string expand(const std::string &format, const Message &msg)
+{
+    std::string out;
+    unsigned arg = 0;
+
+    for (size_t i = 0; i < format.size(); i++)
+    {
+        if (format[i] != '%')
+        {
+            out += format[i];
+            continue;
+        }
+
+        // collect flags and width up to the conversion character
+        size_t start = i++;
+        while (i < format.size() && std::string("-+ #0123456789").find(format[i]) != std::string::npos)
+            i++;
+        if (i >= format.size())
+            break;
+
+        char conv = format[i];
+        if (conv == '%')
+        {
+            out += '%';
+            continue;
+        }
+
+        std::string spec = format.substr(start, i - start + 1);
+        uint16_t v = arg < msg.nargs ? msg.args[arg] : 0;
+        arg++;
+
+        char buf[32];
+        switch (conv)
+        {
+        case 'd':
+        case 'i':
+            snprintf(buf, sizeof buf, spec.c_str(), static_cast<int>(static_cast<int16_t>(v)));
+            break;
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'c':
+            snprintf(buf, sizeof buf, spec.c_str(), static_cast<unsigned>(v));
+            break;
+        default:
+            snprintf(buf, sizeof buf, "%s", spec.c_str());
+            break;
+        }
+        out += buf;
+    }
+    return out;
+}
+
+std::string level_name(unsigned level)
+{
+    static const char *names[] = { "none", "error", "warn", "info", "debug" };
+    if (level < sizeof names / sizeof names[0])
+        return names[level];
+    return "level" + std::to_string(level);
+}
+
+} // namespace logdict
@@ -0,0 +1,61 @@
+/*
+ * File:   log_dict.hpp
+ * Author: Kevin Macksamie
+ *
+ * Log message dictionary produced by logdict. One entry per line:
+ *   <module id> TAB <line> TAB <level> TAB <module> TAB <file> TAB <format>
+ */
+#ifndef LOG_DICT_HPP
+#define LOG_DICT_HPP
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+
+#include "telem_frame.hpp"
+
+namespace logdict {
+
+struct Entry
+{
+    unsigned level = 0;
+    std::string module;
+    std::string file;
+    std::string format;
+};
+
+class Dictionary
+{
+public:
+    /* Load a dictionary file; returns false if it cannot be read */
+    bool load(const std::string &path);
+
+    const Entry *find(unsigned module, unsigned line) const;
+
+private:
+    std::map<std::pair<unsigned, unsigned>, Entry> entries_;
+};
+
+/* A decoded LOG frame */
+struct Message
+{
+    unsigned module = 0;
+    unsigned level = 0;
+    unsigned line = 0;
+    unsigned nargs = 0;
+    uint16_t args[2] = {0, 0};
+};
+
+/* Split a LOG frame payload; returns false if it is malformed */
+bool decode(const telem::Frame &f, Message &msg);
+
+/* Expand a printf style format with 16-bit arguments (%d %u %x %X %c %%) */
+std::string expand(const std::string &format, const Message &msg);
+
+/* Name of a level, "level<n>" if unknown */
+std::string level_name(unsigned level);
+
+} // namespace logdict
+
+#endif
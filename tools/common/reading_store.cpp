@@ -0,0 +1,349 @@
+/*
+ * File:   reading_store.cpp
+ * Author: Kevin Macksamie
+ *
+ * A store directory holds:
+ *   index        "RSTORE1\n", then one 40 byte Block per block
+ *   time.col     uint32 per row, microseconds after its block's t_min
+ *   node.col     uint16 per row
+ *   sensor.col   uint8 per row
+ *   raw.col      int16 per row
+ *   nodes        "<id> <name>" per line
+ * Integers are in host byte order, 9 bytes per row in all. A block's rows
+ * are written to the columns before its index entry, so the index only
+ * ever describes rows that are on disk; open() cuts the columns back to
+ * the index.
+ */
+#include "reading_store.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace store {
+
+static const char MAGIC[8] = {'R', 'S', 'T', 'O', 'R', 'E', '1', '\n'};
+
+enum { COL_TIME, COL_NODE, COL_SENSOR, COL_RAW, COLS };
+
+static const char *const col_name[COLS] = {"time.col", "node.col", "sensor.col", "raw.col"};
+static const size_t col_width[COLS] = {4, 2, 1, 2};
+
+static_assert(sizeof(Block) == 40, "index entries are 40 bytes");
+
+static bool write_all(int fd, const void *buf, size_t len)
+{
+    const uint8_t *p = static_cast<const uint8_t *>(buf);
+    while (len)
+    {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+static bool pread_all(int fd, void *buf, size_t len, off_t off)
+{
+    uint8_t *p = static_cast<uint8_t *>(buf);
+    while (len)
+    {
+        ssize_t n = pread(fd, p, len, off);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return false;
+        if (n == 0)
+        {
+            errno = EIO;    // index points past the end of a column
+            return false;
+        }
+        p += n;
+        off += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+/* Read the index; false with errno set, EINVAL if it is not an index */
+static bool load_index(int fd, std::vector<Block> &blocks, off_t &good)
+{
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+        return false;
+
+    blocks.clear();
+    good = 0;
+    if (st.st_size == 0)
+        return true;
+
+    char magic[sizeof MAGIC];
+    if (st.st_size < static_cast<off_t>(sizeof magic) || !pread_all(fd, magic, sizeof magic, 0) ||
+        memcmp(magic, MAGIC, sizeof magic) != 0)
+    {
+        errno = EINVAL;
+        return false;
+    }
+
+    // a partial entry at the end is a write that did not finish
+    size_t n = static_cast<size_t>(st.st_size - sizeof magic) / sizeof(Block);
+    blocks.resize(n);
+    if (n && !pread_all(fd, blocks.data(), n * sizeof(Block), sizeof magic))
+        return false;
+    good = static_cast<off_t>(sizeof magic + n * sizeof(Block));
+    return true;
+}
+
+static void load_nodes(const std::string &dir, std::map<uint16_t, std::string> &nodes)
+{
+    FILE *f = fopen((dir + "/nodes").c_str(), "r");
+    if (!f)
+        return;
+    char line[1024];
+    while (fgets(line, sizeof line, f))
+    {
+        char *end;
+        unsigned long id = strtoul(line, &end, 10);
+        if (end == line || *end != ' ')
+            continue;
+        std::string name(end + 1);
+        while (!name.empty() && name.back() == '\n')
+            name.pop_back();
+        nodes[static_cast<uint16_t>(id)] = name;
+    }
+    fclose(f);
+}
+
+Writer::~Writer()
+{
+    flush();
+    close_all();
+}
+
+void Writer::close_all()
+{
+    if (index_fd_ >= 0)
+        close(index_fd_);
+    index_fd_ = -1;
+    for (int &fd : col_fd_)
+    {
+        if (fd >= 0)
+            close(fd);
+        fd = -1;
+    }
+}
+
+bool Writer::open(const std::string &dir)
+{
+    close_all();
+    pending_.clear();
+    nodes_.clear();
+    dir_ = dir;
+
+    if (mkdir(dir.c_str(), 0777) < 0 && errno != EEXIST)
+        return false;
+
+    index_fd_ = ::open((dir + "/index").c_str(), O_RDWR | O_CREAT, 0666);
+    if (index_fd_ < 0)
+        return false;
+
+    std::vector<Block> blocks;
+    off_t good;
+    if (!load_index(index_fd_, blocks, good))
+        return false;
+    if (good == 0)
+    {
+        if (!write_all(index_fd_, MAGIC, sizeof MAGIC))
+            return false;
+        good = sizeof MAGIC;
+    }
+    if (ftruncate(index_fd_, good) < 0 || lseek(index_fd_, good, SEEK_SET) < 0)
+        return false;
+    rows_ = blocks.empty() ? 0 : blocks.back().first + blocks.back().rows;
+
+    for (int c = 0; c < COLS; c++)
+    {
+        col_fd_[c] = ::open((dir + "/" + col_name[c]).c_str(), O_WRONLY | O_CREAT | O_APPEND, 0666);
+        if (col_fd_[c] < 0 || ftruncate(col_fd_[c], static_cast<off_t>(rows_ * col_width[c])) < 0)
+            return false;
+    }
+
+    std::map<uint16_t, std::string> ids;
+    load_nodes(dir, ids);
+    for (const auto &n : ids)
+        nodes_[n.second] = n.first;
+    return true;
+}
+
+bool Writer::append(const Row &r)
+{
+    bool ok = true;
+
+    if (!pending_.empty())
+    {
+        int64_t lo = std::min(t_min_, r.time_us);
+        int64_t hi = std::max(t_max_, r.time_us);
+        // the time column holds 32-bit offsets, about 71 minutes
+        if (hi - lo > static_cast<int64_t>(UINT32_MAX))
+            ok = flush();
+    }
+    if (pending_.empty())
+        t_min_ = t_max_ = r.time_us;
+    else
+    {
+        t_min_ = std::min(t_min_, r.time_us);
+        t_max_ = std::max(t_max_, r.time_us);
+    }
+
+    pending_.push_back(r);
+    if (pending_.size() >= BLOCK_ROWS)
+        ok = flush() && ok;
+    return ok;
+}
+
+bool Writer::flush()
+{
+    if (pending_.empty() || index_fd_ < 0)
+        return true;
+
+    size_t n = pending_.size();
+    std::vector<uint32_t> time(n);
+    std::vector<uint16_t> node(n);
+    std::vector<uint8_t> sensor(n);
+    std::vector<int16_t> raw(n);
+    Block b = {rows_, static_cast<uint32_t>(n), 0, t_min_, t_max_, 0};
+
+    for (size_t i = 0; i < n; i++)
+    {
+        const Row &r = pending_[i];
+        time[i] = static_cast<uint32_t>(r.time_us - t_min_);
+        node[i] = r.node;
+        sensor[i] = r.sensor;
+        raw[i] = r.raw;
+        b.keys |= key_bit(r.node, r.sensor);
+    }
+
+    const void *data[COLS] = {time.data(), node.data(), sensor.data(), raw.data()};
+    for (int c = 0; c < COLS; c++)
+    {
+        if (!write_all(col_fd_[c], data[c], n * col_width[c]))
+        {
+            // put the columns back in line with the index
+            int err = errno;
+            for (int k = 0; k <= c; k++)
+                if (ftruncate(col_fd_[k], static_cast<off_t>(rows_ * col_width[k])) < 0)
+                    break;
+            errno = err;
+            return false;
+        }
+    }
+    if (!write_all(index_fd_, &b, sizeof b))
+        return false;
+
+    rows_ += n;
+    pending_.clear();
+    return true;
+}
+
+uint16_t Writer::node_id(const std::string &name)
+{
+    auto it = nodes_.find(name);
+    if (it != nodes_.end())
+        return it->second;
+
+    uint16_t id = static_cast<uint16_t>(nodes_.size());
+    nodes_[name] = id;
+    FILE *f = fopen((dir_ + "/nodes").c_str(), "a");
+    if (f)
+    {
+        fprintf(f, "%u %s\n", id, name.c_str());
+        fclose(f);
+    }
+    return id;
+}
+
+Reader::~Reader()
+{
+    for (int fd : col_fd_)
+        if (fd >= 0)
+            close(fd);
+}
+
+bool Reader::open(const std::string &dir)
+{
+    int fd = ::open((dir + "/index").c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    off_t good;
+    bool ok = load_index(fd, blocks_, good);
+    int err = errno;
+    close(fd);
+    if (!ok)
+    {
+        errno = err;
+        return false;
+    }
+
+    for (int c = 0; c < COLS; c++)
+    {
+        col_fd_[c] = ::open((dir + "/" + col_name[c]).c_str(), O_RDONLY);
+        if (col_fd_[c] < 0)
+            return false;
+    }
+    load_nodes(dir, nodes_);
+    return true;
+}
+
+bool Reader::query(int64_t from, int64_t to, int node, int sensor,
+                   const std::function<void(const Row &)> &cb, QueryStats *stats)
+{
+    std::vector<uint32_t> time;
+    std::vector<uint16_t> nodes;
+    std::vector<uint8_t> sensors;
+    std::vector<int16_t> raw;
+    uint64_t mask = (node != ANY && sensor != ANY) ? key_bit(node, sensor) : ~uint64_t(0);
+
+    for (const Block &b : blocks_)
+    {
+        if (stats)
+            ++stats->blocks;
+        if (b.t_max < from || b.t_min >= to || !(b.keys & mask))
+            continue;
+        if (stats)
+            ++stats->read;
+
+        time.resize(b.rows);
+        nodes.resize(b.rows);
+        sensors.resize(b.rows);
+        raw.resize(b.rows);
+        void *data[COLS] = {time.data(), nodes.data(), sensors.data(), raw.data()};
+        for (int c = 0; c < COLS; c++)
+            if (!pread_all(col_fd_[c], data[c], b.rows * col_width[c],
+                           static_cast<off_t>(b.first * col_width[c])))
+                return false;
+
+        for (uint32_t i = 0; i < b.rows; i++)
+        {
+            Row r = {b.t_min + time[i], nodes[i], sensors[i], raw[i]};
+            if (r.time_us < from || r.time_us >= to)
+                continue;
+            if ((node != ANY && r.node != node) || (sensor != ANY && r.sensor != sensor))
+                continue;
+            if (stats)
+                ++stats->rows;
+            cb(r);
+        }
+    }
+    return true;
+}
+
+} // namespace store
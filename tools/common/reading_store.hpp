@@ -0,0 +1,140 @@
+/*
+ * File:   reading_store.hpp
+ * Author: Kevin Macksamie
+ *
+ * Columnar on-disk store for sensor readings. A store is a directory with
+ * one file per column and a block index; see reading_store.cpp for the
+ * layout. Rows are appended in blocks, and a range query only reads the
+ * blocks whose time bounds and sensor mask can match.
+ */
+#ifndef READING_STORE_HPP
+#define READING_STORE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace store {
+
+/* One stored reading */
+struct Row
+{
+    int64_t time_us;    // host receive time, microseconds since the epoch
+    uint16_t node;      // node id, see Writer::node_id()
+    uint8_t sensor;     // sensor id on that node
+    int16_t raw;        // DS18B20 Q11.4, 1/16 degC per LSB
+};
+
+/* Block index entry */
+struct Block
+{
+    uint64_t first;     // row number of the block's first row
+    uint32_t rows;      // rows in the block
+    uint32_t reserved;
+    int64_t t_min;      // earliest time; the time column holds offsets from it
+    int64_t t_max;      // latest time
+    uint64_t keys;      // key_bit() of every node and sensor in the block
+};
+
+/* Match any node or sensor in a query */
+const int ANY = -1;
+
+/* Bit of a node and sensor in Block::keys */
+inline uint64_t key_bit(unsigned node, unsigned sensor)
+{
+    return uint64_t(1) << ((node * 31 + sensor) & 63);
+}
+
+/* Rows buffered before a block is written */
+const size_t BLOCK_ROWS = 4096;
+
+/*
+ * Appends rows. Rows are buffered into blocks and written by flush(),
+ * which also runs when a block fills up and on destruction.
+ */
+class Writer
+{
+public:
+    Writer() = default;
+    Writer(const Writer &) = delete;
+    Writer &operator=(const Writer &) = delete;
+    ~Writer();
+
+    /*
+     * Open or create a store. Rows written after the last complete index
+     * entry, e.g. by a writer that was killed, are dropped. Returns false
+     * with errno set.
+     */
+    bool open(const std::string &dir);
+
+    /* Buffer a row; false with errno set if writing a full block failed */
+    bool append(const Row &r);
+
+    /* Write the buffered rows as a block; false with errno set on error */
+    bool flush();
+
+    /*
+     * Stable node id of a name, such as a device path. New names are
+     * given the next id and recorded in the store's nodes file.
+     */
+    uint16_t node_id(const std::string &name);
+
+    /* Rows in the store, including the buffered ones */
+    uint64_t rows() const { return rows_ + pending_.size(); }
+
+private:
+    std::string dir_;
+    int index_fd_ = -1;
+    int col_fd_[4] = {-1, -1, -1, -1};
+    uint64_t rows_ = 0;                     // rows on disk
+    std::vector<Row> pending_;
+    int64_t t_min_ = 0, t_max_ = 0;         // bounds of pending_
+    std::map<std::string, uint16_t> nodes_;
+
+    void close_all();
+};
+
+/* Blocks looked at by a query */
+struct QueryStats
+{
+    uint64_t blocks = 0;        // blocks in the index
+    uint64_t read = 0;          // blocks read from the columns
+    uint64_t rows = 0;          // rows matched
+};
+
+class Reader
+{
+public:
+    Reader() = default;
+    Reader(const Reader &) = delete;
+    Reader &operator=(const Reader &) = delete;
+    ~Reader();
+
+    /* Open a store and load its index; false with errno set */
+    bool open(const std::string &dir);
+
+    /*
+     * Call cb for each row with from <= time_us < to, of one node and
+     * sensor or ANY. Rows come in block order, which is arrival order.
+     * Returns false with errno set on a read error.
+     */
+    bool query(int64_t from, int64_t to, int node, int sensor,
+               const std::function<void(const Row &)> &cb, QueryStats *stats = nullptr);
+
+    const std::vector<Block> &blocks() const { return blocks_; }
+
+    /* Node names by id, from the nodes file */
+    const std::map<uint16_t, std::string> &nodes() const { return nodes_; }
+
+private:
+    int col_fd_[4] = {-1, -1, -1, -1};
+    std::vector<Block> blocks_;
+    std::map<uint16_t, std::string> nodes_;
+};
+
+} // namespace store
+
+#endif
@@ -0,0 +1,76 @@
+/*
+ * File:   serial_port.cpp
+ * Author: Kevin Macksamie
+ */
+#include "serial_port.hpp"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace serial {
+
+static speed_t to_speed(unsigned baud)
+{
+    switch (baud)
+    {
+    case 9600:   return B9600;
+    case 19200:  return B19200;
+    case 38400:  return B38400;
+    case 57600:  return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+    default:     return 0;
+    }
+}
+
+int open_port(const std::string &path, unsigned baud, bool nonblock)
+{
+    int fd;
+    if (path == "-")
+        fd = dup(STDIN_FILENO);
+    else
+    {
+        // only character devices are opened for writing commands
+        struct stat st;
+        int flags = O_NOCTTY | (nonblock ? O_NONBLOCK : 0);
+        if (stat(path.c_str(), &st) == 0 && S_ISCHR(st.st_mode))
+            flags |= O_RDWR;
+        fd = open(path.c_str(), flags);
+        if (fd < 0 && (flags & O_RDWR) && errno == EACCES)
+            fd = open(path.c_str(), flags & ~O_RDWR);
+    }
+    if (fd < 0)
+        return -1;
+
+    if (nonblock)
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    if (!isatty(fd))
+        return fd;
+
+    struct termios tio;
+    if (tcgetattr(fd, &tio) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    speed_t speed = to_speed(baud);
+    if (speed)
+    {
+        cfsetispeed(&tio, speed);
+        cfsetospeed(&tio, speed);
+    }
+    if (tcsetattr(fd, TCSANOW, &tio) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+} // namespace serial
@@ -0,0 +1,22 @@
+/*
+ * File:   serial_port.hpp
+ * Author: Kevin Macksamie
+ */
+#ifndef SERIAL_PORT_HPP
+#define SERIAL_PORT_HPP
+
+#include <string>
+
+namespace serial {
+
+/*
+ * Open a serial device or pseudo-terminal for raw 8N1 I/O at baud. Devices
+ * that cannot be written are opened read-only. Regular files and "-"
+ * (stdin) are opened read-only as-is. Returns a file descriptor, or -1 with errno
+ * set.
+ */
+int open_port(const std::string &path, unsigned baud, bool nonblock = false);
+
+} // namespace serial
+
+#endif
@@ -0,0 +1,172 @@
+/*
+ * File:   telem_frame.cpp
+ * Author: Kevin Macksamie
+ */
+#include "telem_frame.hpp"
+
+namespace telem {
+
+std::vector<uint8_t> encode(uint8_t type, uint8_t seq, const uint8_t *payload, size_t len)
+{
+    std::vector<uint8_t> out;
+    out.reserve(TELEM_HDR_LEN + len + TELEM_CRC_LEN);
+    out.push_back(TELEM_SYNC);
+    out.push_back(static_cast<uint8_t>(len));
+    out.push_back(type);
+    out.push_back(seq);
+    out.insert(out.end(), payload, payload + len);
+
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 1; i < out.size(); i++)
+        crc = crc16(crc, out[i]);
+    out.push_back(static_cast<uint8_t>(crc >> 8));
+    out.push_back(static_cast<uint8_t>(crc & 0xFF));
+    return out;
+}
+
+void Parser::feed(const uint8_t *data, size_t len)
+{
+    buf_.insert(buf_.end(), data, data + len);
+
+    size_t pos = 0;
+    while (pos < buf_.size())
+    {
+        if (buf_[pos] != TELEM_SYNC)
+        {
+            ++pos;
+            ++stats_.skipped;
+            continue;
+        }
+        if (buf_.size() - pos < 2)
+            break;
+
+        size_t plen = buf_[pos + 1];
+        if (plen > TELEM_MAX_PAYLOAD)
+        {
+            ++pos;
+            ++stats_.skipped;
+            continue;
+        }
+
+        size_t total = TELEM_HDR_LEN + plen + TELEM_CRC_LEN;
+        if (buf_.size() - pos < total)
+            break;
+
+        uint16_t crc = 0xFFFF;
+        for (size_t i = 1; i < TELEM_HDR_LEN + plen; i++)
+            crc = crc16(crc, buf_[pos + i]);
+        uint16_t got = static_cast<uint16_t>((buf_[pos + total - 2] << 8) | buf_[pos + total - 1]);
+        if (crc != got)
+        {
+            // not a frame after all, look for the next SYNC inside it
+            ++stats_.crc_errors;
+            ++pos;
+            continue;
+        }
+
+        Frame f;
+        f.type = buf_[pos + 2];
+        f.seq = buf_[pos + 3];
+        f.payload.assign(buf_.begin() + pos + TELEM_HDR_LEN,
+                         buf_.begin() + pos + TELEM_HDR_LEN + plen);
+
+        if (have_seq_ && f.seq != next_seq_)
+            stats_.seq_gaps += static_cast<uint8_t>(f.seq - next_seq_);
+        have_seq_ = true;
+        next_seq_ = static_cast<uint8_t>(f.seq + 1);
+
+        ++stats_.frames;
+        pos += total;
+        cb_(f);
+    }
+
+    buf_.erase(buf_.begin(), buf_.begin() + pos);
+}
+
+bool decode_readings(const Frame &f, uint16_t &time_ms, std::vector<Reading> &out)
+{
+    const std::vector<uint8_t> &p = f.payload;
+    if (f.type != TELEM_T_READINGS || p.size() < 2 || (p.size() - 2) % 3)
+        return false;
+
+    time_ms = static_cast<uint16_t>((p[0] << 8) | p[1]);
+    out.clear();
+    for (size_t i = 2; i < p.size(); i += 3)
+        out.push_back({p[i], static_cast<int16_t>((p[i + 1] << 8) | p[i + 2])});
+    return true;
+}
+
+std::string type_name(uint8_t type)
+{
+    switch (type)
+    {
+    case TELEM_T_READINGS: return "reading";
+    case TELEM_T_ROMS:     return "rom";
+    case TELEM_T_STATUS:   return "status";
+    case TELEM_T_COUNTERS: return "counter";
+    case TELEM_T_LOG:      return "log";
+    case TELEM_T_SAMPLES:  return "sample";
+    case TELEM_T_REPLY:    return "reply";
+    case TELEM_T_HEALTH:   return "health";
+    default:               return "type" + std::to_string(type);
+    }
+}
+
+std::string counter_name(uint8_t key)
+{
+    switch (key)
+    {
+    case TELEM_C_ISR_MAX:    return "isr_max_cycles";
+    case TELEM_C_DEFER_DROP: return "defer_dropped";
+    case TELEM_C_RX_DROP:    return "rx_dropped";
+    case TELEM_C_TX_DROP:    return "tx_dropped";
+    case TELEM_C_LOG_DROP:   return "log_dropped";
+    case TELEM_C_AWAKE_MS:   return "awake_ms";
+    case TELEM_C_ASLEEP_MS:  return "asleep_ms";
+    case TELEM_C_WAKES:      return "wakes";
+    case TELEM_C_NO_DEVICE:  return "no_presence";
+    case TELEM_C_BUS_SHORT:  return "bus_shorts";
+    case TELEM_C_SEARCH_ERR: return "search_errors";
+    case TELEM_C_SEG_SWITCH: return "segment_switches";
+    }
+    if ((key & 0xF0) == TELEM_C_TASK_WORST)
+        return "task" + std::to_string(key & 0x0F) + "_worst_ms";
+    if ((key & 0xF0) == TELEM_C_TASK_LATE)
+        return "task" + std::to_string(key & 0x0F) + "_late";
+    return "key" + std::to_string(key);
+}
+
+std::string command_name(uint8_t code)
+{
+    switch (code)
+    {
+    case TELEM_CMD_PERIOD:  return "period";
+    case TELEM_CMD_RES:     return "res";
+    case TELEM_CMD_SCAN:    return "scan";
+    case TELEM_CMD_UNIT:    return "unit";
+    case TELEM_CMD_ROMS:    return "roms";
+    case TELEM_CMD_DUMP:    return "dump";
+    case TELEM_CMD_POWER:   return "power";
+    case TELEM_CMD_HEALTH:  return "health";
+    case TELEM_CMD_FORGET:  return "forget";
+    case TELEM_CMD_TERM:    return "term";
+    case TELEM_CMD_BAUD:    return "baud";
+    case TELEM_CMD_UNKNOWN: return "unknown";
+    default:                return "cmd" + std::to_string(code);
+    }
+}
+
+std::string status_name(uint8_t status)
+{
+    switch (status)
+    {
+    case TELEM_R_OK:       return "ok";
+    case TELEM_R_UNKNOWN:  return "unknown_command";
+    case TELEM_R_BADARG:   return "bad_argument";
+    case TELEM_R_OVERFLOW: return "line_too_long";
+    case TELEM_R_DEVICE:   return "device_error";
+    default:               return "status" + std::to_string(status);
+    }
+}
+
+} // namespace telem
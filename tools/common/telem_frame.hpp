@@ -0,0 +1,94 @@
+/*
+ * File:   telem_frame.hpp
+ * Author: Kevin Macksamie
+ *
+ * Host side parser for the firmware's binary telemetry frames. The wire
+ * format is defined in hw_interfaces/protocol/telemetry/telem_proto.h.
+ */
+#ifndef TELEM_FRAME_HPP
+#define TELEM_FRAME_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "telem_proto.h"
+}
+
+namespace telem {
+
+/* A frame that passed its CRC check */
+struct Frame
+{
+    uint8_t type = 0;
+    uint8_t seq = 0;
+    std::vector<uint8_t> payload;
+};
+
+/* One sample out of a READINGS frame */
+struct Reading
+{
+    uint8_t sensor;
+    int16_t raw;        // DS18B20 Q11.4, 1/16 degC per LSB
+};
+
+/* Parser statistics */
+struct Stats
+{
+    uint64_t frames = 0;        // frames delivered
+    uint64_t crc_errors = 0;    // candidate frames that failed the CRC
+    uint64_t skipped = 0;       // bytes discarded while hunting for SYNC
+    uint64_t seq_gaps = 0;      // frames missing according to SEQ
+};
+
+/* CRC-16/CCITT-FALSE, the same byte-wise form as the firmware */
+inline uint16_t crc16(uint16_t crc, uint8_t b)
+{
+    uint8_t x = static_cast<uint8_t>((crc >> 8) ^ b);
+    x ^= x >> 4;
+    return static_cast<uint16_t>((crc << 8) ^ (x << 12) ^ (x << 5) ^ x);
+}
+
+/* Encode a frame exactly as the firmware would put it on the wire */
+std::vector<uint8_t> encode(uint8_t type, uint8_t seq, const uint8_t *payload, size_t len);
+
+/*
+ * Incremental frame parser. Bytes can be fed in any chunking; frames with
+ * a bad length or CRC are skipped by resynchronizing on the next SYNC.
+ */
+class Parser
+{
+public:
+    using Callback = std::function<void(const Frame &)>;
+
+    explicit Parser(Callback cb) : cb_(std::move(cb)) {}
+
+    void feed(const uint8_t *data, size_t len);
+
+    const Stats &stats() const { return stats_; }
+
+private:
+    Callback cb_;
+    std::vector<uint8_t> buf_;
+    Stats stats_;
+    bool have_seq_ = false;
+    uint8_t next_seq_ = 0;
+};
+
+/* Split a READINGS payload; returns false if it is malformed */
+bool decode_readings(const Frame &f, uint16_t &time_ms, std::vector<Reading> &out);
+
+/* Printable name of a frame type or COUNTERS key */
+std::string type_name(uint8_t type);
+std::string counter_name(uint8_t key);
+
+/* Printable name of a REPLY command code or status */
+std::string command_name(uint8_t code);
+std::string status_name(uint8_t status);
+
+} // namespace telem
+
+#endif
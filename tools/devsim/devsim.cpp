@@ -0,0 +1,259 @@
+/*
+ * File:   devsim.cpp
+ * Author: Kevin Macksamie
+ *
+ * Stand-in for a roomful of sensor nodes: each node is a pseudo-terminal
+ * streaming READINGS frames, paced to what its UART would manage at the
+ * given baud rate.
+ *
+ *   devsim [-n nodes] [-s sensors] [-b baud] [-p period_ms] [-D seconds] [-d dir]
+ *
+ * The terminal side of every node is printed on stdout, one per line, and
+ * with -d also linked as dir/node0, dir/node1, ... so a collector can be
+ * started on them:
+ *
+ *   devsim -n 200 -d /tmp/sim & collector -l -o /tmp/store /tmp/sim/node*
+ *
+ * Each node sends all its sensors every period_ms, or back to back at the
+ * full baud rate with -p 0 (the default), in frames of up to ten readings
+ * like the firmware. Bytes go out a few at a time as the baud rate allows,
+ * so the reader sees frames split the way a UART would split them. TIME16
+ * is CLOCK_MONOTONIC in milliseconds, which collector -l turns into a
+ * latency. Sending stops after -D seconds, or on SIGINT or SIGTERM.
+ */
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "serial_port.hpp"
+#include "telem_frame.hpp"
+
+#define TICK_MS             2       /* Pacing granularity */
+#define READINGS_PER_FRAME  ((TELEM_MAX_PAYLOAD - 2) / 3)
+#define REPORT_MS           5000
+
+/* One simulated node */
+struct Node
+{
+    int master = -1;                // our end of the pty
+    int slave = -1;                 // held open so the pty stays raw and alive
+    std::string path;               // terminal side, for the collector
+    double credit = 0;              // bytes the UART could have sent by now
+    std::vector<uint8_t> out;       // frames not sent yet
+    size_t sent = 0;                // bytes of out already written
+    uint8_t seq = 0;
+    int64_t due_ms = 0;             // when the next set of readings is taken
+};
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int)
+{
+    stop = 1;
+}
+
+static int64_t now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return int64_t(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+static bool open_node(Node &n, unsigned baud)
+{
+    n.master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (n.master < 0 || grantpt(n.master) < 0 || unlockpt(n.master) < 0)
+        return false;
+    const char *name = ptsname(n.master);
+    if (!name)
+        return false;
+    n.path = name;
+
+    // raw mode is set on the terminal side, where the line discipline is
+    n.slave = serial::open_port(n.path, baud);
+    if (n.slave < 0)
+        return false;
+    fcntl(n.master, F_SETFL, fcntl(n.master, F_GETFL) | O_NONBLOCK);
+    return true;
+}
+
+/* Queue one set of readings from every sensor */
+static void take_readings(Node &n, unsigned id, unsigned sensors, int64_t t_ms)
+{
+    uint8_t payload[TELEM_MAX_PAYLOAD];
+    uint16_t time_ms = static_cast<uint16_t>(t_ms);
+
+    for (unsigned first = 0; first < sensors; first += READINGS_PER_FRAME)
+    {
+        size_t len = 0;
+        payload[len++] = static_cast<uint8_t>(time_ms >> 8);
+        payload[len++] = static_cast<uint8_t>(time_ms);
+        for (unsigned s = first; s < sensors && s < first + READINGS_PER_FRAME; s++)
+        {
+            // a slow swing around a per node temperature
+            double c = 18.0 + id % 10 + 2.0 * sin(t_ms / 60000.0 * 2 * M_PI + s);
+            int16_t raw = static_cast<int16_t>(lround(c * 16));
+            payload[len++] = static_cast<uint8_t>(s);
+            payload[len++] = static_cast<uint8_t>(static_cast<uint16_t>(raw) >> 8);
+            payload[len++] = static_cast<uint8_t>(raw);
+        }
+        std::vector<uint8_t> f = telem::encode(TELEM_T_READINGS, n.seq++, payload, len);
+        n.out.insert(n.out.end(), f.begin(), f.end());
+    }
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-n nodes] [-s sensors] [-b baud] [-p period_ms] [-D seconds] [-d dir]\n",
+            prog);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned nodes = 1, sensors = 4, baud = 115200, period_ms = 0, duration_s = 0;
+    std::string dir;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:s:b:p:D:d:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            nodes = static_cast<unsigned>(strtoul(optarg, nullptr, 10));
+            break;
+        case 's':
+            sensors = static_cast<unsigned>(strtoul(optarg, nullptr, 10));
+            break;
+        case 'b':
+            baud = static_cast<unsigned>(strtoul(optarg, nullptr, 10));
+            break;
+        case 'p':
+            period_ms = static_cast<unsigned>(strtoul(optarg, nullptr, 10));
+            break;
+        case 'D':
+            duration_s = static_cast<unsigned>(strtoul(optarg, nullptr, 10));
+            break;
+        case 'd':
+            dir = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (!nodes || !sensors || sensors > TELEM_ROM_ID + 1 || !baud || optind != argc)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    if (!dir.empty() && mkdir(dir.c_str(), 0777) < 0 && errno != EEXIST)
+    {
+        fprintf(stderr, "%s: %s: %s\n", argv[0], dir.c_str(), strerror(errno));
+        return 1;
+    }
+
+    std::vector<Node> node(nodes);
+    int64_t start = now_ms();
+    for (unsigned i = 0; i < nodes; i++)
+    {
+        if (!open_node(node[i], baud))
+        {
+            fprintf(stderr, "%s: node %u: %s\n", argv[0], i, strerror(errno));
+            return 1;
+        }
+        if (!dir.empty())
+        {
+            std::string link = dir + "/node" + std::to_string(i);
+            unlink(link.c_str());
+            if (symlink(node[i].path.c_str(), link.c_str()) < 0)
+            {
+                fprintf(stderr, "%s: %s: %s\n", argv[0], link.c_str(), strerror(errno));
+                return 1;
+            }
+        }
+        // spread the nodes over the period so they do not all send at once
+        node[i].due_ms = start + (period_ms ? period_ms * i / nodes : 0);
+        printf("%s\n", node[i].path.c_str());
+    }
+    fflush(stdout);
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    double bytes_per_ms = baud / 10.0 / 1000.0;     // 8N1 is ten bits a byte
+    uint64_t frames = 0, bytes = 0, stalls = 0;
+    int64_t last = now_ms(), report_at = last + REPORT_MS;
+    struct timespec tick;
+    clock_gettime(CLOCK_MONOTONIC, &tick);
+
+    while (!stop && (!duration_s || last - start < duration_s * 1000ll))
+    {
+        tick.tv_nsec += TICK_MS * 1000000L;
+        if (tick.tv_nsec >= 1000000000L)
+        {
+            tick.tv_nsec -= 1000000000L;
+            ++tick.tv_sec;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tick, nullptr);
+
+        int64_t t = now_ms();
+        double credit = (t - last) * bytes_per_ms;
+        last = t;
+
+        for (unsigned i = 0; i < nodes; i++)
+        {
+            Node &n = node[i];
+            // an idle UART does not save up time
+            n.credit = std::min(n.credit + credit, TICK_MS * bytes_per_ms + TELEM_FRAME_MAX);
+
+            if (n.sent == n.out.size() && t >= n.due_ms)
+            {
+                n.out.clear();
+                n.sent = 0;
+                take_readings(n, i, sensors, t);
+                frames += (sensors + READINGS_PER_FRAME - 1) / READINGS_PER_FRAME;
+                n.due_ms = period_ms ? std::max(n.due_ms + period_ms, t) : t;
+            }
+
+            size_t want = std::min(n.out.size() - n.sent, static_cast<size_t>(n.credit));
+            if (!want)
+                continue;
+            ssize_t got = write(n.master, n.out.data() + n.sent, want);
+            if (got > 0)
+            {
+                n.sent += static_cast<size_t>(got);
+                n.credit -= got;
+                bytes += static_cast<size_t>(got);
+            }
+            else if (got < 0 && errno == EAGAIN)
+                ++stalls;   // the reader is not keeping up
+        }
+
+        if (t >= report_at)
+        {
+            double s = (t - report_at + REPORT_MS) / 1000.0;
+            fprintf(stderr, "nodes %u, %.0f frames/s, %.1f KiB/s, stalls %llu\n",
+                    nodes, frames / s, bytes / s / 1024, (unsigned long long) stalls);
+            frames = bytes = stalls = 0;
+            report_at = t + REPORT_MS;
+        }
+    }
+
+    for (Node &n : node)
+    {
+        close(n.master);
+        close(n.slave);
+    }
+    return 0;
+}
@@ -0,0 +1,376 @@
+/*
+ * File:   ds18b20_bus.cpp
+ * Author: Kevin Macksamie
+ *
+ * Sensors run their ROM and function command state machines bit by bit.
+ * A conversion is latched into the scratchpad lazily, the first time the
+ * sensor is looked at after it has ended, with the temperature at its end.
+ * A parasite powered sensor whose conversion or EEPROM copy is still going
+ * when the master stops driving the bus high loses power: the operation
+ * is dropped and counted as a brownout.
+ */
+#include "ds18b20_bus.hpp"
+
+#include <cmath>
+#include <cstring>
+
+#define US              1000ull
+#define RESET_MIN_NS    (400 * US)
+#define ONE_MAX_NS      (15 * US)
+#define HOLD_NS         (30 * US)       // a 0 bit or the presence pulse
+#define PRESENCE_WAIT   (30 * US)
+#define PRESENCE_NS     (120 * US)
+#define COPY_NS         (10000 * US)
+
+/* Conversion time by the configuration register's R1 R0 bits */
+static const uint64_t conv_ns[4] = {93750 * US, 187500 * US, 375000 * US, 750000 * US};
+
+uint8_t owire_crc8(const uint8_t *data, size_t len)
+{
+    uint8_t crc = 0;
+    while (len--)
+    {
+        uint8_t b = *data++;
+        for (int i = 0; i < 8; i++)
+        {
+            uint8_t mix = (crc ^ b) & 0x01;
+            crc >>= 1;
+            if (mix)
+                crc ^= 0x8C;
+            b >>= 1;
+        }
+    }
+    return crc;
+}
+
+static bool rom_bit(const uint8_t *rom, unsigned n)
+{
+    return (rom[n / 8] >> (n % 8)) & 1;
+}
+
+void Ds18b20Bus::add(double celsius, double ramp, bool parasite, int segment)
+{
+    Sensor s;
+    uint32_t x = 0x9E3779B9u * static_cast<uint32_t>(dev_.size() + 1);
+
+    s.rom[0] = 0x28;
+    for (int i = 1; i < 7; i++)
+    {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        s.rom[i] = static_cast<uint8_t>(x);
+    }
+    s.rom[7] = owire_crc8(s.rom, 7);
+    s.parasite = parasite;
+    s.segment = segment;
+    s.celsius = celsius;
+    s.ramp = ramp;
+
+    // power-on scratchpad: 85 degC, TH 75, TL 70, 12 bits
+    static const uint8_t por[8] = {0x50, 0x05, 0x4B, 0x46, 0x7F, 0xFF, 0x0C, 0x10};
+    memcpy(s.pad, por, sizeof por);
+    s.pad[8] = owire_crc8(s.pad, 8);
+    memcpy(s.ee, por + 2, sizeof s.ee);
+    dev_.push_back(s);
+}
+
+bool Ds18b20Bus::connected(const Sensor &s) const
+{
+    return segment_ == ALL || s.segment == segment_;
+}
+
+void Ds18b20Bus::connect(uint64_t t, int segment)
+{
+    if (segment == segment_)
+        return;
+    segment_ = segment;
+    for (Sensor &s : dev_)
+    {
+        finish(s, t);
+        if (s.parasite && !connected(s) && (s.conv_end || s.busy_until > t))
+        {
+            s.conv_end = 0;
+            s.busy_until = 0;
+            ++brownouts_;
+        }
+    }
+}
+
+void Ds18b20Bus::finish(Sensor &s, uint64_t t)
+{
+    if (!s.conv_end || t < s.conv_end)
+        return;
+
+    unsigned res = (s.pad[4] >> 5) & 3;
+    double c = s.celsius + s.ramp * (s.conv_end / 1e9);
+    long raw = lround(c * 16);
+    raw &= ~((1L << (3 - res)) - 1);    // undefined low bits read as 0
+    s.pad[0] = static_cast<uint8_t>(raw);
+    s.pad[1] = static_cast<uint8_t>(raw >> 8);
+    s.pad[8] = owire_crc8(s.pad, 8);
+    s.converted = s.conv_end;
+    s.conv_end = 0;
+    ++conversions_;
+}
+
+void Ds18b20Bus::drive(uint64_t t, Drive d)
+{
+    if (d == drive_)
+        return;
+
+    if (d == LOW)
+    {
+        fall_ = t;
+        for (Sensor &s : dev_)
+        {
+            if (!connected(s))
+                continue;
+            finish(s, t);
+            if (sending(s))
+            {
+                s.sent = true;
+                if (!send_bit(s, t))
+                {
+                    s.pull_from = t;
+                    s.pull_to = t + HOLD_NS;
+                }
+            }
+        }
+    }
+    else if (drive_ == LOW)
+    {
+        uint64_t low = t - fall_;
+        if (low >= RESET_MIN_NS)
+            ++resets_;
+        else
+            ++slots_;
+        for (Sensor &s : dev_)
+        {
+            if (!connected(s))
+                continue;
+            if (low >= RESET_MIN_NS)
+                reset(s, t);
+            else if (s.sent)
+                s.sent = false;
+            else
+                receive_bit(s, t, low < ONE_MAX_NS);
+        }
+    }
+
+    // only the master driving high powers a parasite sensor through its work
+    if (d != HIGH)
+    {
+        for (Sensor &s : dev_)
+        {
+            if (!s.parasite || !connected(s))
+                continue;
+            finish(s, t);
+            if (s.conv_end || s.busy_until > t)
+            {
+                s.conv_end = 0;
+                s.busy_until = 0;
+                ++brownouts_;
+            }
+        }
+    }
+    drive_ = d;
+}
+
+bool Ds18b20Bus::level(uint64_t t)
+{
+    for (Sensor &s : dev_)
+        if (connected(s) && t >= s.pull_from && t < s.pull_to)
+            return false;
+    return true;
+}
+
+void Ds18b20Bus::reset(Sensor &s, uint64_t t)
+{
+    finish(s, t);
+    s.state = ROM_CMD;
+    s.bit = 0;
+    s.in[0] = 0;
+    s.sent = false;
+    s.reading_pad = false;
+    s.pull_from = t + PRESENCE_WAIT;
+    s.pull_to = s.pull_from + PRESENCE_NS;
+}
+
+bool Ds18b20Bus::sending(const Sensor &s) const
+{
+    switch (s.state)
+    {
+    case READ_ROM:
+    case SEND:
+    case STATUS:
+        return true;
+    case SEARCH:
+        return s.bit % 3 != 2;
+    default:
+        return false;
+    }
+}
+
+bool Ds18b20Bus::send_bit(Sensor &s, uint64_t t)
+{
+    bool b = true;
+
+    switch (s.state)
+    {
+    case READ_ROM:
+        b = rom_bit(s.rom, s.bit);
+        if (++s.bit == 64)
+        {
+            s.state = FUNC_CMD;
+            s.bit = 0;
+            s.in[0] = 0;
+        }
+        break;
+    case SEARCH:
+        b = rom_bit(s.rom, s.bit / 3) ^ (s.bit % 3 == 1);
+        ++s.bit;
+        break;
+    case SEND:
+        if (s.bit < s.out.size() * 8)
+        {
+            b = (s.out[s.bit / 8] >> (s.bit % 8)) & 1;
+            if (++s.bit == s.out.size() * 8 && s.reading_pad)
+            {
+                last_read_.sensor = static_cast<int>(&s - dev_.data());
+                last_read_.at = t;
+                last_read_.converted = s.converted;
+                ++reads_;
+            }
+        }
+        break;
+    case STATUS:
+        b = t >= s.busy_until && !s.conv_end;
+        break;
+    default:
+        break;
+    }
+    return b;
+}
+
+void Ds18b20Bus::receive_bit(Sensor &s, uint64_t t, bool b)
+{
+    switch (s.state)
+    {
+    case ROM_CMD:
+    case FUNC_CMD:
+    case MATCH_ROM:
+    case WRITE_PAD:
+        if (s.bit % 8 == 0)
+            s.in[s.bit / 8] = 0;
+        s.in[s.bit / 8] |= b << (s.bit % 8);
+        ++s.bit;
+        break;
+    case SEARCH:
+        if (b != rom_bit(s.rom, s.bit / 3))
+            s.state = IDLE;     // another sensor's branch
+        else if (++s.bit == 64 * 3)
+        {
+            s.state = FUNC_CMD;
+            s.bit = 0;
+        }
+        return;
+    default:
+        return;
+    }
+
+    if (s.state == ROM_CMD && s.bit == 8)
+        rom_command(s, s.in[0]);
+    else if (s.state == FUNC_CMD && s.bit == 8)
+        function_command(s, t, s.in[0]);
+    else if (s.state == MATCH_ROM && s.bit == 64)
+    {
+        s.state = memcmp(s.in, s.rom, 8) == 0 ? FUNC_CMD : IDLE;
+        s.bit = 0;
+    }
+    else if (s.state == WRITE_PAD && s.bit == 24)
+    {
+        s.pad[2] = s.in[0];
+        s.pad[3] = s.in[1];
+        s.pad[4] = (s.in[2] & 0x60) | 0x1F;
+        s.pad[8] = owire_crc8(s.pad, 8);
+        s.state = IDLE;
+    }
+}
+
+void Ds18b20Bus::rom_command(Sensor &s, uint8_t cmd)
+{
+    int temp = static_cast<int16_t>(s.pad[1] << 8 | s.pad[0]) >> 4;
+
+    s.bit = 0;
+    switch (cmd)
+    {
+    case 0x33:  // read ROM
+        s.state = READ_ROM;
+        break;
+    case 0x55:  // match ROM
+        s.state = MATCH_ROM;
+        break;
+    case 0xCC:  // skip ROM
+        s.state = FUNC_CMD;
+        break;
+    case 0xF0:  // search ROM
+        s.state = SEARCH;
+        break;
+    case 0xEC:  // alarm search
+        s.state = temp >= static_cast<int8_t>(s.pad[2]) ||
+                  temp <= static_cast<int8_t>(s.pad[3]) ? SEARCH : IDLE;
+        break;
+    default:
+        s.state = IDLE;
+        break;
+    }
+}
+
+void Ds18b20Bus::function_command(Sensor &s, uint64_t t, uint8_t cmd)
+{
+    uint8_t power;
+
+    s.bit = 0;
+    switch (cmd)
+    {
+    case 0x44:  // convert T
+        s.conv_end = t + conv_ns[(s.pad[4] >> 5) & 3];
+        s.busy_until = s.conv_end;
+        s.state = STATUS;
+        break;
+    case 0xBE:  // read scratchpad
+        send(s, s.pad, sizeof s.pad);
+        s.reading_pad = true;
+        break;
+    case 0x4E:  // write scratchpad
+        s.state = WRITE_PAD;
+        break;
+    case 0x48:  // copy scratchpad
+        memcpy(s.ee, s.pad + 2, sizeof s.ee);
+        s.busy_until = t + COPY_NS;
+        s.state = STATUS;
+        break;
+    case 0xB8:  // recall EEPROM
+        memcpy(s.pad + 2, s.ee, sizeof s.ee);
+        s.pad[8] = owire_crc8(s.pad, 8);
+        s.busy_until = t;
+        s.state = STATUS;
+        break;
+    case 0xB4:  // read power supply: a parasite powered sensor pulls the slot low
+        power = s.parasite ? 0xFE : 0xFF;
+        send(s, &power, 1);
+        break;
+    default:
+        s.state = IDLE;
+        break;
+    }
+}
+
+void Ds18b20Bus::send(Sensor &s, const uint8_t *data, size_t len)
+{
+    s.out.assign(data, data + len);
+    s.reading_pad = false;
+    s.state = SEND;
+    s.bit = 0;
+}
@@ -0,0 +1,118 @@
+/*
+ * File:   ds18b20_bus.hpp
+ * Author: Kevin Macksamie
+ *
+ * 1-Wire bus with DS18B20 sensors on it, driven from the master's pin.
+ * Slots are told apart by how long the master holds the bus low: 400 us
+ * or more is a reset, under 15 us a 1 or a read slot, anything else a 0.
+ * A sensor with a bit to send holds the bus low for 30 us from the start
+ * of the slot when the bit is 0, so several sensors answer as a wired AND,
+ * which is what makes the search work.
+ *
+ * Each sensor's temperature ramps from its own starting point, so every
+ * conversion gives a new reading.
+ */
+#ifndef DS18B20_BUS_HPP
+#define DS18B20_BUS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class Ds18b20Bus
+{
+public:
+    /* What the master does with the pin */
+    enum Drive { RELEASED, LOW, HIGH };
+
+    /* Segment argument of connect(): every sensor, or none */
+    static const int ALL = -1;
+    static const int NONE = -2;
+
+    /*
+     * Add a sensor at celsius, rising by ramp degrees per second. Sensors
+     * on another segment than the connected one do not see the bus.
+     */
+    void add(double celsius, double ramp, bool parasite, int segment);
+
+    void drive(uint64_t t, Drive d);
+    void connect(uint64_t t, int segment);
+
+    /* Level at time t while the master lets go of the bus */
+    bool level(uint64_t t);
+
+    size_t sensors() const { return dev_.size(); }
+
+    /* Last complete scratchpad read: sensor, end of the read, end of its conversion */
+    struct Read
+    {
+        int sensor = -1;
+        uint64_t at = 0;
+        uint64_t converted = 0;
+    };
+    const Read &last_read() const { return last_read_; }
+
+    uint64_t resets() const { return resets_; }
+    uint64_t slots() const { return slots_; }
+    uint64_t conversions() const { return conversions_; }
+    uint64_t reads() const { return reads_; }
+    uint64_t brownouts() const { return brownouts_; }   // parasite sensors left without the pullup
+
+private:
+    enum State
+    {
+        IDLE,           // waiting for a reset
+        ROM_CMD,        // receiving a ROM command
+        READ_ROM,       // sending the ROM
+        MATCH_ROM,      // receiving a ROM to compare
+        SEARCH,         // bit, complement, direction for every ROM bit
+        FUNC_CMD,       // receiving a function command
+        SEND,           // sending out[], then ones
+        WRITE_PAD,      // receiving TH, TL and configuration
+        STATUS,         // sending 0 until busy_until, then 1
+    };
+
+    struct Sensor
+    {
+        uint8_t rom[8];
+        bool parasite;
+        int segment;
+        double celsius, ramp;
+
+        uint8_t pad[9];
+        uint8_t ee[3];              // TH, TL, configuration
+        uint64_t conv_end = 0;      // conversion in progress until, 0 if none
+        uint64_t converted = 0;     // end of the conversion now in pad[]
+        uint64_t busy_until = 0;
+
+        State state = IDLE;
+        unsigned bit = 0;           // position in the current state
+        uint8_t in[8];
+        std::vector<uint8_t> out;
+        bool sent = false;          // the current slot was one of ours
+        bool reading_pad = false;   // out[] is the scratchpad
+        uint64_t pull_from = 0, pull_to = 0;
+    };
+
+    std::vector<Sensor> dev_;
+    int segment_ = ALL;
+    Drive drive_ = RELEASED;
+    uint64_t fall_ = 0;
+    Read last_read_;
+    uint64_t resets_ = 0, slots_ = 0, conversions_ = 0, reads_ = 0, brownouts_ = 0;
+
+    bool connected(const Sensor &s) const;
+    void finish(Sensor &s, uint64_t t);
+    void reset(Sensor &s, uint64_t t);
+    bool sending(const Sensor &s) const;
+    bool send_bit(Sensor &s, uint64_t t);
+    void receive_bit(Sensor &s, uint64_t t, bool b);
+    void rom_command(Sensor &s, uint8_t cmd);
+    void function_command(Sensor &s, uint64_t t, uint8_t cmd);
+    void send(Sensor &s, const uint8_t *data, size_t len);
+};
+
+/* Dallas/Maxim CRC8 (x^8 + x^5 + x^4 + 1) */
+uint8_t owire_crc8(const uint8_t *data, size_t len);
+
+#endif
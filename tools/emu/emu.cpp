@@ -0,0 +1,550 @@
+/*
+ * File:   emu.cpp
+ * Author: Kevin Macksamie
+ *
+ * Runs the temp_sensor firmware, main() and all, on the host against a
+ * simulated board: the USART on a pseudo-terminal, an HD44780 on PORTB
+ * drawn in the terminal, DS18B20 sensors on the 1-Wire bus at RC4 and a
+ * button on RB0. Time is virtual, kept by the register model in mcu.cpp,
+ * so a run gives the same numbers on any host.
+ *
+ *   emu [-D seconds] [-r] [-k keys] [-n sensors] [-P parasite_mask]
+ *       [-g segments] [-T degC_per_min] [-b button_ms] [-e eeprom]
+ *       [-o uart_out] [-p link] [-q]
+ *
+ * The LCD goes to stdout: redrawn in place on a terminal, otherwise one
+ * line per change with the virtual time. Everything else goes to stderr,
+ * starting with the terminal side of the UART, which telemdec or a
+ * terminal program can open; -p also links it. -o copies what the UART
+ * sends to a file.
+ *
+ *   emu -r -p /tmp/node & telemdec /tmp/node
+ *
+ * -D is the virtual run time, 10 s by default, 0 to run until SIGINT. -r
+ * paces the run to the wall clock, without it the emulator runs as fast
+ * as it can. -k is what arrives on the UART first, "\r" by default to get
+ * past the welcome screen; \r, \n and \xHH are understood. Sensors start
+ * at 20, 21.5, 23 ... degC and ramp at -T, 6 degC/min by default; -P
+ * makes sensor n parasite powered when bit n is set and -g spreads them
+ * over that many bus segments, which needs a firmware built with
+ * OWIRE_SEGMENTS. -b presses the button every button_ms. -e keeps the
+ * data EEPROM in a file across runs.
+ *
+ * The report at the end covers interrupt latency, main loop and task
+ * jitter, the time from a sensor's conversion to the LCD showing it, and
+ * UART bytes lost anywhere between the line and the firmware. Code
+ * between two hooks costs no time (see mcu.hpp), so times are lower
+ * bounds except for busy waits, which are exact.
+ */
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "ds18b20_bus.hpp"
+#include "fw_probe.h"
+#include "hd44780.hpp"
+#include "mcu.hpp"
+#include "serial_port.hpp"
+
+using mcu::ns_t;
+using mcu::NEVER;
+
+#ifndef SER_BAUD
+#define SER_BAUD            115200
+#endif
+
+#define MS                  1000000ull
+#define TICK_NS             (1 * MS)        // board housekeeping, and pacing with -r
+#define SETTLE_NS           (10 * MS)       // LCD quiet this long before a frame is drawn
+#define PRESS_NS            (20 * MS)       // button held down
+#define REDRAW_WALL_NS      (33 * MS)       // live LCD redraws at most this often
+
+/* Time measurements of one kind */
+struct Spread
+{
+    std::vector<ns_t> v;
+
+    void add(ns_t x) { v.push_back(x); }
+
+    /* "n, min/mean/p99/max unit" */
+    std::string str(double scale, const char *unit)
+    {
+        char buf[128];
+        if (v.empty())
+            return "none";
+        std::sort(v.begin(), v.end());
+        double sum = 0;
+        for (ns_t x : v)
+            sum += x;
+        snprintf(buf, sizeof buf, "%zu, min/mean/p99/max %.1f/%.1f/%.1f/%.1f %s", v.size(),
+                 v.front() / scale, sum / v.size() / scale, v[(v.size() * 99 + 99) / 100 - 1] / scale,
+                 v.back() / scale, unit);
+        return buf;
+    }
+};
+
+/* One scheduler task as seen from the hooks */
+struct Task
+{
+    emu_task_t fw;
+    ns_t started = NEVER;
+    Spread jitter;          // start to start, against the period
+    ns_t run_max = 0;
+};
+
+static ns_t duration = 10000 * MS;
+static bool realtime, quiet;
+static std::string keys = "\r";
+static size_t key_pos;
+
+static Hd44780 lcd(16, 2);
+static Ds18b20Bus bus;
+static bool button = true;          // RB0 level, pulled up
+static ns_t button_period, button_next = NEVER;
+
+static int pty = -1, pty_slave = -1;
+static FILE *uart_out;
+static std::string eeprom_file;
+static uint8_t eeprom[256];
+
+static ns_t tick = 0;
+static struct timespec wall_start;
+static volatile sig_atomic_t stop;
+
+/* Metrics */
+static std::vector<Task> tasks;
+static const void *loop_fn;
+static ns_t loop_last = NEVER;
+static Spread loop_gap;
+static Spread from_conversion, from_read;
+static uint64_t superseded, pty_full;
+static int shown_temp;
+static bool sample_pending, display_was_dirty;
+static Ds18b20Bus::Read sample;
+
+/* LCD frames */
+static bool tty;
+static uint64_t drawn_updates;
+static ns_t drawn_wall;
+static bool drawn_once;
+
+static void on_signal(int)
+{
+    stop = 1;
+}
+
+static ns_t wall_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ns_t(ts.tv_sec - wall_start.tv_sec) * 1000000000 + ts.tv_nsec - wall_start.tv_nsec;
+}
+
+/* Backslash escapes of -k */
+static std::string unescape(const char *s)
+{
+    std::string out;
+    while (*s)
+    {
+        if (*s != '\\' || !s[1])
+        {
+            out += *s++;
+            continue;
+        }
+        ++s;
+        switch (*s)
+        {
+        case 'r':   out += '\r'; ++s; break;
+        case 'n':   out += '\n'; ++s; break;
+        case 'x':   out += static_cast<char>(strtoul(s + 1, const_cast<char **>(&s), 16)); break;
+        default:    out += *s++; break;
+        }
+    }
+    return out;
+}
+
+static void draw(ns_t t, bool force)
+{
+    if (quiet || (!force && (lcd.updates() == drawn_updates || t - lcd.last_update() < SETTLE_NS)))
+        return;
+    if (tty && !force && drawn_once && wall_ns() - drawn_wall < REDRAW_WALL_NS)
+        return;
+
+    std::string rule(lcd.cols(), '-');
+    drawn_updates = lcd.updates();
+    drawn_wall = wall_ns();
+    if (tty)
+    {
+        if (drawn_once)
+            printf("\033[%uA", lcd.lines() + 2);
+        printf("+%s+ %10.3f s\n", rule.c_str(), t / 1e9);
+        for (unsigned r = 0; r < lcd.lines(); r++)
+            printf("|%s|\n", lcd.row(r).c_str());
+        printf("+%s+\n", rule.c_str());
+    }
+    else
+    {
+        printf("%10.3f ", t / 1e9);
+        for (unsigned r = 0; r < lcd.lines(); r++)
+            printf("|%s", lcd.row(r).c_str());
+        printf("|\n");
+    }
+    fflush(stdout);
+    drawn_once = true;
+}
+
+static void report()
+{
+    const mcu::Stats &s = mcu::stats;
+    emu_counters_t fw;
+    double virt = mcu::now / 1e9, wall = wall_ns() / 1e9;
+    Spread latency;
+
+    emu_fw_counters(&fw);
+    for (uint32_t x : s.latency_ns)
+        latency.add(x);
+
+    fprintf(stderr, "\nvirtual %.3f s in %.3f s wall (%.1fx)\n", virt, wall, virt / std::max(wall, 1e-6));
+    fprintf(stderr, "interrupts      %llu, latency %s, longest ISR %.1f us (firmware %u cycles)\n",
+            (unsigned long long) s.interrupts, latency.str(1e3, "us").c_str(), s.isr_max / 1e3,
+            fw.isr_max_cycles);
+    fprintf(stderr, "main loop       passes %s\n", loop_gap.str(1e6, "ms apart").c_str());
+    for (size_t i = 0; i < tasks.size(); i++)
+    {
+        Task &k = tasks[i];
+        emu_fw_task(static_cast<unsigned char>(i), &k.fw);
+        fprintf(stderr, "task %zu%s  %5u ms, late %u, run max %.2f ms (firmware %u ticks), jitter %s\n",
+                i, i == emu_fw_display_task() ? " (display)" : "", k.fw.period, k.fw.late,
+                k.run_max / 1e6, k.fw.worst, k.jitter.str(1e6, "ms").c_str());
+    }
+    fprintf(stderr, "sample to LCD   from conversion %s\n", from_conversion.str(1e6, "ms").c_str());
+    fprintf(stderr, "                from read %s, superseded %llu\n",
+            from_read.str(1e6, "ms").c_str(), (unsigned long long) superseded);
+    fprintf(stderr, "uart            tx %llu, rx %llu; lost: overrun %llu, asleep %llu, rx ring %u, pty full %llu\n",
+            (unsigned long long) s.tx_bytes, (unsigned long long) s.rx_bytes,
+            (unsigned long long) s.rx_overruns, (unsigned long long) s.rx_lost_asleep,
+            fw.ser_rx_dropped, (unsigned long long) pty_full);
+    fprintf(stderr, "dropped         telemetry %u, deferred events %u, sample log %u\n",
+            fw.telem_dropped, fw.defer_dropped, fw.samplelog_dropped);
+    fprintf(stderr, "lcd             instructions %llu, characters %llu, busy violations %llu (worst %.1f us early)\n",
+            (unsigned long long) lcd.instructions(), (unsigned long long) lcd.characters(),
+            (unsigned long long) lcd.violations(), lcd.worst_early_ns() / 1e3);
+    fprintf(stderr, "1-wire          resets %llu, slots %llu, conversions %llu, reads %llu, brownouts %llu; "
+            "firmware: no presence %u, shorts %u, search errors %u\n",
+            (unsigned long long) bus.resets(), (unsigned long long) bus.slots(),
+            (unsigned long long) bus.conversions(), (unsigned long long) bus.reads(),
+            (unsigned long long) bus.brownouts(), fw.no_presence, fw.bus_shorts, fw.search_errors);
+    fprintf(stderr, "eeprom          writes %llu, refused %llu\n",
+            (unsigned long long) s.ee_writes, (unsigned long long) s.ee_refused);
+    fprintf(stderr, "sleep           %llu times, %.1f%% of the time; stalls %llu (%.3f ms)\n",
+            (unsigned long long) s.sleeps, mcu::now ? 100.0 * s.asleep / mcu::now : 0.0,
+            (unsigned long long) s.stalls, s.stalled / 1e6);
+}
+
+static void finish(int status)
+{
+    draw(mcu::now, true);
+    report();
+    if (!eeprom_file.empty())
+    {
+        FILE *f = fopen(eeprom_file.c_str(), "wb");
+        if (!f || fwrite(mcu::eeprom(), 1, 256, f) != 256)
+            fprintf(stderr, "emu: %s: %s\n", eeprom_file.c_str(), strerror(errno));
+        if (f)
+            fclose(f);
+    }
+    if (uart_out)
+        fclose(uart_out);
+    exit(status);
+}
+
+void board_pins(ns_t t, int port, uint8_t latch, uint8_t tris)
+{
+    uint8_t out = latch & ~tris;
+
+    if (port == mcu::PORT_B)
+    {
+        lcd.pins(t, out & 0x04, out & 0x02, out & 0x08, out >> 4);
+    }
+    else if (port == mcu::PORT_C)
+    {
+#ifdef OWIRE_SEGMENTS
+        // decoder outputs on RC0-2, enabled by RC3
+        bus.connect(t, (out & 0x08) ? out & 0x07 : Ds18b20Bus::NONE);
+#endif
+        if (tris & 0x10)
+            bus.drive(t, Ds18b20Bus::RELEASED);
+        else
+            bus.drive(t, (latch & 0x10) ? Ds18b20Bus::HIGH : Ds18b20Bus::LOW);
+    }
+}
+
+uint8_t board_inputs(ns_t t, int port)
+{
+    if (port == mcu::PORT_B)
+        return 0xFE | button;
+    if (port == mcu::PORT_C)
+        return bus.level(t) ? 0xFF : 0xEF;
+    return 0;
+}
+
+void board_tx(ns_t, uint8_t byte)
+{
+    if (uart_out)
+        fputc(byte, uart_out);
+    if (write(pty, &byte, 1) != 1)
+        ++pty_full;
+}
+
+int board_rx(ns_t)
+{
+    uint8_t c;
+
+    if (key_pos < keys.size())
+        return static_cast<uint8_t>(keys[key_pos++]);
+    if (read(pty, &c, 1) == 1)
+        return c;
+    return -1;
+}
+
+void board_call(ns_t t, const void *fn, bool enter)
+{
+    unsigned char n = emu_fw_tasks();
+    int temp;
+
+    if (n != tasks.size())
+    {
+        tasks.resize(n);
+        for (unsigned char i = 0; i < n; i++)
+            emu_fw_task(i, &tasks[i].fw);
+    }
+
+    if (enter && fn == loop_fn)
+    {
+        if (loop_last != NEVER)
+            loop_gap.add(t - loop_last);
+        loop_last = t;
+    }
+
+    for (size_t i = 0; i < tasks.size(); i++)
+    {
+        Task &k = tasks[i];
+        if (fn != k.fw.fn)
+            continue;
+        if (enter)
+        {
+            // the period command and low-power mode change periods
+            emu_fw_task(static_cast<unsigned char>(i), &k.fw);
+            if (k.started != NEVER)
+            {
+                int64_t d = int64_t(t - k.started) - int64_t(k.fw.period * MS);
+                k.jitter.add(static_cast<ns_t>(d < 0 ? -d : d));
+            }
+            k.started = t;
+            if (i == emu_fw_display_task())
+                display_was_dirty = emu_fw_display_dirty();
+        }
+        else
+        {
+            k.run_max = std::max(k.run_max, t - k.started);
+            if (i == emu_fw_display_task() && sample_pending && display_was_dirty && !emu_fw_display_dirty())
+            {
+                // drawn: sampler_read() published right after its read
+                if (sample.converted)
+                    from_conversion.add(t - sample.converted);
+                from_read.add(t - sample.at);
+                sample_pending = false;
+            }
+        }
+    }
+
+    temp = emu_fw_display_temp();
+    if (temp != shown_temp)
+    {
+        shown_temp = temp;
+        if (sample_pending)
+            ++superseded;
+        sample = bus.last_read();
+        sample_pending = !emu_fw_welcome();
+    }
+}
+
+ns_t board_next()
+{
+    return std::min(tick, button_next);
+}
+
+void board_event(ns_t t)
+{
+    if (t >= button_next)
+    {
+        button = !button;
+        mcu::rb0(t, button);
+        button_next = button ? button_next - PRESS_NS + button_period : t + PRESS_NS;
+    }
+    if (t < tick)
+        return;
+    tick = t + TICK_NS;
+
+    draw(t, false);
+    if (realtime)
+    {
+        struct timespec due = wall_start;
+        due.tv_sec += t / 1000000000;
+        due.tv_nsec += t % 1000000000;
+        if (due.tv_nsec >= 1000000000)
+        {
+            due.tv_nsec -= 1000000000;
+            ++due.tv_sec;
+        }
+        // the stall watch's signal cuts sleeps short
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, nullptr) == EINTR)
+            continue;
+    }
+    if (stop || (duration && t >= duration))
+        finish(0);
+}
+
+void board_fault(const char *what)
+{
+    fprintf(stderr, "emu: %s at %.6f s, the device would reset\n", what, mcu::now / 1e9);
+    finish(1);
+}
+
+static bool open_pty(const std::string &link)
+{
+    pty = posix_openpt(O_RDWR | O_NOCTTY);
+    if (pty < 0 || grantpt(pty) < 0 || unlockpt(pty) < 0)
+        return false;
+    const char *name = ptsname(pty);
+    if (!name)
+        return false;
+
+    // raw mode is set on the terminal side, which stays open so it stays raw
+    pty_slave = serial::open_port(name, SER_BAUD);
+    if (pty_slave < 0)
+        return false;
+    fcntl(pty, F_SETFL, fcntl(pty, F_GETFL) | O_NONBLOCK);
+    if (!link.empty())
+    {
+        unlink(link.c_str());
+        if (symlink(name, link.c_str()) < 0)
+            return false;
+    }
+    fprintf(stderr, "emu: UART on %s\n", name);
+    return true;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-D seconds] [-r] [-k keys] [-n sensors] [-P parasite_mask] [-g segments]\n"
+            "       [-T degC_per_min] [-b button_ms] [-e eeprom] [-o uart_out] [-p link] [-q]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned sensors = 1, parasite = 0, segments = 1;
+    double ramp = 6.0;
+    std::string link;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "D:rk:n:P:g:T:b:e:o:p:qh")) != -1)
+    {
+        switch (opt)
+        {
+        case 'D':
+            duration = static_cast<ns_t>(strtod(optarg, nullptr) * 1e9);
+            break;
+        case 'r':
+            realtime = true;
+            break;
+        case 'k':
+            keys = unescape(optarg);
+            break;
+        case 'n':
+            sensors = static_cast<unsigned>(strtoul(optarg, nullptr, 10));
+            break;
+        case 'P':
+            parasite = static_cast<unsigned>(strtoul(optarg, nullptr, 0));
+            break;
+        case 'g':
+            segments = static_cast<unsigned>(strtoul(optarg, nullptr, 10));
+            break;
+        case 'T':
+            ramp = strtod(optarg, nullptr);
+            break;
+        case 'b':
+            button_period = strtoull(optarg, nullptr, 10) * MS;
+            break;
+        case 'e':
+            eeprom_file = optarg;
+            break;
+        case 'o':
+            uart_out = fopen(optarg, "wb");
+            if (!uart_out)
+            {
+                fprintf(stderr, "%s: %s: %s\n", argv[0], optarg, strerror(errno));
+                return 1;
+            }
+            break;
+        case 'p':
+            link = optarg;
+            break;
+        case 'q':
+            quiet = true;
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (!segments || segments > 8 || (button_period && button_period <= PRESS_NS) || optind != argc)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    for (unsigned i = 0; i < sensors; i++)
+        bus.add(20.0 + 1.5 * i, ramp / 60.0, (parasite >> i) & 1, static_cast<int>(i % segments));
+
+    memset(eeprom, 0xFF, sizeof eeprom);
+    if (!eeprom_file.empty())
+    {
+        FILE *f = fopen(eeprom_file.c_str(), "rb");
+        if (f)
+        {
+            if (fread(eeprom, 1, sizeof eeprom, f) != sizeof eeprom)
+                memset(eeprom, 0xFF, sizeof eeprom);
+            fclose(f);
+        }
+    }
+
+    if (!open_pty(link))
+    {
+        fprintf(stderr, "%s: pty: %s\n", argv[0], strerror(errno));
+        return 1;
+    }
+
+    tty = isatty(STDOUT_FILENO);
+    loop_fn = emu_fw_loop_fn();
+    shown_temp = emu_fw_display_temp();
+    if (button_period)
+        button_next = button_period;
+    clock_gettime(CLOCK_MONOTONIC, &wall_start);
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    mcu::reset(eeprom);
+    mcu::watch_stalls();
+    emu_fw_main();
+    fprintf(stderr, "emu: main() returned\n");
+    finish(1);
+}
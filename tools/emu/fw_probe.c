@@ -0,0 +1,86 @@
+/*
+ * File:   fw_probe.c
+ * Author: Kevin Macksamie
+ *
+ * Reads firmware globals for the emulator; see fw_probe.h. Built without
+ * the profiling hooks, so reading them costs the firmware no virtual time.
+ */
+#include <xc.h>
+#include "defer.h"
+#include "ds18b20.h"
+#include "owire.h"
+#include "samplelog.h"
+#include "sched.h"
+#include "ser.h"
+#include "telem.h"
+#include "temp.h"
+#include "fw_probe.h"
+
+/* main.c globals, not declared in any header */
+extern temp_t display_temp;
+extern unsigned char display_dirty;
+extern unsigned char welcome;
+extern unsigned char display_task_idx;
+
+/* main() is renamed for the host build */
+int fw_main(void);
+
+unsigned char emu_fw_tasks(void)
+{
+    return sched_num_tasks;
+}
+
+void emu_fw_task(unsigned char i, emu_task_t *task)
+{
+    task->fn = (const void *) sched_tasks[i].fn;
+    task->period = sched_tasks[i].period;
+    task->worst = sched_tasks[i].worst;
+    task->late = sched_tasks[i].late;
+}
+
+unsigned char emu_fw_display_task(void)
+{
+    return display_task_idx;
+}
+
+/* defer_dispatch() runs once per pass of the main loop */
+const void *emu_fw_loop_fn(void)
+{
+    return (const void *) defer_dispatch;
+}
+
+int emu_fw_display_temp(void)
+{
+    return display_temp;
+}
+
+unsigned char emu_fw_display_dirty(void)
+{
+    return display_dirty;
+}
+
+unsigned char emu_fw_welcome(void)
+{
+    return welcome;
+}
+
+void emu_fw_counters(emu_counters_t *c)
+{
+    c->ser_rx_dropped = ser_rx_dropped;
+    c->telem_dropped = telem_dropped;
+    c->defer_dropped = defer_dropped;
+#ifdef SAMPLE_LOG
+    c->samplelog_dropped = samplelog_dropped;
+#else
+    c->samplelog_dropped = 0;
+#endif
+    c->isr_max_cycles = defer_isr_max;
+    c->no_presence = owire_no_presence;
+    c->bus_shorts = owire_shorts;
+    c->search_errors = ds18b20_search_errors;
+}
+
+int emu_fw_main(void)
+{
+    return fw_main();
+}
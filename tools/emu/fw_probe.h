@@ -0,0 +1,52 @@
+/*
+ * File:   fw_probe.h
+ * Author: Kevin Macksamie
+ *
+ * Firmware state the emulator reports on. fw_probe.c is built with the
+ * firmware's headers and flags, so the emulator itself does not depend on
+ * the firmware's types.
+ */
+#ifndef FW_PROBE_H
+#define FW_PROBE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* One scheduler task */
+typedef struct
+{
+    const void *fn;         /* task body, as passed to the profiling hooks */
+    unsigned period;        /* ticks between releases */
+    unsigned worst;         /* longest run time seen by the scheduler */
+    unsigned late;          /* releases that started past their deadline */
+} emu_task_t;
+
+/* Counters the firmware keeps */
+typedef struct
+{
+    unsigned ser_rx_dropped;
+    unsigned telem_dropped;
+    unsigned defer_dropped;
+    unsigned samplelog_dropped;
+    unsigned isr_max_cycles;
+    unsigned no_presence;
+    unsigned bus_shorts;
+    unsigned search_errors;
+} emu_counters_t;
+
+unsigned char emu_fw_tasks(void);
+void emu_fw_task(unsigned char i, emu_task_t *task);
+unsigned char emu_fw_display_task(void);
+const void *emu_fw_loop_fn(void);
+int emu_fw_display_temp(void);
+unsigned char emu_fw_display_dirty(void);
+unsigned char emu_fw_welcome(void);
+void emu_fw_counters(emu_counters_t *c);
+int emu_fw_main(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,185 @@
+/*
+ * File:   hd44780.cpp
+ * Author: Kevin Macksamie
+ *
+ * DDRAM is kept as the controller addresses it: line 1 at 0x00-0x27 and
+ * line 2 at 0x40-0x67 in two line mode, 0x00-0x4F in one line mode. Rows
+ * 3 and 4 of a four line panel continue lines 1 and 2. Characters are
+ * shown from the A00 (Japanese) character ROM.
+ */
+#include "hd44780.hpp"
+
+Hd44780::Hd44780(unsigned cols, unsigned lines) : cols_(cols), lines_(lines)
+{
+    for (uint8_t &c : ddram_)
+        c = ' ';
+}
+
+void Hd44780::pins(uint64_t t, bool rs, bool rw, bool en, uint8_t data)
+{
+    bool fall = en_ && !en;
+
+    en_ = en;
+    if (!fall || rw)
+        return;
+
+    if (!four_bit_)
+    {
+        // 8-bit mode: the nibble is D7..D4 of a whole instruction
+        latch(t, rs, static_cast<uint8_t>(data << 4));
+        return;
+    }
+    if (!low_next_)
+    {
+        high_ = static_cast<uint8_t>(data << 4);
+        low_next_ = true;
+        if (t < busy_until_)
+        {
+            ++violations_;
+            if (busy_until_ - t > worst_early_)
+                worst_early_ = busy_until_ - t;
+        }
+        return;
+    }
+    low_next_ = false;
+    latch(t, rs, static_cast<uint8_t>(high_ | (data & 0x0F)));
+}
+
+void Hd44780::latch(uint64_t t, bool rs, uint8_t byte)
+{
+    uint64_t exec = EXEC_NS;
+
+    if (!four_bit_ && t < busy_until_)
+    {
+        ++violations_;
+        if (busy_until_ - t > worst_early_)
+            worst_early_ = busy_until_ - t;
+    }
+
+    if (rs)
+    {
+        ++characters_;
+        if (!cgram_)
+        {
+            if (ddram_[ac_] != byte)
+            {
+                ddram_[ac_] = byte;
+                updated(t);
+            }
+            step_ac();
+            if (shift_entry_)
+            {
+                shift_ += increment_ ? 1 : -1;
+                updated(t);
+            }
+        }
+    }
+    else
+    {
+        ++instructions_;
+        if (instruction(byte, exec))
+            updated(t);
+    }
+    busy_until_ = t + exec;
+}
+
+/* Carry out an instruction; TRUE if what is shown may have changed */
+bool Hd44780::instruction(uint8_t cmd, uint64_t &exec)
+{
+    if (cmd & 0x80)                 // set DDRAM address
+    {
+        ac_ = cmd & 0x7F;
+        cgram_ = false;
+    }
+    else if (cmd & 0x40)            // set CGRAM address
+        cgram_ = true;
+    else if (cmd & 0x20)            // function set
+    {
+        four_bit_ = !(cmd & 0x10);
+        low_next_ = false;
+        two_line_ = cmd & 0x08;
+    }
+    else if (cmd & 0x10)            // cursor or display shift
+    {
+        if (cmd & 0x08)
+        {
+            shift_ += (cmd & 0x04) ? 1 : -1;
+            return true;
+        }
+        if (cmd & 0x04)
+            step_ac();
+        else
+        {
+            increment_ = !increment_;
+            step_ac();
+            increment_ = !increment_;
+        }
+    }
+    else if (cmd & 0x08)            // display on/off control
+    {
+        display_on_ = cmd & 0x04;
+        return true;
+    }
+    else if (cmd & 0x04)            // entry mode set
+    {
+        increment_ = cmd & 0x02;
+        shift_entry_ = cmd & 0x01;
+    }
+    else if (cmd & 0x02)            // return home
+    {
+        ac_ = 0;
+        cgram_ = false;
+        shift_ = 0;
+        exec = CLEAR_NS;
+        return true;
+    }
+    else if (cmd & 0x01)            // clear display
+    {
+        for (uint8_t &c : ddram_)
+            c = ' ';
+        ac_ = 0;
+        cgram_ = false;
+        shift_ = 0;
+        increment_ = true;
+        exec = CLEAR_NS;
+        return true;
+    }
+    return false;
+}
+
+void Hd44780::step_ac()
+{
+    if (!two_line_)
+        ac_ = increment_ ? (ac_ + 1) % 80 : (ac_ + 79) % 80;
+    else if (increment_)
+        ac_ = ac_ == 0x27 ? 0x40 : ac_ == 0x67 ? 0x00 : ac_ + 1;
+    else
+        ac_ = ac_ == 0x40 ? 0x27 : ac_ == 0x00 ? 0x67 : ac_ - 1;
+}
+
+void Hd44780::updated(uint64_t t)
+{
+    ++updates_;
+    last_update_ = t;
+}
+
+std::string Hd44780::row(unsigned r) const
+{
+    std::string s;
+    unsigned len = two_line_ ? 40 : 80;
+    unsigned base = two_line_ ? (r & 1) * 0x40 : 0;
+    unsigned first = two_line_ ? (r >> 1) * cols_ : r * cols_;
+
+    for (unsigned c = 0; c < cols_; c++)
+    {
+        int pos = (static_cast<int>(first + c) + shift_) % static_cast<int>(len);
+        uint8_t ch = display_on_ ? ddram_[base + (pos < 0 ? pos + len : pos)] : ' ';
+        if (ch == 0xDF)
+            s += "\xC2\xB0";            // degree sign
+        else if (ch < 0x20 || ch > 0x7E)
+            s += '?';
+        else
+            s += static_cast<char>(ch);
+    }
+    return s;
+}
@@ -0,0 +1,69 @@
+/*
+ * File:   hd44780.hpp
+ * Author: Kevin Macksamie
+ *
+ * HD44780 controller on a 4-bit bus, as seen from its pins. A nibble is
+ * taken on the falling edge of EN. The controller starts in 8-bit mode,
+ * so the nibbles of the init sequence are instructions of their own until
+ * a function set selects 4 bits. The firmware never reads the busy flag,
+ * so anything latched while the last instruction is still executing is a
+ * timing violation; it is counted and carried out anyway.
+ */
+#ifndef HD44780_HPP
+#define HD44780_HPP
+
+#include <cstdint>
+#include <string>
+
+class Hd44780
+{
+public:
+    /* Execution times at the nominal 270 kHz oscillator */
+    static const uint64_t EXEC_NS = 37000;
+    static const uint64_t CLEAR_NS = 1520000;
+
+    Hd44780(unsigned cols, unsigned lines);
+
+    /* Pin levels at time t; data is D7..D4 */
+    void pins(uint64_t t, bool rs, bool rw, bool en, uint8_t data);
+
+    /* Text of a display row as UTF-8, blank while the display is off */
+    std::string row(unsigned r) const;
+
+    unsigned cols() const { return cols_; }
+    unsigned lines() const { return lines_; }
+
+    uint64_t instructions() const { return instructions_; }
+    uint64_t characters() const { return characters_; }
+    uint64_t violations() const { return violations_; }
+    uint64_t worst_early_ns() const { return worst_early_; }
+    uint64_t updates() const { return updates_; }       // changes to what is shown
+    uint64_t last_update() const { return last_update_; }
+
+private:
+    unsigned cols_, lines_;
+    bool en_ = false;
+    bool four_bit_ = false;
+    bool low_next_ = false;         // 4-bit mode: the next nibble is the low one
+    uint8_t high_ = 0;
+    uint64_t busy_until_ = 0;
+
+    uint8_t ddram_[128] = {};
+    uint8_t ac_ = 0;                // address counter
+    bool cgram_ = false;            // data goes to CGRAM
+    bool increment_ = true;
+    bool shift_entry_ = false;
+    bool two_line_ = true;
+    bool display_on_ = false;
+    int shift_ = 0;                 // display shift in characters
+
+    uint64_t instructions_ = 0, characters_ = 0, violations_ = 0, worst_early_ = 0;
+    uint64_t updates_ = 0, last_update_ = 0;
+
+    void latch(uint64_t t, bool rs, uint8_t byte);
+    bool instruction(uint8_t cmd, uint64_t &exec);
+    void step_ac();
+    void updated(uint64_t t);
+};
+
+#endif
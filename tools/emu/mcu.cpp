@@ -0,0 +1,781 @@
+/*
+ * File:   mcu.cpp
+ * Author: Kevin Macksamie
+ *
+ * Every register access, function entry and exit, __delay_us() and SLEEP
+ * is a hook into here. A hook first takes in whatever the firmware wrote
+ * since the last one, found by comparing each register with the value it
+ * was last handed out with, then moves virtual time on, runs the
+ * peripheral events that are due and delivers an interrupt if one is
+ * pending and enabled. Writes through a pointer, as the LCD and decoder
+ * drivers do to their port, are therefore seen at the next hook.
+ *
+ * Peripherals keep their state as event times rather than ticking:
+ *  - Timer0, Timer1 and Timer2 count from the instruction clock and stop
+ *    in sleep. Only their wraps are events.
+ *  - USART: TXREG and the shift register, a two byte receive FIFO with
+ *    overrun, timed by SPBRG and BRGH. The line is only read while the
+ *    receiver is enabled; a byte that arrives in sleep is lost.
+ *  - Data EEPROM: a write needs the EECON2 unlock sequence and takes 4 ms.
+ *  - Watchdog from the 31 kHz LFINTOSC: it wakes the MCU from sleep and is
+ *    a fault while awake.
+ */
+#include "mcu.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <cstring>
+#include <ctime>
+
+#include "xc.h"
+
+extern "C" void ISR(void);
+
+namespace mcu {
+
+ns_t now;
+Stats stats;
+
+namespace {
+
+/* INTCON */
+const uint8_t GIE_BIT = 0x80, PEIE_BIT = 0x40, T0IE_BIT = 0x20, INTE_BIT = 0x10;
+const uint8_t RBIE_BIT = 0x08, T0IF_BIT = 0x04, INTF_BIT = 0x02, RBIF_BIT = 0x01;
+/* PIR1 and PIE1 */
+const uint8_t TMR1_BIT = 0x01, TMR2_BIT = 0x02, SSP_BIT = 0x08, TX_BIT = 0x10, RC_BIT = 0x20, EE_BIT = 0x80;
+/* TXSTA, RCSTA */
+const uint8_t TRMT_BIT = 0x02, BRGH_BIT = 0x04, TXEN_BIT = 0x20, TX9_BIT = 0x40;
+const uint8_t OERR_BIT = 0x02, CREN_BIT = 0x10, RX9_BIT = 0x40, SPEN_BIT = 0x80;
+/* STATUS, OPTION_REG, EECON1 */
+const uint8_t NPD_BIT = 0x08, NTO_BIT = 0x10, INTEDG_BIT = 0x40;
+const uint8_t RD_BIT = 0x01, WR_BIT = 0x02, WREN_BIT = 0x04;
+
+const ns_t EE_WRITE_NS = 4000000;
+const ns_t STALL_CPU_NS = 100000;       // host CPU time spun without a hook
+const long STALL_TICK_NS = 50000;
+
+/* Interrupt sources whose latency is measured */
+enum { SRC_T0, SRC_INT, SRC_TMR1, SRC_TMR2, SRC_RC, SOURCES };
+
+/* A counter clocked every per ns while on, wrapping at mod */
+struct Counter
+{
+    bool on = false;
+    ns_t per = TCY_NS;
+    uint32_t mod = 256;
+    int64_t zero = 0;       // time the count was 0, while on
+    uint32_t held = 0;      // count, while off
+    ns_t next = NEVER;      // next wrap
+
+    uint32_t value(ns_t t) const
+    {
+        if (!on)
+            return held;
+        return static_cast<uint32_t>((static_cast<int64_t>(t) - zero) / static_cast<int64_t>(per) % mod);
+    }
+
+    void set(ns_t t, bool run, ns_t p, uint32_t m, uint32_t v)
+    {
+        on = run;
+        per = p;
+        mod = m;
+        held = v % m;
+        zero = static_cast<int64_t>(t) - static_cast<int64_t>(held * per);
+        next = run ? static_cast<ns_t>(zero + static_cast<int64_t>(mod * per)) : NEVER;
+    }
+};
+
+uint8_t sfr[EMU_NUM_SFRS];      // what the firmware reads and writes
+uint8_t seen[EMU_NUM_SFRS];     // each register as last handed out
+int last = -1;                  // register of the last access
+uint8_t latch[3];               // port output latches
+uint8_t pins_out[3], pins_tris[3];
+
+volatile sig_atomic_t depth;    // hooks running
+volatile sig_atomic_t in_isr;
+volatile uint64_t hooks;
+bool asleep, woke_wdt;
+
+Counter t0, t1, t2;
+unsigned t2_post;
+
+uint8_t tsr, txbuf;
+bool txfull;
+ns_t tx_done = NEVER;
+uint8_t rxfifo[2], rxbyte;
+unsigned rxn;
+ns_t rx_done = NEVER, rx_poll = NEVER;
+
+uint8_t ee[256];
+uint8_t ee_addr, ee_data;
+unsigned unlock;                // EECON2 sequence progress
+ns_t ee_done = NEVER;
+
+ns_t wdt_clear, wdt_next = NEVER;
+ns_t since[SOURCES];            // when each source's flag went up
+
+uint64_t tick_hooks;
+ns_t tick_cpu;
+
+struct Hook
+{
+    Hook()
+    {
+        ++depth;
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        ++hooks;
+    }
+    ~Hook()
+    {
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        --depth;
+    }
+};
+
+void put(int r, uint8_t v)
+{
+    sfr[r] = seen[r] = v;
+}
+
+void bits(int r, uint8_t mask, bool on)
+{
+    put(r, on ? sfr[r] | mask : sfr[r] & ~mask);
+}
+
+/* Raise an interrupt flag and note when, if its interrupt is enabled */
+void raise(int r, uint8_t mask, int src, ns_t t)
+{
+    bool enabled = r == EMU_INTCON ? (sfr[EMU_INTCON] & (mask << 3)) : (sfr[EMU_PIE1] & mask);
+    if (!(sfr[r] & mask) && enabled && src < SOURCES && since[src] == NEVER)
+        since[src] = t;
+    bits(r, mask, true);
+}
+
+bool flagged(int src)
+{
+    uint8_t ic = sfr[EMU_INTCON], p = sfr[EMU_PIR1] & sfr[EMU_PIE1];
+    switch (src)
+    {
+    case SRC_T0:    return (ic & T0IE_BIT) && (ic & T0IF_BIT);
+    case SRC_INT:   return (ic & INTE_BIT) && (ic & INTF_BIT);
+    case SRC_TMR1:  return (ic & PEIE_BIT) && (p & TMR1_BIT);
+    case SRC_TMR2:  return (ic & PEIE_BIT) && (p & TMR2_BIT);
+    default:        return (ic & PEIE_BIT) && (p & RC_BIT);
+    }
+}
+
+/* An enabled interrupt flag is up, GIE aside; this also ends SLEEP */
+bool wake_pending()
+{
+    uint8_t ic = sfr[EMU_INTCON];
+    if ((ic & T0IE_BIT) && (ic & T0IF_BIT))
+        return true;
+    if ((ic & INTE_BIT) && (ic & INTF_BIT))
+        return true;
+    if ((ic & RBIE_BIT) && (ic & RBIF_BIT))
+        return true;
+    return (ic & PEIE_BIT) && (sfr[EMU_PIE1] & sfr[EMU_PIR1]);
+}
+
+/* Timers, reconfigured from their registers keeping the count */
+void timer0(ns_t t, uint32_t v)
+{
+    uint8_t opt = sfr[EMU_OPTION_REG];
+    ns_t pre = (opt & 0x08) ? 1 : 2u << (opt & 7);
+    t0.set(t, !(opt & 0x20) && !asleep, TCY_NS * pre, 256, v);
+}
+
+void timer1(ns_t t, uint32_t v)
+{
+    uint8_t con = sfr[EMU_T1CON];
+    t1.set(t, (con & 0x01) && !(con & 0x02) && !asleep, TCY_NS << ((con >> 4) & 3), 65536, v);
+}
+
+void timer2(ns_t t, uint32_t v)
+{
+    static const ns_t pre[4] = {1, 4, 16, 16};
+    uint8_t con = sfr[EMU_T2CON];
+    t2.set(t, (con & 0x04) && !asleep, TCY_NS * pre[con & 3], sfr[EMU_PR2] + 1u, v);
+}
+
+void timers(ns_t t)
+{
+    timer0(t, t0.value(t));
+    timer1(t, t1.value(t));
+    timer2(t, t2.value(t));
+}
+
+/* USART */
+ns_t byte_ns(bool nine)
+{
+    uint64_t div = (sfr[EMU_TXSTA] & BRGH_BIT) ? 16 : 64;
+    return div * (sfr[EMU_SPBRG] + 1u) * 1000000000ull * (nine ? 11 : 10) / _XTAL_FREQ;
+}
+
+void tx_flags()
+{
+    bits(EMU_TXSTA, TRMT_BIT, tx_done == NEVER);
+    bits(EMU_PIR1, TX_BIT, (sfr[EMU_TXSTA] & TXEN_BIT) && !txfull);
+}
+
+void tx_write(uint8_t v)
+{
+    if (!(sfr[EMU_RCSTA] & SPEN_BIT) || !(sfr[EMU_TXSTA] & TXEN_BIT))
+        return;
+    if (tx_done == NEVER)
+    {
+        tsr = v;
+        tx_done = now + byte_ns(sfr[EMU_TXSTA] & TX9_BIT);
+    }
+    else
+    {
+        txbuf = v;          // overwrites an unsent byte, as TXREG would
+        txfull = true;
+    }
+    tx_flags();
+}
+
+bool rx_on()
+{
+    return (sfr[EMU_RCSTA] & (SPEN_BIT | CREN_BIT)) == (SPEN_BIT | CREN_BIT);
+}
+
+void rx_sync()
+{
+    if (!rx_on())
+        rx_done = rx_poll = NEVER;
+    else if (rx_done == NEVER && rx_poll == NEVER)
+        rx_poll = now;
+}
+
+void rx_byte(ns_t t)
+{
+    ++stats.rx_bytes;
+    if (asleep)
+        ++stats.rx_lost_asleep;
+    else if ((sfr[EMU_RCSTA] & OERR_BIT) || rxn == sizeof rxfifo)
+    {
+        bits(EMU_RCSTA, OERR_BIT, true);
+        ++stats.rx_overruns;
+    }
+    else
+    {
+        rxfifo[rxn++] = rxbyte;
+        raise(EMU_PIR1, RC_BIT, SRC_RC, t);
+    }
+}
+
+/* Watchdog period: 32 << WDTPS cycles of the 31 kHz LFINTOSC */
+void wdt_sync()
+{
+    unsigned ps = std::min((sfr[EMU_WDTCON] >> 1) & 15, 11);
+    wdt_next = (sfr[EMU_WDTCON] & 1) ? wdt_clear + (32ull << ps) * 1000000000ull / 31000 : NEVER;
+}
+
+/* Pins of a port: outputs from the latch, inputs from the board */
+void port(int p)
+{
+    uint8_t tris = sfr[EMU_TRISA + p];
+    uint8_t out = latch[p] & ~tris;
+
+    if (out != pins_out[p] || tris != pins_tris[p])
+    {
+        pins_out[p] = out;
+        pins_tris[p] = tris;
+        board_pins(now, p, latch[p], tris);
+    }
+    put(EMU_PORTA + p, out | (board_inputs(now, p) & tris));
+}
+
+ns_t next_event()
+{
+    ns_t t = std::min({t0.next, t1.next, t2.next, tx_done, rx_done, rx_poll, ee_done, wdt_next});
+    return std::min(t, board_next());
+}
+
+void run_events()
+{
+    for (;;)
+    {
+        ns_t t = next_event();
+        if (t > now)
+            return;
+
+        if (t == t0.next)
+        {
+            t0.next += t0.mod * t0.per;
+            raise(EMU_INTCON, T0IF_BIT, SRC_T0, t);
+        }
+        else if (t == t1.next)
+        {
+            t1.next += t1.mod * t1.per;
+            raise(EMU_PIR1, TMR1_BIT, SRC_TMR1, t);
+        }
+        else if (t == t2.next)
+        {
+            t2.next += t2.mod * t2.per;
+            if (++t2_post > ((sfr[EMU_T2CON] >> 3) & 15))
+            {
+                t2_post = 0;
+                raise(EMU_PIR1, TMR2_BIT, SRC_TMR2, t);
+            }
+        }
+        else if (t == tx_done)
+        {
+            board_tx(t, tsr);
+            ++stats.tx_bytes;
+            if (txfull)
+            {
+                tsr = txbuf;
+                txfull = false;
+                tx_done = t + byte_ns(sfr[EMU_TXSTA] & TX9_BIT);
+            }
+            else
+                tx_done = NEVER;
+            tx_flags();
+        }
+        else if (t == rx_done)
+        {
+            rx_byte(t);
+            rx_done = NEVER;
+            rx_poll = t;
+        }
+        else if (t == rx_poll)
+        {
+            int c = board_rx(t);
+            if (c >= 0)
+            {
+                rxbyte = static_cast<uint8_t>(c);
+                rx_done = t + byte_ns(sfr[EMU_RCSTA] & RX9_BIT);
+                rx_poll = NEVER;
+            }
+            else
+                rx_poll = t + byte_ns(false);
+        }
+        else if (t == ee_done)
+        {
+            ee[ee_addr] = ee_data;
+            ee_done = NEVER;
+            bits(EMU_EECON1, WR_BIT, false);
+            raise(EMU_PIR1, EE_BIT, SOURCES, t);
+            ++stats.ee_writes;
+        }
+        else if (t == wdt_next)
+        {
+            if (!asleep)
+                board_fault("watchdog time-out");
+            bits(EMU_STATUS, NTO_BIT, false);
+            woke_wdt = true;
+            wdt_clear = t;
+            wdt_sync();
+        }
+        else
+            board_event(t);
+    }
+}
+
+void advance(ns_t d)
+{
+    now += d;
+    run_events();
+}
+
+/* Carry out a firmware write to a register */
+void write(int r, uint8_t old, uint8_t v)
+{
+    int p;
+    uint32_t c;
+
+    switch (r)
+    {
+    case EMU_STATUS:
+        sfr[r] = (v & ~(NPD_BIT | NTO_BIT)) | (old & (NPD_BIT | NTO_BIT));
+        break;
+    case EMU_OPTION_REG:
+        timer0(now, t0.value(now));
+        break;
+    case EMU_PIR1:
+        sfr[r] = (v & ~(TX_BIT | RC_BIT)) | (old & (TX_BIT | RC_BIT));
+        break;
+    case EMU_PORTA:
+    case EMU_PORTB:
+    case EMU_PORTC:
+        p = r - EMU_PORTA;
+        latch[p] = v;
+        port(p);
+        break;
+    case EMU_TRISA:
+    case EMU_TRISB:
+    case EMU_TRISC:
+        port(r - EMU_TRISA);
+        break;
+    case EMU_TMR0:
+        timer0(now, v);
+        break;
+    case EMU_TMR1L:
+        c = t1.value(now);
+        timer1(now, (c & 0xFF00) | v);
+        break;
+    case EMU_TMR1H:
+        c = t1.value(now);
+        timer1(now, (static_cast<uint32_t>(v) << 8) | (c & 0xFF));
+        break;
+    case EMU_T1CON:
+        timer1(now, t1.value(now));
+        break;
+    case EMU_TMR2:
+        t2_post = 0;
+        timer2(now, v);
+        break;
+    case EMU_PR2:
+    case EMU_T2CON:
+        timer2(now, t2.value(now));
+        break;
+    case EMU_TXSTA:
+        tx_flags();
+        break;
+    case EMU_RCSTA:
+        sfr[r] = (v & ~OERR_BIT) | (old & OERR_BIT);
+        if ((old & CREN_BIT) && !(v & CREN_BIT))
+            sfr[r] &= ~OERR_BIT;
+        rx_sync();
+        break;
+    case EMU_TXREG:
+        tx_write(v);
+        break;
+    case EMU_RCREG:
+        sfr[r] = old;
+        break;
+    case EMU_SSPBUF:
+        // transfers finish at once, nothing is clocked in
+        if (sfr[EMU_SSPCON] & 0x20)
+        {
+            bits(EMU_SSPSTAT, 0x01, true);
+            raise(EMU_PIR1, SSP_BIT, SOURCES, now);
+        }
+        break;
+    case EMU_SSPSTAT:
+        sfr[r] = (v & ~0x01) | (old & 0x01);
+        break;
+    case EMU_EECON1:
+        if (v & RD_BIT)
+        {
+            put(EMU_EEDAT, ee[sfr[EMU_EEADR]]);
+            sfr[r] &= ~RD_BIT;
+        }
+        if ((old & WR_BIT) && !(v & WR_BIT) && ee_done != NEVER)
+            sfr[r] |= WR_BIT;           // software cannot end a write
+        else if (!(old & WR_BIT) && (v & WR_BIT))
+        {
+            if ((v & WREN_BIT) && unlock == 2)
+            {
+                ee_addr = sfr[EMU_EEADR];
+                ee_data = sfr[EMU_EEDAT];
+                ee_done = now + EE_WRITE_NS;
+            }
+            else
+            {
+                sfr[r] &= ~WR_BIT;
+                ++stats.ee_refused;
+            }
+            unlock = 0;
+        }
+        break;
+    case EMU_EECON2:
+        unlock = v == 0x55 ? 1 : (v == 0xAA && unlock == 1) ? 2 : 0;
+        break;
+    case EMU_WDTCON:
+        wdt_sync();
+        break;
+    default:
+        break;
+    }
+    seen[r] = sfr[r];
+}
+
+/* Take in what the firmware wrote since the last hook */
+void commit()
+{
+    for (int r = 0; r < EMU_NUM_SFRS; r++)
+    {
+        // every access to these is a write, even of the same value
+        bool wrote = r == last && (r == EMU_TXREG || r == EMU_EECON2);
+        if (sfr[r] != seen[r] || wrote)
+            write(r, seen[r], sfr[r]);
+    }
+    last = -1;
+}
+
+/* Bring a register up to date before it is handed out */
+void refresh(int r)
+{
+    switch (r)
+    {
+    case EMU_PORTA:
+    case EMU_PORTB:
+    case EMU_PORTC:
+        port(r - EMU_PORTA);
+        break;
+    case EMU_TMR0:
+        put(r, static_cast<uint8_t>(t0.value(now)));
+        break;
+    case EMU_TMR1L:
+        put(r, static_cast<uint8_t>(t1.value(now)));
+        break;
+    case EMU_TMR1H:
+        put(r, static_cast<uint8_t>(t1.value(now) >> 8));
+        break;
+    case EMU_TMR2:
+        put(r, static_cast<uint8_t>(t2.value(now)));
+        break;
+    case EMU_RCREG:
+        if (rxn)
+        {
+            put(r, rxfifo[0]);
+            rxfifo[0] = rxfifo[1];
+            --rxn;
+        }
+        bits(EMU_PIR1, RC_BIT, rxn != 0);
+        break;
+    case EMU_SSPBUF:
+        bits(EMU_SSPSTAT, 0x01, false);
+        break;
+    default:
+        break;
+    }
+}
+
+/* Deliver a pending interrupt; TRUE if the ISR ran */
+bool interrupt()
+{
+    if (in_isr || !(sfr[EMU_INTCON] & GIE_BIT) || !wake_pending())
+        return false;
+
+    ns_t start = now;
+    in_isr = 1;
+    for (int s = 0; s < SOURCES; s++)
+        if (flagged(s) && since[s] != NEVER)
+        {
+            stats.latency_ns.push_back(static_cast<uint32_t>(std::min<ns_t>(now - since[s], UINT32_MAX)));
+            since[s] = NEVER;
+        }
+
+    bits(EMU_INTCON, GIE_BIT, false);
+    advance(ISR_CYCLES / 2 * TCY_NS);
+    ISR();
+    commit();
+    advance(ISR_CYCLES / 2 * TCY_NS);
+    bits(EMU_INTCON, GIE_BIT, true);
+
+    for (int s = 0; s < SOURCES; s++)
+        if (!flagged(s))
+            since[s] = NEVER;
+    ++stats.interrupts;
+    stats.isr_max = std::max(stats.isr_max, now - start);
+    in_isr = 0;
+    return true;
+}
+
+ns_t cpu_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ns_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * A firmware loop with no hook in it, such as ser_putch() waiting for the
+ * ISR to make room, would spin forever. Spinning is all it would do until
+ * the next interrupt, so time is moved on to that interrupt.
+ */
+void on_tick(int)
+{
+    if (depth || in_isr)
+        return;
+    if (hooks != tick_hooks)
+    {
+        tick_hooks = hooks;
+        tick_cpu = cpu_ns();
+        return;
+    }
+    if (cpu_ns() - tick_cpu < STALL_CPU_NS)
+        return;
+
+    {
+        Hook h;
+        ns_t from = now;
+        commit();
+        ++stats.stalls;
+        while (!interrupt())
+        {
+            now = std::max(now, next_event());
+            run_events();
+        }
+        stats.stalled += now - from;
+    }
+    tick_hooks = hooks;
+    tick_cpu = cpu_ns();
+}
+
+} // namespace
+
+void reset(const uint8_t *eeprom)
+{
+    memset(sfr, 0, sizeof sfr);
+    put(EMU_STATUS, NPD_BIT | NTO_BIT);
+    put(EMU_OPTION_REG, 0xFF);
+    put(EMU_TRISA, 0xFF);
+    put(EMU_TRISB, 0xFF);
+    put(EMU_TRISC, 0xFF);
+    put(EMU_PR2, 0xFF);
+    put(EMU_TXSTA, TRMT_BIT);
+    put(EMU_WDTCON, 0x08);
+    put(EMU_LCDCON, 0x13);
+    for (int r = 0; r < EMU_NUM_SFRS; r++)
+        seen[r] = sfr[r];
+
+    now = 0;
+    last = -1;
+    asleep = woke_wdt = false;
+    memset(latch, 0, sizeof latch);
+    memset(pins_out, 0, sizeof pins_out);
+    memset(pins_tris, 0xFF, sizeof pins_tris);
+    for (int p = PORT_A; p <= PORT_C; p++)
+        port(p);
+
+    t2_post = 0;
+    timers(0);
+    txfull = false;
+    tx_done = rx_done = rx_poll = ee_done = NEVER;
+    rxn = 0;
+    unlock = 0;
+    memcpy(ee, eeprom, sizeof ee);
+    wdt_clear = 0;
+    wdt_sync();
+    std::fill(since, since + SOURCES, NEVER);
+    stats = Stats();
+}
+
+const uint8_t *eeprom()
+{
+    return ee;
+}
+
+void rb0(ns_t t, bool level)
+{
+    bool was = pins_tris[PORT_B] & sfr[EMU_PORTB] & 1;
+    bool rising = (sfr[EMU_OPTION_REG] & INTEDG_BIT) != 0;
+
+    port(PORT_B);
+    if (level != was && level == rising)
+        raise(EMU_INTCON, INTF_BIT, SRC_INT, t);
+}
+
+void watch_stalls()
+{
+    struct sigaction sa = {};
+    sa.sa_handler = on_tick;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGALRM, &sa, nullptr);
+
+    struct sigevent sev = {};
+    sev.sigev_notify = SIGEV_SIGNAL;
+    sev.sigev_signo = SIGALRM;
+    timer_t id;
+    if (timer_create(CLOCK_MONOTONIC, &sev, &id) == 0)
+    {
+        struct itimerspec its = {};
+        its.it_interval.tv_nsec = STALL_TICK_NS;
+        its.it_value.tv_nsec = STALL_TICK_NS;
+        timer_settime(id, 0, &its, nullptr);
+    }
+}
+
+} // namespace mcu
+
+using namespace mcu;
+
+extern "C" volatile unsigned char *emu_sfr(unsigned char reg)
+{
+    Hook h;
+    commit();
+    advance(SFR_CYCLES * TCY_NS);
+    interrupt();
+    refresh(reg);
+    last = reg;
+    return &sfr[reg];
+}
+
+extern "C" void emu_delay_us(unsigned long us)
+{
+    Hook h;
+    ns_t left = us * 1000ull;
+
+    commit();
+    // an interrupt stretches the delay loop by the time the ISR takes
+    while (left)
+    {
+        ns_t next = next_event();
+        ns_t step = next > now ? std::min(left, next - now) : 0;
+        now += step;
+        left -= step;
+        run_events();
+        interrupt();
+    }
+}
+
+extern "C" void emu_clrwdt(void)
+{
+    Hook h;
+    commit();
+    advance(TCY_NS);
+    bits(EMU_STATUS, NPD_BIT | NTO_BIT, true);
+    wdt_clear = now;
+    wdt_sync();
+}
+
+extern "C" void emu_sleep(void)
+{
+    Hook h;
+    commit();
+    advance(TCY_NS);
+    put(EMU_STATUS, (sfr[EMU_STATUS] & ~NPD_BIT) | NTO_BIT);
+    wdt_clear = now;
+    wdt_sync();
+    if (wake_pending())
+        return;
+
+    ns_t from = now;
+    asleep = true;
+    woke_wdt = false;
+    timers(now);
+    while (!wake_pending() && !woke_wdt)
+    {
+        now = std::max(now, next_event());
+        run_events();
+    }
+    asleep = false;
+    timers(now);
+    ++stats.sleeps;
+    stats.asleep += now - from;
+    interrupt();
+}
+
+extern "C" void __cyg_profile_func_enter(void *fn, void *)
+{
+    Hook h;
+    commit();
+    advance(CALL_CYCLES * TCY_NS);
+    board_call(now, fn, true);
+    interrupt();
+}
+
+extern "C" void __cyg_profile_func_exit(void *fn, void *)
+{
+    Hook h;
+    commit();
+    advance(RETURN_CYCLES * TCY_NS);
+    board_call(now, fn, false);
+    interrupt();
+}
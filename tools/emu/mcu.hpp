@@ -0,0 +1,85 @@
+/*
+ * File:   mcu.hpp
+ * Author: Kevin Macksamie
+ *
+ * PIC16F913 core of the emulator: the register file behind xc.h, virtual
+ * time, interrupts and the on-chip peripherals the firmware uses. The pins
+ * and the serial line belong to the board, which supplies the board_*()
+ * functions below.
+ */
+#ifndef MCU_HPP
+#define MCU_HPP
+
+#include <cstdint>
+#include <vector>
+
+#ifndef _XTAL_FREQ
+#define _XTAL_FREQ  20000000
+#endif
+
+namespace mcu {
+
+typedef uint64_t ns_t;
+const ns_t NEVER = ~ns_t(0);
+
+/* Instruction cycle, four oscillator periods */
+const ns_t TCY_NS = 4000000000ull / _XTAL_FREQ;
+
+/*
+ * Instruction cycles charged for what the emulator sees. Code between two
+ * of these points costs nothing, so every time measured is a lower bound
+ * apart from __delay_us(), which is exact.
+ */
+const unsigned SFR_CYCLES = 2;      // bank select and the access
+const unsigned CALL_CYCLES = 4;     // arguments and CALL
+const unsigned RETURN_CYCLES = 2;
+const unsigned ISR_CYCLES = 20;     // latency, context save and restore, RETFIE
+
+enum { PORT_A, PORT_B, PORT_C };
+
+struct Stats
+{
+    uint64_t interrupts = 0;
+    std::vector<uint32_t> latency_ns;   // flag raised to ISR entry
+    ns_t isr_max = 0;
+    uint64_t tx_bytes = 0;
+    uint64_t rx_bytes = 0;
+    uint64_t rx_overruns = 0;           // lost to a full receive FIFO
+    uint64_t rx_lost_asleep = 0;
+    uint64_t ee_writes = 0;
+    uint64_t ee_refused = 0;            // WR set without the unlock sequence
+    uint64_t sleeps = 0;
+    ns_t asleep = 0;
+    uint64_t stalls = 0;                // waits the emulator could not see
+    ns_t stalled = 0;
+};
+
+extern ns_t now;
+extern Stats stats;
+
+/* Power-on reset; eeprom is the 256 bytes of data EEPROM */
+void reset(const uint8_t *eeprom);
+const uint8_t *eeprom();
+
+/* Level of the RB0/INT pin */
+void rb0(ns_t t, bool level);
+
+/*
+ * Catch the firmware spinning on a variable only an interrupt changes,
+ * which the hooks cannot see: time is moved on to the next interrupt.
+ */
+void watch_stalls();
+
+} // namespace mcu
+
+/* Board side, see emu.cpp */
+void board_pins(mcu::ns_t t, int port, uint8_t latch, uint8_t tris);
+uint8_t board_inputs(mcu::ns_t t, int port);
+void board_tx(mcu::ns_t t, uint8_t byte);
+int board_rx(mcu::ns_t t);                      // next byte on the line, -1 if none
+void board_call(mcu::ns_t t, const void *fn, bool enter);
+mcu::ns_t board_next();                         // time of the next board event
+void board_event(mcu::ns_t t);
+void board_fault(const char *what);             // the device would reset
+
+#endif
@@ -0,0 +1,185 @@
+/*
+ * File:   xc.h
+ * Author: Kevin Macksamie
+ *
+ * Stand-in for the XC8 device header when the firmware is built for the
+ * host emulator, see emu.cpp. Every special function register access goes
+ * through emu_sfr(), which lets the emulator see the access, advance
+ * virtual time and deliver interrupts before handing back the register.
+ * Register and bit names are the PIC16F913 ones the firmware uses, with
+ * the bits laid out as in the data sheet.
+ */
+#ifndef EMU_XC_H
+#define EMU_XC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Registers, indexes for emu_sfr() */
+enum {
+    EMU_STATUS, EMU_OPTION_REG, EMU_INTCON, EMU_PIR1, EMU_PIE1,
+    EMU_PORTA, EMU_PORTB, EMU_PORTC, EMU_TRISA, EMU_TRISB, EMU_TRISC,
+    EMU_TMR0, EMU_TMR1L, EMU_TMR1H, EMU_T1CON, EMU_TMR2, EMU_PR2, EMU_T2CON,
+    EMU_TXSTA, EMU_RCSTA, EMU_SPBRG, EMU_TXREG, EMU_RCREG,
+    EMU_SSPBUF, EMU_SSPCON, EMU_SSPSTAT,
+    EMU_EEADR, EMU_EEDAT, EMU_EECON1, EMU_EECON2,
+    EMU_WDTCON, EMU_LCDCON,
+    EMU_NUM_SFRS
+};
+
+volatile unsigned char *emu_sfr(unsigned char reg);
+void emu_delay_us(unsigned long us);
+void emu_sleep(void);
+void emu_clrwdt(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifndef __cplusplus
+
+/* XC8 keywords and builtins */
+#define bit             unsigned char
+#define bank1
+#define bank2
+#define bank3
+#define interrupt
+#define __delay_us(x)   emu_delay_us(x)
+#define __delay_ms(x)   emu_delay_us((x) * 1000UL)
+#define NOP()           ((void) 0)
+#define CLRWDT()        emu_clrwdt()
+#define SLEEP()         emu_sleep()
+
+#define EMU_REG(r)          (*emu_sfr(EMU_##r))
+#define EMU_BITS(r)         (*(volatile r##bits_t *) emu_sfr(EMU_##r))
+
+typedef struct { unsigned char C:1, DC:1, Z:1, nPD:1, nTO:1, RP0:1, RP1:1, IRP:1; } STATUSbits_t;
+typedef struct { unsigned char PS0:1, PS1:1, PS2:1, PSA:1, T0SE:1, T0CS:1, INTEDG:1, nRBPU:1; } OPTION_REGbits_t;
+typedef struct { unsigned char RBIF:1, INTF:1, T0IF:1, RBIE:1, INTE:1, T0IE:1, PEIE:1, GIE:1; } INTCONbits_t;
+typedef struct { unsigned char TMR1IF:1, TMR2IF:1, CCP1IF:1, SSPIF:1, TXIF:1, RCIF:1, ADIF:1, EEIF:1; } PIR1bits_t;
+typedef struct { unsigned char TMR1IE:1, TMR2IE:1, CCP1IE:1, SSPIE:1, TXIE:1, RCIE:1, ADIE:1, EEIE:1; } PIE1bits_t;
+typedef struct { unsigned char RA0:1, RA1:1, RA2:1, RA3:1, RA4:1, RA5:1, RA6:1, RA7:1; } PORTAbits_t;
+typedef struct { unsigned char RB0:1, RB1:1, RB2:1, RB3:1, RB4:1, RB5:1, RB6:1, RB7:1; } PORTBbits_t;
+typedef struct { unsigned char RC0:1, RC1:1, RC2:1, RC3:1, RC4:1, RC5:1, RC6:1, RC7:1; } PORTCbits_t;
+typedef struct { unsigned char TRISA0:1, TRISA1:1, TRISA2:1, TRISA3:1, TRISA4:1, TRISA5:1, TRISA6:1, TRISA7:1; } TRISAbits_t;
+typedef struct { unsigned char TRISB0:1, TRISB1:1, TRISB2:1, TRISB3:1, TRISB4:1, TRISB5:1, TRISB6:1, TRISB7:1; } TRISBbits_t;
+typedef struct { unsigned char TRISC0:1, TRISC1:1, TRISC2:1, TRISC3:1, TRISC4:1, TRISC5:1, TRISC6:1, TRISC7:1; } TRISCbits_t;
+typedef struct { unsigned char TMR1ON:1, TMR1CS:1, nT1SYNC:1, T1OSCEN:1, T1CKPS0:1, T1CKPS1:1, TMR1GE:1, T1GINV:1; } T1CONbits_t;
+typedef struct { unsigned char T2CKPS0:1, T2CKPS1:1, TMR2ON:1, TOUTPS0:1, TOUTPS1:1, TOUTPS2:1, TOUTPS3:1, :1; } T2CONbits_t;
+typedef struct { unsigned char TX9D:1, TRMT:1, BRGH:1, :1, SYNC:1, TXEN:1, TX9:1, CSRC:1; } TXSTAbits_t;
+typedef struct { unsigned char RX9D:1, OERR:1, FERR:1, ADDEN:1, CREN:1, SREN:1, RX9:1, SPEN:1; } RCSTAbits_t;
+typedef struct { unsigned char SSPM0:1, SSPM1:1, SSPM2:1, SSPM3:1, CKP:1, SSPEN:1, SSPOV:1, WCOL:1; } SSPCONbits_t;
+typedef struct { unsigned char BF:1, UA:1, R_nW:1, S:1, P:1, D_nA:1, CKE:1, SMP:1; } SSPSTATbits_t;
+typedef struct { unsigned char RD:1, WR:1, WREN:1, WRERR:1, :3, EEPGD:1; } EECON1bits_t;
+typedef struct { unsigned char SWDTEN:1, WDTPS0:1, WDTPS1:1, WDTPS2:1, WDTPS3:1, :3; } WDTCONbits_t;
+
+#define STATUS          EMU_REG(STATUS)
+#define OPTION_REG      EMU_REG(OPTION_REG)
+#define INTCON          EMU_REG(INTCON)
+#define PIR1            EMU_REG(PIR1)
+#define PIE1            EMU_REG(PIE1)
+#define PORTA           EMU_REG(PORTA)
+#define PORTB           EMU_REG(PORTB)
+#define PORTC           EMU_REG(PORTC)
+#define TRISA           EMU_REG(TRISA)
+#define TRISB           EMU_REG(TRISB)
+#define TRISC           EMU_REG(TRISC)
+#define TMR0            EMU_REG(TMR0)
+#define TMR1L           EMU_REG(TMR1L)
+#define TMR1H           EMU_REG(TMR1H)
+#define T1CON           EMU_REG(T1CON)
+#define TMR2            EMU_REG(TMR2)
+#define PR2             EMU_REG(PR2)
+#define T2CON           EMU_REG(T2CON)
+#define TXSTA           EMU_REG(TXSTA)
+#define RCSTA           EMU_REG(RCSTA)
+#define SPBRG           EMU_REG(SPBRG)
+#define TXREG           EMU_REG(TXREG)
+#define RCREG           EMU_REG(RCREG)
+#define SSPBUF          EMU_REG(SSPBUF)
+#define SSPCON          EMU_REG(SSPCON)
+#define SSPSTAT         EMU_REG(SSPSTAT)
+#define EEADR           EMU_REG(EEADR)
+#define EEDAT           EMU_REG(EEDAT)
+#define EECON1          EMU_REG(EECON1)
+#define EECON2          EMU_REG(EECON2)
+#define WDTCON          EMU_REG(WDTCON)
+#define LCDCON          EMU_REG(LCDCON)
+
+#define STATUSbits      EMU_BITS(STATUS)
+#define OPTION_REGbits  EMU_BITS(OPTION_REG)
+#define INTCONbits      EMU_BITS(INTCON)
+#define PIR1bits        EMU_BITS(PIR1)
+#define PIE1bits        EMU_BITS(PIE1)
+#define PORTAbits       EMU_BITS(PORTA)
+#define PORTBbits       EMU_BITS(PORTB)
+#define PORTCbits       EMU_BITS(PORTC)
+#define TRISAbits       EMU_BITS(TRISA)
+#define TRISBbits       EMU_BITS(TRISB)
+#define TRISCbits       EMU_BITS(TRISC)
+#define T1CONbits       EMU_BITS(T1CON)
+#define T2CONbits       EMU_BITS(T2CON)
+#define TXSTAbits       EMU_BITS(TXSTA)
+#define RCSTAbits       EMU_BITS(RCSTA)
+#define SSPCONbits      EMU_BITS(SSPCON)
+#define SSPSTATbits     EMU_BITS(SSPSTAT)
+#define EECON1bits      EMU_BITS(EECON1)
+#define WDTCONbits      EMU_BITS(WDTCON)
+
+/* Bit names XC8 v1.x declares on their own */
+#define PSA             OPTION_REGbits.PSA
+#define T0CS            OPTION_REGbits.T0CS
+#define INTEDG          OPTION_REGbits.INTEDG
+#define INTF            INTCONbits.INTF
+#define T0IF            INTCONbits.T0IF
+#define INTE            INTCONbits.INTE
+#define T0IE            INTCONbits.T0IE
+#define PEIE            INTCONbits.PEIE
+#define GIE             INTCONbits.GIE
+#define TMR1IF          PIR1bits.TMR1IF
+#define TMR2IF          PIR1bits.TMR2IF
+#define SSPIF           PIR1bits.SSPIF
+#define TXIF            PIR1bits.TXIF
+#define RCIF            PIR1bits.RCIF
+#define EEIF            PIR1bits.EEIF
+#define TMR1IE          PIE1bits.TMR1IE
+#define TMR2IE          PIE1bits.TMR2IE
+#define SSPIE           PIE1bits.SSPIE
+#define TXIE            PIE1bits.TXIE
+#define RCIE            PIE1bits.RCIE
+#define EEIE            PIE1bits.EEIE
+#define TMR1ON          T1CONbits.TMR1ON
+#define TMR1CS          T1CONbits.TMR1CS
+#define T1OSCEN         T1CONbits.T1OSCEN
+#define T1CKPS0         T1CONbits.T1CKPS0
+#define T1CKPS1         T1CONbits.T1CKPS1
+#define TMR2ON          T2CONbits.TMR2ON
+#define T2CKPS0         T2CONbits.T2CKPS0
+#define T2CKPS1         T2CONbits.T2CKPS1
+#define TX9D            TXSTAbits.TX9D
+#define TRMT            TXSTAbits.TRMT
+#define BRGH            TXSTAbits.BRGH
+#define SYNC            TXSTAbits.SYNC
+#define TXEN            TXSTAbits.TXEN
+#define TX9             TXSTAbits.TX9
+#define RX9D            RCSTAbits.RX9D
+#define OERR            RCSTAbits.OERR
+#define FERR            RCSTAbits.FERR
+#define CREN            RCSTAbits.CREN
+#define RX9             RCSTAbits.RX9
+#define SPEN            RCSTAbits.SPEN
+#define SSPEN           SSPCONbits.SSPEN
+#define CKP             SSPCONbits.CKP
+#define BF              SSPSTATbits.BF
+#define CKE             SSPSTATbits.CKE
+#define SMP             SSPSTATbits.SMP
+#define RD              EECON1bits.RD
+#define WR              EECON1bits.WR
+#define WREN            EECON1bits.WREN
+#define EEPGD           EECON1bits.EEPGD
+#define SWDTEN          WDTCONbits.SWDTEN
+
+#endif  /* __cplusplus */
+
+#endif  /* EMU_XC_H */
@@ -0,0 +1,145 @@
+/*
+ * File:   logdict.cpp
+ * Author: Kevin Macksamie
+ *
+ * Build the log message dictionary from the firmware sources.
+ *
+ *   logdict [-o dictionary] log.h source.c ...
+ *
+ * Module numbers come from the LOG_MOD_* definitions in log.h. Every
+ * LOG/LOG1/LOG2 call found in the sources becomes one dictionary entry
+ * keyed by module and line. Two calls sharing a module and line cannot be
+ * told apart on the wire and are reported as an error.
+ */
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <regex>
+#include <string>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+struct Call
+{
+    unsigned level;
+    unsigned line;
+    std::string module;
+    std::string file;
+    std::string format;
+};
+
+static const std::map<std::string, unsigned> levels = {
+    {"LOG_NONE", 0}, {"LOG_ERROR", 1}, {"LOG_WARN", 2}, {"LOG_INFO", 3}, {"LOG_DEBUG", 4},
+};
+
+int main(int argc, char **argv)
+{
+    std::string out_path;
+    int opt;
+    while ((opt = getopt(argc, argv, "o:h")) != -1)
+    {
+        if (opt == 'o')
+            out_path = optarg;
+        else
+        {
+            fprintf(stderr, "usage: %s [-o dictionary] log.h source.c ...\n", argv[0]);
+            return 2;
+        }
+    }
+
+    const std::regex mod_re(R"(^\s*#define\s+LOG_MOD_(\w+)\s+(\d+))");
+    const std::regex call_re(R"(\bLOG[12]?\s*\(\s*(\w+)\s*,\s*(LOG_\w+)\s*,\s*"((?:[^"\\]|\\.)*)\")");
+    const std::regex open_re(R"(\bLOG[12]?\s*\(\s*\w+\s*,)");
+    const std::regex comment_re(R"(^\s*(\*|//|/\*|#))");
+
+    std::map<std::string, unsigned> modules;
+    std::vector<Call> calls;
+    int errors = 0;
+
+    for (int i = optind; i < argc; i++)
+    {
+        std::ifstream in(argv[i]);
+        if (!in)
+        {
+            fprintf(stderr, "%s: cannot read %s\n", argv[0], argv[i]);
+            return 1;
+        }
+
+        std::string file = argv[i];
+        size_t slash = file.find_last_of('/');
+        if (slash != std::string::npos)
+            file = file.substr(slash + 1);
+
+        std::string line;
+        unsigned lineno = 0;
+        while (std::getline(in, line))
+        {
+            ++lineno;
+            std::smatch m;
+            if (std::regex_search(line, m, mod_re))
+            {
+                modules[m[1]] = static_cast<unsigned>(std::stoul(m[2]));
+                continue;
+            }
+            if (std::regex_search(line, comment_re))
+                continue;
+            if (std::regex_search(line, m, call_re))
+            {
+                auto lvl = levels.find(m[2]);
+                if (lvl == levels.end())
+                {
+                    fprintf(stderr, "%s:%u: unknown level %s\n", file.c_str(), lineno, m[2].str().c_str());
+                    ++errors;
+                    continue;
+                }
+                calls.push_back({lvl->second, lineno, m[1], file, m[3]});
+            }
+            else if (std::regex_search(line, open_re))
+            {
+                // __LINE__ would not match the line the format is found on
+                fprintf(stderr, "%s:%u: log call must fit on one line\n", file.c_str(), lineno);
+                ++errors;
+            }
+        }
+    }
+
+    // module numbers may be defined after use, so resolve them last
+    std::map<std::pair<unsigned, unsigned>, Call> dict;
+    for (const Call &c : calls)
+    {
+        auto mod = modules.find(c.module);
+        if (mod == modules.end())
+        {
+            fprintf(stderr, "%s:%u: unknown module %s\n", c.file.c_str(), c.line, c.module.c_str());
+            ++errors;
+            continue;
+        }
+        auto key = std::make_pair(mod->second, c.line);
+        auto prev = dict.find(key);
+        if (prev != dict.end())
+        {
+            fprintf(stderr, "%s:%u: module %s clashes with %s:%u\n", c.file.c_str(), c.line,
+                    c.module.c_str(), prev->second.file.c_str(), prev->second.line);
+            ++errors;
+            continue;
+        }
+        dict[key] = c;
+    }
+    if (errors)
+        return 1;
+
+    FILE *out = stdout;
+    if (!out_path.empty() && !(out = fopen(out_path.c_str(), "w")))
+    {
+        fprintf(stderr, "%s: cannot write %s\n", argv[0], out_path.c_str());
+        return 1;
+    }
+    fprintf(out, "# module\tline\tlevel\tname\tfile\tformat\n");
+    for (auto &kv : dict)
+        fprintf(out, "%u\t%u\t%u\t%s\t%s\t%s\n", kv.first.first, kv.first.second, kv.second.level,
+                kv.second.module.c_str(), kv.second.file.c_str(), kv.second.format.c_str());
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}
@@ -0,0 +1,120 @@
+/*
+ * File:   storeq.cpp
+ * Author: Kevin Macksamie
+ *
+ * Query a reading store written by collector.
+ *
+ *   storeq [-n node] [-s sensor] [-f from] [-t to] [-c] [-v] store
+ *
+ * from and to are seconds since the epoch, fractions allowed; the range
+ * includes from and excludes to. Node is a node id or a device path from
+ * the store's nodes file. Matching rows are printed as
+ *   <time_us>,<node>,<sensor>,<raw>,<celsius>
+ * or only counted with -c. -v reports how many blocks the query read.
+ */
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+
+#include "reading_store.hpp"
+
+static int64_t parse_time(const char *s)
+{
+    return static_cast<int64_t>(strtod(s, nullptr) * 1e6);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-n node] [-s sensor] [-f from] [-t to] [-c] [-v] store\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    int64_t from = INT64_MIN, to = INT64_MAX;
+    int sensor = store::ANY;
+    std::string node_arg;
+    bool count = false, verbose = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:s:f:t:cvh")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            node_arg = optarg;
+            break;
+        case 's':
+            sensor = atoi(optarg);
+            break;
+        case 'f':
+            from = parse_time(optarg);
+            break;
+        case 't':
+            to = parse_time(optarg);
+            break;
+        case 'c':
+            count = true;
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (optind + 1 != argc)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    store::Reader reader;
+    if (!reader.open(argv[optind]))
+    {
+        fprintf(stderr, "%s: %s: %s\n", argv[0], argv[optind], strerror(errno));
+        return 1;
+    }
+
+    int node = store::ANY;
+    if (!node_arg.empty())
+    {
+        char *end;
+        node = static_cast<int>(strtol(node_arg.c_str(), &end, 10));
+        if (*end)
+        {
+            node = -2;
+            for (const auto &n : reader.nodes())
+                if (n.second == node_arg)
+                    node = n.first;
+            if (node == -2)
+            {
+                fprintf(stderr, "%s: %s: no such node\n", argv[0], node_arg.c_str());
+                return 1;
+            }
+        }
+    }
+
+    store::QueryStats stats;
+    bool ok = reader.query(from, to, node, sensor, [count](const store::Row &r) {
+        if (!count)
+            printf("%" PRId64 ",%u,%u,%d,%.4f\n", r.time_us, r.node, r.sensor, r.raw, r.raw / 16.0);
+    }, &stats);
+    if (!ok)
+    {
+        fprintf(stderr, "%s: %s: %s\n", argv[0], argv[optind], strerror(errno));
+        return 1;
+    }
+
+    if (count)
+        printf("%llu\n", (unsigned long long) stats.rows);
+    if (verbose)
+        fprintf(stderr, "rows %llu, blocks read %llu of %llu\n",
+                (unsigned long long) stats.rows, (unsigned long long) stats.read,
+                (unsigned long long) stats.blocks);
+    return 0;
+}
@@ -0,0 +1,292 @@
+/*
+ * File:   telemdec.cpp
+ * Author: Kevin Macksamie
+ *
+ * Decode the firmware's binary telemetry into CSV or JSON lines.
+ *
+ *   telemdec [-f csv|json] [-b baud] [-d dictionary] [-c command]... [device|file|-]
+ *
+ * CSV records start with the frame kind:
+ *   reading,<seq>,<time_ms>,<sensor>,<raw>,<celsius>
+ *   rom,<seq>,<sensor>,<rom hex, family code first>,<parasite|external>,<present|missing>
+ *   status,<seq>,<uptime_s>,<sensors>,<flags>
+ *   counter,<seq>,<name>,<value>
+ *   log,<seq>,<module>,<level>,<file:line>,"<message>"
+ *   sample,<seq>,<age>,<sensor>,<raw>,<celsius>
+ *   reply,<seq>,<command>,<status>,<value>
+ *   health,<seq>,<sensor>,<backoff>,<no_presence>,<crc>,<por>,<retries>
+ * LOG frames are expanded with the dictionary written by logdict; without
+ * one, or for lines it does not know, the raw module, line and arguments
+ * are printed instead.
+ * JSON output has one object per line with the same fields.
+ */
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "log_dict.hpp"
+#include "serial_port.hpp"
+#include "telem_frame.hpp"
+
+static bool json = false;
+static logdict::Dictionary dict;
+
+static std::string quote(const std::string &s)
+{
+    std::string out;
+    for (char c : s)
+    {
+        if (c == '"' || (json && c == '\\'))
+            out += json ? '\\' : '"';
+        out += c;
+    }
+    return "\"" + out + "\"";
+}
+
+static void print_log(const telem::Frame &f, const logdict::Message &msg)
+{
+    const logdict::Entry *e = dict.find(msg.module, msg.line);
+    std::string module, where, text;
+
+    if (e)
+    {
+        module = e->module;
+        where = e->file + ":" + std::to_string(msg.line);
+        text = logdict::expand(e->format, msg);
+    }
+    else
+    {
+        module = "module" + std::to_string(msg.module);
+        where = "?:" + std::to_string(msg.line);
+        for (unsigned i = 0; i < msg.nargs; i++)
+            text += (i ? " " : "") + std::to_string(msg.args[i]);
+    }
+
+    std::string level = logdict::level_name(msg.level);
+    if (json)
+        printf("{\"type\":\"log\",\"seq\":%u,\"module\":\"%s\",\"level\":\"%s\","
+               "\"where\":\"%s\",\"message\":%s}\n",
+               f.seq, module.c_str(), level.c_str(), where.c_str(), quote(text).c_str());
+    else
+        printf("log,%u,%s,%s,%s,%s\n", f.seq, module.c_str(), level.c_str(), where.c_str(),
+               quote(text).c_str());
+}
+
+static std::string rom_hex(const uint8_t *rom)
+{
+    char buf[17];
+    for (int i = 0; i < 8; i++)
+        snprintf(buf + 2 * i, 3, "%02X", rom[i]);
+    return buf;
+}
+
+static void print_frame(const telem::Frame &f)
+{
+    const std::vector<uint8_t> &p = f.payload;
+
+    switch (f.type)
+    {
+    case TELEM_T_READINGS:
+    {
+        uint16_t time_ms;
+        std::vector<telem::Reading> readings;
+        if (!telem::decode_readings(f, time_ms, readings))
+            break;
+        for (const telem::Reading &r : readings)
+        {
+            if (json)
+                printf("{\"type\":\"reading\",\"seq\":%u,\"time_ms\":%u,\"sensor\":%u,"
+                       "\"raw\":%d,\"celsius\":%.4f}\n",
+                       f.seq, time_ms, r.sensor, r.raw, r.raw / 16.0);
+            else
+                printf("reading,%u,%u,%u,%d,%.4f\n", f.seq, time_ms, r.sensor, r.raw, r.raw / 16.0);
+        }
+        return;
+    }
+    case TELEM_T_ROMS:
+        for (size_t i = 0; i + 9 <= p.size(); i += 9)
+        {
+            std::string hex = rom_hex(&p[i + 1]);
+            unsigned sensor = p[i] & TELEM_ROM_ID;
+            const char *power = (p[i] & TELEM_ROM_PARASITE) ? "parasite" : "external";
+            const char *state = (p[i] & TELEM_ROM_MISSING) ? "missing" : "present";
+            if (json)
+                printf("{\"type\":\"rom\",\"seq\":%u,\"sensor\":%u,\"rom\":\"%s\",\"power\":\"%s\","
+                       "\"state\":\"%s\"}\n",
+                       f.seq, sensor, hex.c_str(), power, state);
+            else
+                printf("rom,%u,%u,%s,%s,%s\n", f.seq, sensor, hex.c_str(), power, state);
+        }
+        return;
+    case TELEM_T_STATUS:
+        if (p.size() < 4)
+            break;
+        if (json)
+            printf("{\"type\":\"status\",\"seq\":%u,\"uptime_s\":%u,\"sensors\":%u,\"flags\":%u}\n",
+                   f.seq, (p[0] << 8) | p[1], p[2], p[3]);
+        else
+            printf("status,%u,%u,%u,%u\n", f.seq, (p[0] << 8) | p[1], p[2], p[3]);
+        return;
+    case TELEM_T_COUNTERS:
+        for (size_t i = 0; i + 3 <= p.size(); i += 3)
+        {
+            std::string name = telem::counter_name(p[i]);
+            unsigned value = (p[i + 1] << 8) | p[i + 2];
+            if (json)
+                printf("{\"type\":\"counter\",\"seq\":%u,\"name\":\"%s\",\"value\":%u}\n",
+                       f.seq, name.c_str(), value);
+            else
+                printf("counter,%u,%s,%u\n", f.seq, name.c_str(), value);
+        }
+        return;
+    case TELEM_T_SAMPLES:
+    {
+        if (p.size() < 2)
+            break;
+        unsigned age = (p[0] << 8) | p[1];
+        for (size_t i = 2; i + 3 <= p.size(); i += 3, age--)
+        {
+            int raw = static_cast<int16_t>((p[i + 1] << 8) | p[i + 2]);
+            if (json)
+                printf("{\"type\":\"sample\",\"seq\":%u,\"age\":%u,\"sensor\":%u,"
+                       "\"raw\":%d,\"celsius\":%.4f}\n",
+                       f.seq, age, p[i], raw, raw / 16.0);
+            else
+                printf("sample,%u,%u,%u,%d,%.4f\n", f.seq, age, p[i], raw, raw / 16.0);
+        }
+        return;
+    }
+    case TELEM_T_REPLY:
+    {
+        if (p.size() < 4)
+            break;
+        std::string cmd = telem::command_name(p[0]);
+        std::string status = telem::status_name(p[1]);
+        unsigned value = (p[2] << 8) | p[3];
+        if (json)
+            printf("{\"type\":\"reply\",\"seq\":%u,\"command\":\"%s\",\"status\":\"%s\","
+                   "\"value\":%u}\n",
+                   f.seq, cmd.c_str(), status.c_str(), value);
+        else
+            printf("reply,%u,%s,%s,%u\n", f.seq, cmd.c_str(), status.c_str(), value);
+        return;
+    }
+    case TELEM_T_HEALTH:
+        for (size_t i = 0; i + 10 <= p.size(); i += 10)
+        {
+            unsigned presence = (p[i + 2] << 8) | p[i + 3];
+            unsigned crc = (p[i + 4] << 8) | p[i + 5];
+            unsigned por = (p[i + 6] << 8) | p[i + 7];
+            unsigned retries = (p[i + 8] << 8) | p[i + 9];
+            if (json)
+                printf("{\"type\":\"health\",\"seq\":%u,\"sensor\":%u,\"backoff\":%u,"
+                       "\"no_presence\":%u,\"crc\":%u,\"por\":%u,\"retries\":%u}\n",
+                       f.seq, p[i], p[i + 1], presence, crc, por, retries);
+            else
+                printf("health,%u,%u,%u,%u,%u,%u,%u\n",
+                       f.seq, p[i], p[i + 1], presence, crc, por, retries);
+        }
+        return;
+    case TELEM_T_LOG:
+    {
+        logdict::Message msg;
+        if (!logdict::decode(f, msg))
+            break;
+        print_log(f, msg);
+        return;
+    }
+    default:
+        break;
+    }
+
+    if (json)
+        printf("{\"type\":\"%s\",\"seq\":%u,\"len\":%zu}\n",
+               telem::type_name(f.type).c_str(), f.seq, p.size());
+    else
+        printf("%s,%u,%zu\n", telem::type_name(f.type).c_str(), f.seq, p.size());
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-f csv|json] [-b baud] [-d dictionary] [-c command]... [device|file|-]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned baud = 115200;
+    std::string path = "-";
+    std::vector<std::string> commands;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:b:d:c:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'f':
+            json = strcmp(optarg, "json") == 0;
+            if (!json && strcmp(optarg, "csv") != 0)
+            {
+                usage(argv[0]);
+                return 2;
+            }
+            break;
+        case 'b':
+            baud = static_cast<unsigned>(strtoul(optarg, nullptr, 10));
+            break;
+        case 'c':
+            commands.push_back(std::string(optarg) + "\r");
+            break;
+        case 'd':
+            if (!dict.load(optarg))
+            {
+                fprintf(stderr, "%s: %s: %s\n", argv[0], optarg, strerror(errno));
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (optind < argc)
+        path = argv[optind];
+
+    int fd = serial::open_port(path, baud);
+    if (fd < 0)
+    {
+        fprintf(stderr, "%s: %s: %s\n", argv[0], path.c_str(), strerror(errno));
+        return 1;
+    }
+
+    for (const std::string &cmd : commands)
+    {
+        if (write(fd, cmd.data(), cmd.size()) != static_cast<ssize_t>(cmd.size()))
+        {
+            fprintf(stderr, "%s: %s: cannot send command: %s\n", argv[0], path.c_str(), strerror(errno));
+            return 1;
+        }
+    }
+
+    telem::Parser parser(print_frame);
+    uint8_t buf[4096];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof buf)) > 0 || (n < 0 && errno == EINTR))
+    {
+        if (n > 0)
+        {
+            parser.feed(buf, static_cast<size_t>(n));
+            fflush(stdout);
+        }
+    }
+    close(fd);
+
+    const telem::Stats &st = parser.stats();
+    fprintf(stderr, "frames %llu, crc errors %llu, skipped bytes %llu, sequence gaps %llu\n",
+            (unsigned long long) st.frames, (unsigned long long) st.crc_errors,
+            (unsigned long long) st.skipped, (unsigned long long) st.seq_gaps);
+    return 0;
+}
@@ -0,0 +1,161 @@
+/*
+ * File:   tempcheck.cpp
+ * Author: Kevin Macksamie
+ *
+ * Exhaustive check of the firmware's temperature conversion. Every 12-bit
+ * raw code goes through temp_from_raw(), temp_convert() and temp_format()
+ * in every unit, precision and rounding mode, and is compared against a
+ * floating point reference. temp.c is built twice, once as for the PIC16F913 and once as
+ * for a PIC18 with its hardware multiplier, and both builds are checked.
+ *
+ *   tempcheck [-v]
+ *
+ * Prints each mismatch (all of them with -v, the first few otherwise) and
+ * exits non-zero if there was any.
+ */
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+extern "C" {
+#include "temp.h"
+
+/* temp.c built with -D_PIC18, see the Makefile */
+temp_t temp_from_raw_mul(uint8_t hi, uint8_t lo);
+void temp_convert_mul(temp_t t, uint8_t unit, uint8_t prec, uint8_t rnd, temp_dec_t *out);
+uint8_t temp_format_mul(const temp_dec_t *dec, uint8_t prec, char *str);
+}
+
+#define MAX_REPORTED    10
+
+typedef void (*convert_fn)(temp_t, uint8_t, uint8_t, uint8_t, temp_dec_t *);
+typedef uint8_t (*format_fn)(const temp_dec_t *, uint8_t, char *);
+
+static const struct
+{
+    const char *name;
+    temp_t (*from_raw)(uint8_t, uint8_t);
+    convert_fn convert;
+    format_fn format;
+} builds[] = {
+    { "PIC16F913", temp_from_raw, temp_convert, temp_format },
+    { "PIC18", temp_from_raw_mul, temp_convert_mul, temp_format_mul },
+};
+
+static const char *const unit_names[] = { "C", "F", "K" };
+static bool verbose;
+static unsigned long failures;
+
+/* Degrees in unit for a raw reading */
+static double reference(int raw, unsigned unit)
+{
+    double c = raw / 16.0;
+
+    if (unit == TEMP_UNIT_F)
+        return c * 1.8 + 32;
+    if (unit == TEMP_UNIT_K)
+        return c + 273.15;
+    return c;
+}
+
+static void fail(const char *build, int raw, unsigned unit, unsigned prec, unsigned rnd,
+                 const char *got, const char *want)
+{
+    if (verbose || failures < MAX_REPORTED)
+        printf("%s: raw %d (%.4f degC) %s prec %u %s: got %s, want %s\n", build, raw, raw / 16.0,
+               unit_names[unit], prec, rnd == TEMP_ROUND_NEAREST ? "nearest" : "trunc", got, want);
+    ++failures;
+}
+
+static void check(unsigned b, int raw, unsigned unit, unsigned prec, unsigned rnd)
+{
+    double v, scaled, mag;
+    unsigned long want_mag, pow10 = 1;
+    bool want_neg;
+    temp_dec_t dec;
+    char got[TEMP_STR_LEN + 8], want[32], got_dec[32], want_dec[32];
+    unsigned i;
+    uint8_t len;
+
+    for (i = 0; i < prec; i++)
+        pow10 *= 10;
+
+    // results are whole multiples of 1e-4 degree, so a nudge far below that
+    // and far above the double's error settles exact halves the right way
+    v = reference(raw, unit);
+    scaled = std::fabs(v) * pow10;
+    mag = rnd == TEMP_ROUND_NEAREST ? std::floor(scaled + 0.5 + 1e-7) : std::floor(scaled + 1e-7);
+    want_mag = static_cast<unsigned long>(mag);
+    want_neg = v < 0 && want_mag != 0;
+
+    memset(&dec, 0xA5, sizeof dec);
+    builds[b].convert(static_cast<temp_t>(raw), unit, prec, rnd, &dec);
+    if (dec.mag != want_mag || !dec.neg != !want_neg)
+    {
+        snprintf(got_dec, sizeof got_dec, "{ %u, %u }", dec.neg, static_cast<unsigned>(dec.mag));
+        snprintf(want_dec, sizeof want_dec, "{ %u, %lu }", want_neg ? 1 : 0, want_mag);
+        fail(builds[b].name, raw, unit, prec, rnd, got_dec, want_dec);
+        return;
+    }
+
+    if (prec)
+        snprintf(want, sizeof want, "%c%lu.%0*lu", want_neg ? '-' : '+', want_mag / pow10,
+                 static_cast<int>(prec), want_mag % pow10);
+    else
+        snprintf(want, sizeof want, "%c%lu", want_neg ? '-' : '+', want_mag);
+
+    memset(got, '#', sizeof got);
+    len = builds[b].format(&dec, prec, got);
+    if (len >= TEMP_STR_LEN || got[len] != 0 || strlen(got) != len || strcmp(got, want) != 0)
+    {
+        got[sizeof got - 1] = 0;
+        fail(builds[b].name, raw, unit, prec, rnd, got, want);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long checked = 0;
+    unsigned b, unit, prec, rnd;
+    int raw, opt;
+
+    while ((opt = getopt(argc, argv, "vh")) != -1)
+    {
+        switch (opt)
+        {
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-v]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    for (b = 0; b < sizeof builds / sizeof builds[0]; b++)
+    {
+        // every 12-bit code, sign extended as the scratchpad word is
+        for (raw = -2048; raw < 2048; raw++)
+        {
+            if (builds[b].from_raw(static_cast<uint8_t>(raw >> 8), static_cast<uint8_t>(raw)) != raw)
+            {
+                printf("%s: raw %d: temp_from_raw() gave %d\n", builds[b].name, raw,
+                       builds[b].from_raw(static_cast<uint8_t>(raw >> 8), static_cast<uint8_t>(raw)));
+                ++failures;
+            }
+            for (unit = TEMP_UNIT_C; unit <= TEMP_UNIT_K; unit++)
+                for (prec = 0; prec <= TEMP_PREC_MAX; prec++)
+                    for (rnd = TEMP_ROUND_TRUNC; rnd <= TEMP_ROUND_NEAREST; rnd++)
+                    {
+                        check(b, raw, unit, prec, rnd);
+                        ++checked;
+                    }
+        }
+    }
+
+    if (failures > MAX_REPORTED && !verbose)
+        printf("...\n");
+    printf("%lu conversions checked, %lu failed\n", checked, failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,12 @@
+/*
+ * File:   xc.h
+ * Author: Kevin Macksamie
+ *
+ * Stand-in for the XC8 device header when temp.c is built for tempcheck.
+ * temp.c touches no registers, so nothing is declared here, which also
+ * lets target.h map the PIC18 register names without clashing.
+ */
+#ifndef TEMPCHECK_XC_H
+#define TEMPCHECK_XC_H
+
+#endif